@@ -27,12 +27,14 @@ namespace fs = std::filesystem;
 
 constexpr int benchmark_thread_grid[] = {1, 2, 3, 4, 8};
 constexpr int benchmark_compress_grid[] = {3, 9};
+constexpr std::uint32_t benchmark_block_size_grid[] = {65536, 262144, 1048576, 4194304, 16777216};
 constexpr std::size_t default_benchmark_rows = 10000000;
 constexpr int default_max_reps = 5;
 
 struct benchmark_case {
     int compress_level;
     int nthreads;
+    std::uint32_t block_size;
 };
 
 enum class benchmark_measure {
@@ -58,6 +60,7 @@ struct result_row {
     benchmark_measure measure;
     int compress_level;
     int nthreads;
+    std::uint32_t block_size;
     int reps;
     stats timing;
 };
@@ -66,6 +69,7 @@ struct result_key {
     benchmark_measure measure;
     int compress_level;
     int nthreads;
+    std::uint32_t block_size;
 
     bool operator<(const result_key& other) const {
         if(nthreads != other.nthreads) {
@@ -74,6 +78,9 @@ struct result_key {
         if(compress_level != other.compress_level) {
             return compress_level < other.compress_level;
         }
+        if(block_size != other.block_size) {
+            return block_size < other.block_size;
+        }
         return static_cast<int>(measure) < static_cast<int>(other.measure);
     }
 };
@@ -208,7 +215,8 @@ std::vector<benchmark_sample> shuffled_samples(const int reps) {
     samples.reserve(
         static_cast<std::size_t>(reps) *
         std::size(benchmark_compress_grid) *
-        std::size(benchmark_thread_grid)
+        std::size(benchmark_thread_grid) *
+        std::size(benchmark_block_size_grid)
     );
 
     std::random_device rd;
@@ -216,7 +224,9 @@ std::vector<benchmark_sample> shuffled_samples(const int reps) {
     for(int rep = 0; rep < reps; ++rep) {
         for(const int compress_level : benchmark_compress_grid) {
             for(const int nthreads : benchmark_thread_grid) {
-                samples.push_back({{compress_level, nthreads}, rep});
+                for(const std::uint32_t block_size : benchmark_block_size_grid) {
+                    samples.push_back({{compress_level, nthreads, block_size}, rep});
+                }
             }
         }
     }
@@ -264,6 +274,10 @@ double to_mebibytes(const double bytes) {
     return bytes / (1024.0 * 1024.0);
 }
 
+std::uint32_t to_kibibytes(const std::uint32_t bytes) {
+    return bytes / 1024;
+}
+
 struct save_result {
     double elapsed_seconds;
     double file_size_bytes;
@@ -273,9 +287,15 @@ save_result benchmark_save_once(const qdata::object& dataset,
                                 const fs::path& output_file,
                                 const int compress_level,
                                 const bool shuffle,
-                                const int nthreads) {
+                                const int nthreads,
+                                const std::uint32_t block_size) {
+    qdata::write_options options;
+    options.compress_level = compress_level;
+    options.shuffle = shuffle;
+    options.nthreads = nthreads;
+    options.block_size = block_size;
     const auto start = clock_type::now();
-    qdata::save(output_file.string(), dataset, compress_level, shuffle, nthreads);
+    qdata::save(output_file.string(), dataset, options);
     return {
         elapsed_seconds(start, clock_type::now()),
         static_cast<double>(fs::file_size(output_file))
@@ -307,15 +327,16 @@ void print_results(const std::vector<result_row>& rows) {
     std::map<result_key, result_row> row_map;
     for(const auto& row : rows) {
         row_map.emplace(
-            result_key{row.measure, row.compress_level, row.nthreads},
+            result_key{row.measure, row.compress_level, row.nthreads, row.block_size},
             row
         );
     }
 
     const auto median_for = [&](const benchmark_measure measure,
                                 const int compress_level,
-                                const int nthreads) -> std::optional<double> {
-        const auto it = row_map.find(result_key{measure, compress_level, nthreads});
+                                const int nthreads,
+                                const std::uint32_t block_size) -> std::optional<double> {
+        const auto it = row_map.find(result_key{measure, compress_level, nthreads, block_size});
         if(it == row_map.end()) {
             return std::nullopt;
         }
@@ -323,8 +344,8 @@ void print_results(const std::vector<result_row>& rows) {
     };
 
     const auto required_median_for =
-        [&](const benchmark_measure measure, const int compress_level, const int nthreads) {
-            const auto value = median_for(measure, compress_level, nthreads);
+        [&](const benchmark_measure measure, const int compress_level, const int nthreads, const std::uint32_t block_size) {
+            const auto value = median_for(measure, compress_level, nthreads, block_size);
             if(!value.has_value()) {
                 fail("missing aggregated benchmark row");
             }
@@ -347,19 +368,23 @@ void print_results(const std::vector<result_row>& rows) {
         std::cout << "\nthreads = " << nthreads << "\n";
         std::cout << std::left
                   << std::setw(8) << "cl"
+                  << std::setw(12) << "block_kib"
                   << std::setw(14) << "size_mib"
                   << std::setw(18) << "write"
                   << std::setw(18) << "io_read"
                   << "\n";
-        std::cout << std::string(58, '-') << "\n";
+        std::cout << std::string(70, '-') << "\n";
 
         for(const int compress_level : benchmark_compress_grid) {
-            std::cout << std::left
-                      << std::setw(8) << compress_level
-                      << std::setw(14) << to_mebibytes(required_median_for(benchmark_measure::size_bytes, compress_level, nthreads))
-                      << std::setw(18) << format_milliseconds_cell(median_for(benchmark_measure::write, compress_level, nthreads))
-                      << std::setw(18) << format_milliseconds_cell(median_for(benchmark_measure::io_read, compress_level, nthreads))
-                      << "\n";
+            for(const std::uint32_t block_size : benchmark_block_size_grid) {
+                std::cout << std::left
+                          << std::setw(8) << compress_level
+                          << std::setw(12) << to_kibibytes(block_size)
+                          << std::setw(14) << to_mebibytes(required_median_for(benchmark_measure::size_bytes, compress_level, nthreads, block_size))
+                          << std::setw(18) << format_milliseconds_cell(median_for(benchmark_measure::write, compress_level, nthreads, block_size))
+                          << std::setw(18) << format_milliseconds_cell(median_for(benchmark_measure::io_read, compress_level, nthreads, block_size))
+                          << "\n";
+            }
         }
     }
 }
@@ -396,7 +421,8 @@ int main(int argc, char** argv) try {
               << ", reps per configuration: " << max_reps
               << ", shuffle: true"
               << ", thread grid: {1,2,3,4,8}"
-              << ", compress grid: {3,9}\n";
+              << ", compress grid: {3,9}"
+              << ", block size grid (KiB): {64,256,1024,4096,16384}\n";
 
     std::map<result_key, std::vector<double>> timings_by_key;
     const auto samples = shuffled_samples(max_reps);
@@ -409,20 +435,20 @@ int main(int argc, char** argv) try {
         const auto config = sample.config;
         remove_if_exists(sample_file);
 
-        auto& write_timings = timings_by_key[result_key{benchmark_measure::write, config.compress_level, config.nthreads}];
+        auto& write_timings = timings_by_key[result_key{benchmark_measure::write, config.compress_level, config.nthreads, config.block_size}];
         if(write_timings.empty()) {
             write_timings.reserve(static_cast<std::size_t>(max_reps));
         }
-        const auto save = benchmark_save_once(dataset, sample_file, config.compress_level, true, config.nthreads);
+        const auto save = benchmark_save_once(dataset, sample_file, config.compress_level, true, config.nthreads, config.block_size);
         write_timings.push_back(save.elapsed_seconds);
 
-        auto& size_timings = timings_by_key[result_key{benchmark_measure::size_bytes, config.compress_level, config.nthreads}];
+        auto& size_timings = timings_by_key[result_key{benchmark_measure::size_bytes, config.compress_level, config.nthreads, config.block_size}];
         if(size_timings.empty()) {
             size_timings.reserve(static_cast<std::size_t>(max_reps));
         }
         size_timings.push_back(save.file_size_bytes);
 
-        auto& read_timings = timings_by_key[result_key{benchmark_measure::io_read, config.compress_level, config.nthreads}];
+        auto& read_timings = timings_by_key[result_key{benchmark_measure::io_read, config.compress_level, config.nthreads, config.block_size}];
         if(read_timings.empty()) {
             read_timings.reserve(static_cast<std::size_t>(max_reps));
         }
@@ -446,6 +472,7 @@ int main(int argc, char** argv) try {
             key.measure,
             key.compress_level,
             key.nthreads,
+            key.block_size,
             static_cast<int>(timings.size()),
             compute_stats(timings)
         });
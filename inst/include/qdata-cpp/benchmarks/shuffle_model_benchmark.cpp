@@ -0,0 +1,158 @@
+#include "io/zstd_module.h"
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Times the xgboost shuffle model on its own, on the features the shuffle
+// heuristic extracts from a few kinds of 1 MiB blocks, next to the trial
+// compressions that produce those features.
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr std::uint32_t block_bytes = MAX_BLOCKSIZE;
+constexpr int default_predictions = 200000;
+
+[[noreturn]] void fail(const std::string& message) {
+    throw std::runtime_error(message);
+}
+
+int parse_predictions_arg(const char* arg) {
+    const long value = std::strtol(arg, nullptr, 10);
+    if(value <= 0 || value > 100000000) {
+        fail("predictions must be a positive integer up to 100000000");
+    }
+    return static_cast<int>(value);
+}
+
+template <class T>
+std::vector<char> as_block(const std::vector<T>& values) {
+    std::vector<char> block(block_bytes);
+    std::memcpy(block.data(), values.data(), block_bytes);
+    return block;
+}
+
+struct sample_block {
+    std::string name;
+    std::vector<char> data;
+};
+
+std::vector<sample_block> sample_blocks() {
+    std::mt19937_64 rng(42);
+    std::vector<double> smooth(block_bytes / sizeof(double));
+    std::vector<double> noisy(smooth.size());
+    std::normal_distribution<double> normal(0.0, 1.0);
+    for(std::size_t i = 0; i < smooth.size(); ++i) {
+        smooth[i] = std::sin(static_cast<double>(i) * 0.001) * 1000.0;
+        noisy[i] = normal(rng);
+    }
+    std::vector<std::int32_t> counts(block_bytes / sizeof(std::int32_t));
+    std::uniform_int_distribution<std::int32_t> small(0, 1000);
+    for(auto& value : counts) value = small(rng);
+    std::vector<char> text(block_bytes);
+    static const char words[] = "lorem ipsum dolor sit amet consectetur adipiscing elit sed do eiusmod ";
+    std::uniform_int_distribution<std::size_t> word(0, sizeof(words) - 2);
+    for(std::size_t i = 0; i < text.size(); ++i) {
+        text[i] = i % 64 == 0 ? words[word(rng)] : words[i % (sizeof(words) - 1)];
+    }
+    return {
+        {"smooth doubles", as_block(smooth)},
+        {"normal doubles", as_block(noisy)},
+        {"small integers", as_block(counts)},
+        {"text", text}
+    };
+}
+
+// the features use_shuffle_heuristic builds: shuffled and unshuffled sizes of
+// four 32 KiB samples, then the compression level
+std::array<double, 9> heuristic_features(const std::vector<char>& block, const int compress_level, ZSTD_CCtx* cctx) {
+    std::vector<char> shuffled(SHUFFLE_HEURISTIC_BLOCKSIZE);
+    std::vector<char> zbuffer(ZSTD_compressBound(SHUFFLE_HEURISTIC_BLOCKSIZE));
+    std::array<double, 9> features;
+    features[8] = compress_level;
+    for(int i = 0; i < 4; ++i) {
+        const char* sample = block.data() + (block.size() / 4) * i;
+        blosc_shuffle(reinterpret_cast<const std::uint8_t*>(sample), reinterpret_cast<std::uint8_t*>(shuffled.data()),
+                      SHUFFLE_HEURISTIC_BLOCKSIZE, SHUFFLE_ELEMSIZE);
+        const std::size_t shuf = ZSTD_compressCCtx(cctx, zbuffer.data(), zbuffer.size(), shuffled.data(),
+                                                   SHUFFLE_HEURISTIC_BLOCKSIZE, SHUFFLE_HEURISTIC_CL);
+        const std::size_t noshuf = ZSTD_compressCCtx(cctx, zbuffer.data(), zbuffer.size(), sample,
+                                                     SHUFFLE_HEURISTIC_BLOCKSIZE, SHUFFLE_HEURISTIC_CL);
+        if(ZSTD_isError(shuf) || ZSTD_isError(noshuf)) {
+            fail("trial compression failed");
+        }
+        features[i * 2] = static_cast<double>(shuf);
+        features[i * 2 + 1] = static_cast<double>(noshuf);
+    }
+    return features;
+}
+
+} // namespace
+
+int main(int argc, char** argv) try {
+    const int predictions = argc >= 2 ? parse_predictions_arg(argv[1]) : default_predictions;
+    if(argc > 2) {
+        fail("usage: qdata_shuffle_model_benchmark [predictions]");
+    }
+
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    if(cctx == nullptr) {
+        fail("failed to create zstd context");
+    }
+    const auto blocks = sample_blocks();
+
+    std::cout << "Predictions per block kind: " << predictions << "\n\n";
+    std::cout << std::left
+              << std::setw(18) << "block"
+              << std::setw(8) << "cl"
+              << std::setw(14) << "prediction"
+              << std::setw(16) << "predict_ns"
+              << std::setw(16) << "features_us"
+              << "\n";
+    std::cout << std::string(72, '-') << "\n";
+    for(const auto& block : blocks) {
+        for(const int compress_level : {1, 3, 9}) {
+            const auto features_start = clock_type::now();
+            const auto features = heuristic_features(block.data, compress_level, cctx);
+            const double features_seconds = std::chrono::duration<double>(clock_type::now() - features_start).count();
+
+            // the level feature varies so the loop cannot be hoisted
+            std::array<double, 9> varied = features;
+            double sum = 0;
+            const auto predict_start = clock_type::now();
+            for(int i = 0; i < predictions; ++i) {
+                varied[8] = compress_level + (i & 1);
+                sum += XgboostBlockshuffleModel::predict_xgboost_impl(varied);
+            }
+            const double predict_seconds = std::chrono::duration<double>(clock_type::now() - predict_start).count();
+            if(!std::isfinite(sum)) {
+                fail("prediction was not finite");
+            }
+
+            std::cout << std::left << std::fixed
+                      << std::setw(18) << block.name
+                      << std::setw(8) << compress_level
+                      << std::setw(14) << std::setprecision(4) << XgboostBlockshuffleModel::predict_xgboost_impl(features)
+                      << std::setw(16) << std::setprecision(1) << predict_seconds / predictions * 1e9
+                      << std::setw(16) << std::setprecision(1) << features_seconds * 1e6
+                      << "\n";
+        }
+    }
+    ZSTD_freeCCtx(cctx);
+    return 0;
+} catch(const std::exception& e) {
+    std::cerr << "Benchmark failed: " << e.what() << "\n";
+    return 1;
+}
@@ -0,0 +1,92 @@
+#ifndef _QS2_AVX512_TRANSPOSE_H
+#define _QS2_AVX512_TRANSPOSE_H
+
+/* qdata-cpp
+ *
+ * Register transposes shared by the AVX-512BW shuffle and unshuffle kernels.
+ * Each kernel moves 64 elements per iteration: bytes are first regrouped
+ * within registers, then these transposes move the groups across registers.
+ * Every transpose is its own inverse, so unshuffle runs the same steps in
+ * reverse order.
+ */
+
+#include "simd_dispatch.h"
+
+#if defined(QIO_HAS_AVX512)
+
+QIO_AVX512_DIAGNOSTICS_PUSH
+
+// a 16 byte shuffle control repeated in every 128 bit lane
+QIO_TARGET_AVX512
+static inline __m512i lane_shuffle_control_avx512(const uint8_t order[16]) {
+  uint8_t control[sizeof(__m512i)];
+  for (uint64_t i = 0; i < sizeof(control); i++) control[i] = order[i % 16];
+  return _mm512_loadu_si512((const void*)control);
+}
+
+// 128 bit lane k of v[i] <-> 128 bit lane i of v[k]
+QIO_TARGET_AVX512
+static inline void transpose_lanes4x4_avx512(__m512i v[4]) {
+  const __m512i t0 = _mm512_shuffle_i64x2(v[0], v[1], 0x44);
+  const __m512i t1 = _mm512_shuffle_i64x2(v[0], v[1], 0xEE);
+  const __m512i t2 = _mm512_shuffle_i64x2(v[2], v[3], 0x44);
+  const __m512i t3 = _mm512_shuffle_i64x2(v[2], v[3], 0xEE);
+  v[0] = _mm512_shuffle_i64x2(t0, t2, 0x88);
+  v[1] = _mm512_shuffle_i64x2(t0, t2, 0xDD);
+  v[2] = _mm512_shuffle_i64x2(t1, t3, 0x88);
+  v[3] = _mm512_shuffle_i64x2(t1, t3, 0xDD);
+}
+
+// 64 bit word k of v[i] <-> 64 bit word i of v[k]
+QIO_TARGET_AVX512
+static inline void transpose_qwords8x8_avx512(__m512i v[8]) {
+  __m512i a[8], b[8];
+  for (int k = 0; k < 4; k++) {
+    a[k] = _mm512_unpacklo_epi64(v[2*k], v[2*k+1]);
+    a[k+4] = _mm512_unpackhi_epi64(v[2*k], v[2*k+1]);
+  }
+  for (int k = 0; k < 4; k++) {
+    b[2*k] = _mm512_shuffle_i64x2(a[2*k], a[2*k+1], 0x88);
+    b[2*k+1] = _mm512_shuffle_i64x2(a[2*k], a[2*k+1], 0xDD);
+  }
+  v[0] = _mm512_shuffle_i64x2(b[0], b[2], 0x88);
+  v[4] = _mm512_shuffle_i64x2(b[0], b[2], 0xDD);
+  v[2] = _mm512_shuffle_i64x2(b[1], b[3], 0x88);
+  v[6] = _mm512_shuffle_i64x2(b[1], b[3], 0xDD);
+  v[1] = _mm512_shuffle_i64x2(b[4], b[6], 0x88);
+  v[5] = _mm512_shuffle_i64x2(b[4], b[6], 0xDD);
+  v[3] = _mm512_shuffle_i64x2(b[5], b[7], 0x88);
+  v[7] = _mm512_shuffle_i64x2(b[5], b[7], 0xDD);
+}
+
+// within each 128 bit lane, byte k of in[j] -> byte j of out[k]. Four rounds
+// of unpacks transpose 16 registers, but leave the output bytes in bit
+// reversed order unless the inputs are taken in that order.
+QIO_TARGET_AVX512
+static inline void transpose_bytes16x16_avx512(const __m512i in[16], __m512i out[16]) {
+  static const int bit_reversed[16] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+  __m512i x[16], y[16];
+  for (int i = 0; i < 16; i++) x[i] = in[bit_reversed[i]];
+  for (int i = 0; i < 8; i++) {
+    y[2*i] = _mm512_unpacklo_epi8(x[i], x[i+8]);
+    y[2*i+1] = _mm512_unpackhi_epi8(x[i], x[i+8]);
+  }
+  for (int i = 0; i < 8; i++) {
+    x[2*i] = _mm512_unpacklo_epi16(y[i], y[i+8]);
+    x[2*i+1] = _mm512_unpackhi_epi16(y[i], y[i+8]);
+  }
+  for (int i = 0; i < 8; i++) {
+    y[2*i] = _mm512_unpacklo_epi32(x[i], x[i+8]);
+    y[2*i+1] = _mm512_unpackhi_epi32(x[i], x[i+8]);
+  }
+  for (int i = 0; i < 8; i++) {
+    out[2*i] = _mm512_unpacklo_epi64(y[i], y[i+8]);
+    out[2*i+1] = _mm512_unpackhi_epi64(y[i], y[i+8]);
+  }
+}
+
+QIO_AVX512_DIAGNOSTICS_POP
+
+#endif
+
+#endif
@@ -0,0 +1,228 @@
+/* qdata-cpp
+ *
+ * Bit-level shuffle. The layout follows the blocked bitshuffle filter: the
+ * input is cut into chunks of about BITSHUFFLE_CHUNK_BYTES, and the n elements
+ * of a chunk are split into 8 * bytesoftype bit planes, plane p holding bit
+ * (p % 8) of byte (p / 8) of every element. Each chunk is first byte-shuffled
+ * with blosc_shuffle (shuffle_routines.h), then every byte row is
+ * bit-transposed. A chunk's planes take the place of its input, so the
+ * transpose stays within cache.
+ *
+ * Within a chunk, plane p starts at p * (n / 8) bytes and its byte k holds
+ * elements 8k to 8k + 7, element 8k + j in bit j. Elements past the last
+ * multiple of 8 and bytes past the last whole element are copied as is, so
+ * the routines take any blocksize.
+ *
+ * Include after shuffle_routines.h and unshuffle_routines.h. Kernels are chosen
+ * at runtime like theirs (simd_dispatch.h).
+ */
+
+#include <cstdint>
+#include <cstring>
+
+// bytes of input per chunk; chunks are byte shuffled into a stack buffer
+static const uint64_t BITSHUFFLE_CHUNK_BYTES = 16384;
+static const uint64_t BITSHUFFLE_MAX_TYPESIZE = BITSHUFFLE_CHUNK_BYTES / 32;
+
+// transposes an 8x8 bit matrix held in a uint64_t, bit 8i+j <-> bit 8j+i
+static inline uint64_t bit_transpose8(uint64_t x) {
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+// row: n bytes, n a multiple of 8. Bit b of row[i] goes to bit (i % 8) of
+// planes[b * plane_stride + i / 8].
+static inline void bit_transpose_row_generic(const uint8_t* const row, uint8_t* const planes,
+                                             const uint64_t start, const uint64_t n, const uint64_t plane_stride) {
+  for (uint64_t i = start; i < n; i += 8) {
+    uint64_t x = 0;
+    for (int j = 0; j < 8; j++) x |= static_cast<uint64_t>(row[i + j]) << (8 * j);
+    x = bit_transpose8(x);
+    for (int b = 0; b < 8; b++) planes[b * plane_stride + i / 8] = static_cast<uint8_t>(x >> (8 * b));
+  }
+}
+
+static inline void bit_untranspose_row_generic(const uint8_t* const planes, uint8_t* const row,
+                                               const uint64_t start, const uint64_t n, const uint64_t plane_stride) {
+  for (uint64_t i = start; i < n; i += 8) {
+    uint64_t x = 0;
+    for (int b = 0; b < 8; b++) x |= static_cast<uint64_t>(planes[b * plane_stride + i / 8]) << (8 * b);
+    x = bit_transpose8(x);
+    for (int j = 0; j < 8; j++) row[i + j] = static_cast<uint8_t>(x >> (8 * j));
+  }
+}
+
+#if defined(QIO_HAS_AVX2)
+
+// movemask collects the top bit of 32 bytes; shifting left walks down the bits
+QIO_TARGET_AVX2
+static uint64_t bit_transpose_row_avx2(const uint8_t* const row, uint8_t* const planes,
+                                       const uint64_t n, const uint64_t plane_stride) {
+  uint64_t i;
+  for (i = 0; i + sizeof(__m256i) <= n; i += sizeof(__m256i)) {
+    __m256i ymm = _mm256_loadu_si256((const __m256i*)(row + i));
+    for (int b = 7; b >= 0; b--) {
+      const uint32_t bits = static_cast<uint32_t>(_mm256_movemask_epi8(ymm));
+      std::memcpy(planes + b * plane_stride + i / 8, &bits, sizeof(bits));
+      ymm = _mm256_slli_epi16(ymm, 1);
+    }
+  }
+  return i;
+}
+
+// 64 bit lane k gathers byte k of the 8 planes; transposing each lane as in
+// bit_transpose8 yields 8 row bytes
+QIO_TARGET_AVX2
+static uint64_t bit_untranspose_row_avx2(const uint8_t* const planes, uint8_t* const row,
+                                         const uint64_t n, const uint64_t plane_stride) {
+  const __m256i gather4 = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+                                           0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+  const __m256i lanes = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  uint64_t i;
+  for (i = 0; i + sizeof(__m256i) <= n; i += sizeof(__m256i)) {
+    int32_t v[8];
+    for (int b = 0; b < 8; b++) std::memcpy(&v[b], planes + b * plane_stride + i / 8, sizeof(int32_t));
+    __m256i x = _mm256_setr_epi32(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+    x = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(x, gather4), lanes);
+    __m256i t;
+    t = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 7)), _mm256_set1_epi64x(0x00AA00AA00AA00AALL));
+    x = _mm256_xor_si256(_mm256_xor_si256(x, t), _mm256_slli_epi64(t, 7));
+    t = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 14)), _mm256_set1_epi64x(0x0000CCCC0000CCCCLL));
+    x = _mm256_xor_si256(_mm256_xor_si256(x, t), _mm256_slli_epi64(t, 14));
+    t = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 28)), _mm256_set1_epi64x(0x00000000F0F0F0F0LL));
+    x = _mm256_xor_si256(_mm256_xor_si256(x, t), _mm256_slli_epi64(t, 28));
+    _mm256_storeu_si256((__m256i*)(row + i), x);
+  }
+  return i;
+}
+
+#endif
+
+#if defined(QIO_HAS_SSE2)
+
+QIO_TARGET_SSE2
+static uint64_t bit_transpose_row_sse2(const uint8_t* const row, uint8_t* const planes,
+                                       const uint64_t n, const uint64_t plane_stride) {
+  uint64_t i;
+  for (i = 0; i + sizeof(__m128i) <= n; i += sizeof(__m128i)) {
+    __m128i xmm = _mm_loadu_si128((const __m128i*)(row + i));
+    for (int b = 7; b >= 0; b--) {
+      const uint16_t bits = static_cast<uint16_t>(_mm_movemask_epi8(xmm));
+      std::memcpy(planes + b * plane_stride + i / 8, &bits, sizeof(bits));
+      xmm = _mm_slli_epi16(xmm, 1);
+    }
+  }
+  return i;
+}
+
+QIO_TARGET_SSE2
+static uint64_t bit_untranspose_row_sse2(const uint8_t* const planes, uint8_t* const row,
+                                         const uint64_t n, const uint64_t plane_stride) {
+  const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t i;
+  for (i = 0; i + sizeof(__m128i) <= n; i += sizeof(__m128i)) {
+    int16_t v[8];
+    for (int b = 0; b < 8; b++) std::memcpy(&v[b], planes + b * plane_stride + i / 8, sizeof(int16_t));
+    __m128i x = _mm_setr_epi16(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+    x = _mm_unpacklo_epi64(_mm_packus_epi16(_mm_and_si128(x, low_bytes), zero),
+                           _mm_packus_epi16(_mm_srli_epi16(x, 8), zero));
+    __m128i t;
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 7)), _mm_set1_epi64x(0x00AA00AA00AA00AALL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 7));
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 14)), _mm_set1_epi64x(0x0000CCCC0000CCCCLL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 14));
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 28)), _mm_set1_epi64x(0x00000000F0F0F0F0LL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 28));
+    _mm_storeu_si128((__m128i*)(row + i), x);
+  }
+  return i;
+}
+
+#endif
+
+static inline void bit_transpose_row(const uint8_t* const row, uint8_t* const planes,
+                                     const uint64_t n, const uint64_t plane_stride) {
+  uint64_t start = 0;
+  switch(qio_simd_level()) {
+#if defined(QIO_HAS_AVX2)
+#if defined(QIO_HAS_AVX512)
+  case QIO_SIMD_AVX512: // no wider bit transpose
+#endif
+  case QIO_SIMD_AVX2:
+    start = bit_transpose_row_avx2(row, planes, n, plane_stride);
+    break;
+#endif
+#if defined(QIO_HAS_SSE2)
+  case QIO_SIMD_SSE2:
+    start = bit_transpose_row_sse2(row, planes, n, plane_stride);
+    break;
+#endif
+  default:
+    break;
+  }
+  bit_transpose_row_generic(row, planes, start, n, plane_stride);
+}
+
+static inline void bit_untranspose_row(const uint8_t* const planes, uint8_t* const row,
+                                       const uint64_t n, const uint64_t plane_stride) {
+  uint64_t start = 0;
+  switch(qio_simd_level()) {
+#if defined(QIO_HAS_AVX2)
+#if defined(QIO_HAS_AVX512)
+  case QIO_SIMD_AVX512: // no wider bit transpose
+#endif
+  case QIO_SIMD_AVX2:
+    start = bit_untranspose_row_avx2(planes, row, n, plane_stride);
+    break;
+#endif
+#if defined(QIO_HAS_SSE2)
+  case QIO_SIMD_SSE2:
+    start = bit_untranspose_row_sse2(planes, row, n, plane_stride);
+    break;
+#endif
+  default:
+    break;
+  }
+  bit_untranspose_row_generic(planes, row, start, n, plane_stride);
+}
+
+// bitshuffle dispatcher; bytesoftype at most BITSHUFFLE_MAX_TYPESIZE
+static void bitshuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
+  uint8_t scratch[BITSHUFFLE_CHUNK_BYTES];
+  const uint64_t total_elements = (blocksize / bytesoftype) & ~uint64_t(7);
+  const uint64_t chunk_elements = (BITSHUFFLE_CHUNK_BYTES / bytesoftype) & ~uint64_t(31);
+  for (uint64_t start = 0; start < total_elements; start += chunk_elements) {
+    const uint64_t n = total_elements - start < chunk_elements ? total_elements - start : chunk_elements;
+    uint8_t * const planes = dest + start * bytesoftype;
+    blosc_shuffle(src + start * bytesoftype, scratch, n * bytesoftype, bytesoftype);
+    for (uint64_t r = 0; r < bytesoftype; r++) {
+      bit_transpose_row(scratch + r * n, planes + r * n, n, n / 8);
+    }
+  }
+  const uint64_t done = total_elements * bytesoftype;
+  std::memcpy(dest + done, src + done, blocksize - done);
+}
+
+// bitunshuffle dispatcher; bytesoftype at most BITSHUFFLE_MAX_TYPESIZE
+static void bitunshuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
+  uint8_t scratch[BITSHUFFLE_CHUNK_BYTES];
+  const uint64_t total_elements = (blocksize / bytesoftype) & ~uint64_t(7);
+  const uint64_t chunk_elements = (BITSHUFFLE_CHUNK_BYTES / bytesoftype) & ~uint64_t(31);
+  for (uint64_t start = 0; start < total_elements; start += chunk_elements) {
+    const uint64_t n = total_elements - start < chunk_elements ? total_elements - start : chunk_elements;
+    const uint8_t * const planes = src + start * bytesoftype;
+    for (uint64_t r = 0; r < bytesoftype; r++) {
+      bit_untranspose_row(planes + r * n, scratch + r * n, n, n / 8);
+    }
+    blosc_unshuffle(scratch, dest + start * bytesoftype, n * bytesoftype, bytesoftype);
+  }
+  const uint64_t done = total_elements * bytesoftype;
+  std::memcpy(dest + done, src + done, blocksize - done);
+}
@@ -7,13 +7,8 @@
  */
 
 
-#if defined (__AVX2__)
-#include "immintrin.h"
-#elif defined(__SSE2__)
-#include "emmintrin.h"
-#else
-//no other includes necessary
-#endif
+#include "simd_dispatch.h"
+#include "avx512_transpose.h"
 
 static inline void shuffle_generic_inline(const uint64_t type_size,
                                           const uint64_t vectorizable_elements, const uint64_t blocksize,
@@ -29,8 +24,118 @@ static inline void shuffle_generic_inline(const uint64_t type_size,
   }
 }
 
-#if defined (__AVX2__)
+#if defined(QIO_HAS_AVX512)
+
+QIO_AVX512_DIAGNOSTICS_PUSH
+
+// 64 elements per iteration: regroup bytes within each register, then move
+// the groups across registers (avx512_transpose.h)
+QIO_TARGET_AVX512
+static void shuffle4_avx512(uint8_t* const dest, const uint8_t* const src,
+                            const uint64_t vectorizable_elements, const uint64_t total_elements) {
+  static const uint64_t bytesoftype = 4;
+  /* dword k of each lane gathers byte k of the lane's 4 elements, then dword
+   k of every lane moves to lane k */
+  static const uint8_t byte_order[16] = {0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15};
+  const __m512i bytes = lane_shuffle_control_avx512(byte_order);
+  const __m512i dwords = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+  uint64_t i;
+  int j;
+  __m512i zmm[4];
+
+  for (i = 0; i < vectorizable_elements; i += sizeof(__m512i)) {
+    for (j = 0; j < 4; j++) {
+      zmm[j] = _mm512_loadu_si512((const void*)(src + (i * bytesoftype) + (j * sizeof(__m512i))));
+      zmm[j] = _mm512_permutexvar_epi32(dwords, _mm512_shuffle_epi8(zmm[j], bytes));
+    }
+    transpose_lanes4x4_avx512(zmm);
+    for (j = 0; j < 4; j++) {
+      _mm512_storeu_si512((void*)(dest + i + (j * total_elements)), zmm[j]);
+    }
+  }
+}
+
+QIO_TARGET_AVX512
+static void shuffle8_avx512(uint8_t* const dest, const uint8_t* const src,
+                            const uint64_t vectorizable_elements, const uint64_t total_elements) {
+  static const uint64_t bytesoftype = 8;
+  /* word k of each lane gathers byte k of the lane's 2 elements, then words
+   are grouped so that 64 bit word k holds byte k of the register's 8 elements */
+  static const uint16_t word_order[32] = {0, 8, 16, 24, 1, 9, 17, 25, 2, 10, 18, 26, 3, 11, 19, 27,
+                                          4, 12, 20, 28, 5, 13, 21, 29, 6, 14, 22, 30, 7, 15, 23, 31};
+  static const uint8_t byte_order[16] = {0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15};
+  const __m512i bytes = lane_shuffle_control_avx512(byte_order);
+  const __m512i words = _mm512_loadu_si512((const void*)word_order);
+  uint64_t i;
+  int j;
+  __m512i zmm[8];
+
+  for (i = 0; i < vectorizable_elements; i += sizeof(__m512i)) {
+    for (j = 0; j < 8; j++) {
+      zmm[j] = _mm512_loadu_si512((const void*)(src + (i * bytesoftype) + (j * sizeof(__m512i))));
+      zmm[j] = _mm512_permutexvar_epi16(words, _mm512_shuffle_epi8(zmm[j], bytes));
+    }
+    transpose_qwords8x8_avx512(zmm);
+    for (j = 0; j < 8; j++) {
+      _mm512_storeu_si512((void*)(dest + i + (j * total_elements)), zmm[j]);
+    }
+  }
+}
+
+QIO_TARGET_AVX512
+static void shuffle16_avx512(uint8_t* const dest, const uint8_t* const src,
+                             const uint64_t vectorizable_elements, const uint64_t total_elements) {
+  static const uint64_t bytesoftype = 16;
+  uint64_t i;
+  int j, k;
+  __m512i zmm[16], lanes[4];
+
+  for (i = 0; i < vectorizable_elements; i += sizeof(__m512i)) {
+    /* Gather elements j, 16 + j, 32 + j and 48 + j into zmm[j], so that the
+     byte transpose leaves each row in element order */
+    for (j = 0; j < 4; j++) {
+      for (k = 0; k < 4; k++) {
+        lanes[k] = _mm512_loadu_si512((const void*)(src + ((i + 16 * k + 4 * j) * bytesoftype)));
+      }
+      transpose_lanes4x4_avx512(lanes);
+      for (k = 0; k < 4; k++) zmm[4 * j + k] = lanes[k];
+    }
+    transpose_bytes16x16_avx512(zmm, zmm);
+    for (j = 0; j < 16; j++) {
+      _mm512_storeu_si512((void*)(dest + i + (j * total_elements)), zmm[j]);
+    }
+  }
+}
+
+// runs the AVX-512 kernel for bytesoftype, if there is one, and returns the
+// number of leading elements it handled
+QIO_TARGET_AVX512
+static uint64_t shuffle_avx512(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
+  const uint64_t total_elements = blocksize / bytesoftype;
+  const uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m512i);
+  const uint64_t vectorizable_elements = (blocksize - (blocksize % vectorized_chunk_size)) / bytesoftype;
+  switch(bytesoftype) {
+  case 4:
+    shuffle4_avx512(dest, src, vectorizable_elements, total_elements);
+    return vectorizable_elements;
+  case 8:
+    shuffle8_avx512(dest, src, vectorizable_elements, total_elements);
+    return vectorizable_elements;
+  case 16:
+    shuffle16_avx512(dest, src, vectorizable_elements, total_elements);
+    return vectorizable_elements;
+  default: // no vectorized routine for this element size
+    return 0;
+  }
+}
+
+QIO_AVX512_DIAGNOSTICS_POP
+
+#endif
 
+#if defined(QIO_HAS_AVX2)
+
+QIO_TARGET_AVX2
 static void shuffle8_avx2(uint8_t* const dest, const uint8_t* const src,
                           const uint64_t vectorizable_elements, const uint64_t total_elements) {
   static const uint64_t bytesoftype = 8;
@@ -74,6 +179,7 @@ static void shuffle8_avx2(uint8_t* const dest, const uint8_t* const src,
   }
 }
 
+QIO_TARGET_AVX2
 static void shuffle4_avx2(uint8_t* const dest, const uint8_t* const src,
                           const uint64_t vectorizable_elements, const uint64_t total_elements) {
   static const uint64_t bytesoftype = 4;
@@ -119,8 +225,30 @@ static void shuffle4_avx2(uint8_t* const dest, const uint8_t* const src,
   }
 }
 
-#elif defined(__SSE2__)
+// runs the AVX2 kernel for bytesoftype, if there is one, and returns the
+// number of leading elements it handled
+QIO_TARGET_AVX2
+static uint64_t shuffle_avx2(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
+  const uint64_t total_elements = blocksize / bytesoftype;
+  const uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m256i);
+  const uint64_t vectorizable_elements = (blocksize - (blocksize % vectorized_chunk_size)) / bytesoftype;
+  switch(bytesoftype) {
+  case 4:
+    shuffle4_avx2(dest, src, vectorizable_elements, total_elements);
+    return vectorizable_elements;
+  case 8:
+    shuffle8_avx2(dest, src, vectorizable_elements, total_elements);
+    return vectorizable_elements;
+  default: // no vectorized routine for this element size
+    return 0;
+  }
+}
+
+#endif
 
+#if defined(QIO_HAS_SSE2)
+
+QIO_TARGET_SSE2
 static void
   shuffle8_sse2(uint8_t* const dest, const uint8_t* const src,
                 const uint64_t vectorizable_elements, const uint64_t total_elements) {
@@ -161,6 +289,7 @@ static void
     }
   }
 
+QIO_TARGET_SSE2
 static void shuffle4_sse2(uint8_t* const dest, const uint8_t* const src,
                           const uint64_t vectorizable_elements, const uint64_t total_elements) {
   static const uint64_t bytesoftype = 4;
@@ -197,41 +326,49 @@ static void shuffle4_sse2(uint8_t* const dest, const uint8_t* const src,
   }
 }
 
-#else
-// if neither supported, no other functions needed
-#endif
 
-// shuffle dispatcher
-static void blosc_shuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
-  #if defined (__AVX2__)
-  uint64_t total_elements = blocksize / bytesoftype;
-  uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m256i);
-  uint64_t vectorizable_bytes = blocksize - (blocksize % vectorized_chunk_size);
-  uint64_t vectorizable_elements = vectorizable_bytes / bytesoftype;
-  switch(bytesoftype) {
-  case 4:
-    shuffle4_avx2(dest, src, vectorizable_elements, total_elements);
-    break;
-  case 8:
-    shuffle8_avx2(dest, src, vectorizable_elements, total_elements);
-    break;
-  }
-  if(blocksize != vectorizable_bytes) shuffle_generic_inline(bytesoftype, vectorizable_elements, blocksize, src, dest);
-#elif defined(__SSE2__)
-  uint64_t total_elements = blocksize / bytesoftype;
-  uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m128i);
-  uint64_t vectorizable_bytes = blocksize - (blocksize % vectorized_chunk_size);
-  uint64_t vectorizable_elements = vectorizable_bytes / bytesoftype;
+// runs the SSE2 kernel for bytesoftype, if there is one, and returns the
+// number of leading elements it handled
+QIO_TARGET_SSE2
+static uint64_t shuffle_sse2(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
+  const uint64_t total_elements = blocksize / bytesoftype;
+  const uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m128i);
+  const uint64_t vectorizable_elements = (blocksize - (blocksize % vectorized_chunk_size)) / bytesoftype;
   switch(bytesoftype) {
   case 4:
     shuffle4_sse2(dest, src, vectorizable_elements, total_elements);
-    break;
+    return vectorizable_elements;
   case 8:
     shuffle8_sse2(dest, src, vectorizable_elements, total_elements);
-    break;
+    return vectorizable_elements;
+  default: // no vectorized routine for this element size
+    return 0;
   }
-  if(blocksize != vectorizable_bytes) shuffle_generic_inline(bytesoftype, vectorizable_elements, blocksize, src, dest);
-#else
-  shuffle_generic_inline(bytesoftype, 0, blocksize, src, dest);
+}
+
 #endif
+
+// shuffle dispatcher; the kernel set is chosen at runtime (simd_dispatch.h)
+static void blosc_shuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
+  uint64_t vectorizable_elements = 0;
+  switch(qio_simd_level()) {
+#if defined(QIO_HAS_AVX512)
+  case QIO_SIMD_AVX512:
+    vectorizable_elements = shuffle_avx512(src, dest, blocksize, bytesoftype);
+    break;
+#endif
+#if defined(QIO_HAS_AVX2)
+  case QIO_SIMD_AVX2:
+    vectorizable_elements = shuffle_avx2(src, dest, blocksize, bytesoftype);
+    break;
+#endif
+#if defined(QIO_HAS_SSE2)
+  case QIO_SIMD_SSE2:
+    vectorizable_elements = shuffle_sse2(src, dest, blocksize, bytesoftype);
+    break;
+#endif
+  default:
+    break;
+  }
+  if(blocksize != vectorizable_elements * bytesoftype) shuffle_generic_inline(bytesoftype, vectorizable_elements, blocksize, src, dest);
 }
@@ -0,0 +1,174 @@
+#ifndef _QS2_SIMD_DISPATCH_H
+#define _QS2_SIMD_DISPATCH_H
+
+/* qdata-cpp
+ *
+ * Runtime selection of the shuffle kernels. On x86 with GCC, Clang or MSVC
+ * every kernel is compiled, the wider ones through a target attribute, and
+ * cpuid picks the widest one the machine supports the first time a routine
+ * runs. Binaries built without -mavx2 still use AVX2 or AVX-512 where it is
+ * available.
+ * Other compilers only get the kernels their compile flags enable.
+ */
+
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)) && \
+    (defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+#define QIO_SIMD_RUNTIME_DISPATCH
+#define QIO_HAS_SSE2
+#define QIO_HAS_AVX2
+#define QIO_HAS_AVX512
+#if defined(__GNUC__) || defined(__clang__)
+#define QIO_TARGET_SSE2 __attribute__((target("sse2")))
+#define QIO_TARGET_AVX2 __attribute__((target("avx2")))
+#define QIO_TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#else
+#define QIO_TARGET_SSE2
+#define QIO_TARGET_AVX2
+#define QIO_TARGET_AVX512
+#endif
+#else
+#if defined(__SSE2__)
+#define QIO_HAS_SSE2
+#endif
+#if defined(__AVX2__)
+#define QIO_HAS_AVX2
+#endif
+#if defined(__AVX512BW__)
+#define QIO_HAS_AVX512
+#endif
+#define QIO_TARGET_SSE2
+#define QIO_TARGET_AVX2
+#define QIO_TARGET_AVX512
+#endif
+
+#if defined(QIO_HAS_SSE2) || defined(QIO_HAS_AVX2) || defined(QIO_HAS_AVX512)
+#include <immintrin.h>
+#endif
+
+// GCC 12 reports the undefined pass-through operand inside its own AVX-512
+// intrinsics as uninitialized (GCC bug 105593)
+#if defined(__GNUC__) && !defined(__clang__)
+#define QIO_AVX512_DIAGNOSTICS_PUSH \
+  _Pragma("GCC diagnostic push") \
+  _Pragma("GCC diagnostic ignored \"-Wuninitialized\"") \
+  _Pragma("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+#define QIO_AVX512_DIAGNOSTICS_POP _Pragma("GCC diagnostic pop")
+#else
+#define QIO_AVX512_DIAGNOSTICS_PUSH
+#define QIO_AVX512_DIAGNOSTICS_POP
+#endif
+
+#if defined(QIO_SIMD_RUNTIME_DISPATCH)
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// kernel sets in increasing width; each level implies the ones below it
+enum QioSimdLevel : int {
+  QIO_SIMD_NONE = 0,
+  QIO_SIMD_SSE2 = 1,
+  QIO_SIMD_AVX2 = 2,
+  QIO_SIMD_AVX512 = 3 // AVX-512F and AVX-512BW
+};
+
+#if defined(QIO_SIMD_RUNTIME_DISPATCH)
+
+static inline void qio_cpuid(const uint32_t leaf, uint32_t regs[4]) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int r[4];
+  __cpuidex(r, static_cast<int>(leaf), 0);
+  for (int i = 0; i < 4; i++) regs[i] = static_cast<uint32_t>(r[i]);
+#else
+  __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// register state the OS saves on context switch (XCR0)
+static inline uint64_t qio_xgetbv() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile(".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+static int qio_detect_simd_level() {
+  uint32_t regs[4];
+  qio_cpuid(0, regs);
+  const uint32_t max_leaf = regs[0];
+  if (max_leaf < 1) return QIO_SIMD_NONE;
+  qio_cpuid(1, regs);
+  if ((regs[3] & (1u << 26)) == 0) return QIO_SIMD_NONE; // SSE2
+  int level = QIO_SIMD_SSE2;
+  const bool osxsave = (regs[2] & (1u << 27)) != 0;
+  const bool avx = (regs[2] & (1u << 28)) != 0;
+  if (max_leaf >= 7 && osxsave && avx) {
+    const uint64_t xcr0 = qio_xgetbv();
+    qio_cpuid(7, regs);
+    if ((xcr0 & 0x6) == 0x6 && (regs[1] & (1u << 5)) != 0) { // XMM and YMM state
+      level = QIO_SIMD_AVX2;
+      const uint32_t avx512 = (1u << 16) | (1u << 30); // F and BW
+      if ((xcr0 & 0xE0) == 0xE0 && (regs[1] & avx512) == avx512) level = QIO_SIMD_AVX512; // opmask and ZMM state
+    }
+  }
+  return level;
+}
+
+#else
+
+static int qio_detect_simd_level() {
+#if defined(QIO_HAS_AVX512)
+  return QIO_SIMD_AVX512;
+#elif defined(QIO_HAS_AVX2)
+  return QIO_SIMD_AVX2;
+#elif defined(QIO_HAS_SSE2)
+  return QIO_SIMD_SSE2;
+#else
+  return QIO_SIMD_NONE;
+#endif
+}
+
+#endif
+
+// inline rather than static: one level for the whole program, so a cap set
+// in one translation unit applies to the shuffles of every other one
+inline int& qio_simd_level_slot() {
+  static int level = qio_detect_simd_level();
+  return level;
+}
+
+// kernel set used by blosc_shuffle, blosc_unshuffle and the bitshuffle routines
+static inline int qio_simd_level() {
+  return qio_simd_level_slot();
+}
+
+// Caps the kernel set at level (at most what the machine supports) and
+// returns the level now in use; for tests and benchmarks. Not thread safe
+// against concurrent shuffles.
+static inline int qio_limit_simd_level(const int level) {
+  const int supported = qio_detect_simd_level();
+  qio_simd_level_slot() = level < supported ? (level < QIO_SIMD_NONE ? QIO_SIMD_NONE : level) : supported;
+  return qio_simd_level_slot();
+}
+
+static inline const char* qio_simd_name(const int level) {
+  switch (level) {
+  case QIO_SIMD_AVX512:
+    return "AVX-512";
+  case QIO_SIMD_AVX2:
+    return "AVX2";
+  case QIO_SIMD_SSE2:
+    return "SSE2";
+  default:
+    return "no SIMD";
+  }
+}
+
+#endif
@@ -6,32 +6,131 @@
  */
 
 
-#if defined (__AVX2__)
-#include "immintrin.h"
-#elif defined(__SSE2__)
-#include "emmintrin.h"
-#else
-//no other includes necessary
-#endif
+#include "simd_dispatch.h"
+#include "avx512_transpose.h"
 
+// elements [vectorizable_elements, elements) of a block of total_elements;
+// src and dest may be offset to start at any element (see blosc_unshuffle_elements)
 static inline void unshuffle_generic_inline(const uint64_t type_size,
-                                     const uint64_t vectorizable_elements, const uint64_t blocksize,
+                                     const uint64_t vectorizable_elements, const uint64_t elements,
+                                     const uint64_t total_elements,
                                      const uint8_t* const _src, uint8_t* const _dest) {
   uint64_t i, j;
   
-  /* Calculate the number of elements in the block. */
-  const uint64_t neblock_quot = blocksize / type_size;
-  
   /* Non-optimized unshuffle */
-  for (i = vectorizable_elements; i < neblock_quot; i++) {
+  for (i = vectorizable_elements; i < elements; i++) {
     for (j = 0; j < type_size; j++) {
-      _dest[i*type_size+j] = _src[j*neblock_quot+i];
+      _dest[i*type_size+j] = _src[j*total_elements+i];
+    }
+  }
+}
+
+#if defined(QIO_HAS_AVX512)
+
+QIO_AVX512_DIAGNOSTICS_PUSH
+
+// the shuffle kernels' steps in reverse; each step is its own inverse or
+// uses the inverse permutation
+QIO_TARGET_AVX512
+static void unshuffle4_avx512(uint8_t* const dest, const uint8_t* const src,
+                              const uint64_t vectorizable_elements, const uint64_t total_elements) {
+  static const uint64_t bytesoftype = 4;
+  static const uint8_t byte_order[16] = {0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15};
+  const __m512i bytes = lane_shuffle_control_avx512(byte_order);
+  const __m512i dwords = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+  uint64_t i;
+  int j;
+  __m512i zmm[4];
+
+  for (i = 0; i < vectorizable_elements; i += sizeof(__m512i)) {
+    for (j = 0; j < 4; j++) {
+      zmm[j] = _mm512_loadu_si512((const void*)(src + i + (j * total_elements)));
+    }
+    transpose_lanes4x4_avx512(zmm);
+    for (j = 0; j < 4; j++) {
+      zmm[j] = _mm512_shuffle_epi8(_mm512_permutexvar_epi32(dwords, zmm[j]), bytes);
+      _mm512_storeu_si512((void*)(dest + (i * bytesoftype) + (j * sizeof(__m512i))), zmm[j]);
+    }
+  }
+}
+
+QIO_TARGET_AVX512
+static void unshuffle8_avx512(uint8_t* const dest, const uint8_t* const src,
+                              const uint64_t vectorizable_elements, const uint64_t total_elements) {
+  static const uint64_t bytesoftype = 8;
+  static const uint16_t word_order[32] = {0, 4, 8, 12, 16, 20, 24, 28, 1, 5, 9, 13, 17, 21, 25, 29,
+                                          2, 6, 10, 14, 18, 22, 26, 30, 3, 7, 11, 15, 19, 23, 27, 31};
+  static const uint8_t byte_order[16] = {0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15};
+  const __m512i bytes = lane_shuffle_control_avx512(byte_order);
+  const __m512i words = _mm512_loadu_si512((const void*)word_order);
+  uint64_t i;
+  int j;
+  __m512i zmm[8];
+
+  for (i = 0; i < vectorizable_elements; i += sizeof(__m512i)) {
+    for (j = 0; j < 8; j++) {
+      zmm[j] = _mm512_loadu_si512((const void*)(src + i + (j * total_elements)));
+    }
+    transpose_qwords8x8_avx512(zmm);
+    for (j = 0; j < 8; j++) {
+      zmm[j] = _mm512_shuffle_epi8(_mm512_permutexvar_epi16(words, zmm[j]), bytes);
+      _mm512_storeu_si512((void*)(dest + (i * bytesoftype) + (j * sizeof(__m512i))), zmm[j]);
+    }
+  }
+}
+
+QIO_TARGET_AVX512
+static void unshuffle16_avx512(uint8_t* const dest, const uint8_t* const src,
+                               const uint64_t vectorizable_elements, const uint64_t total_elements) {
+  static const uint64_t bytesoftype = 16;
+  uint64_t i;
+  int j, k;
+  __m512i zmm[16], lanes[4];
+
+  for (i = 0; i < vectorizable_elements; i += sizeof(__m512i)) {
+    for (j = 0; j < 16; j++) {
+      zmm[j] = _mm512_loadu_si512((const void*)(src + i + (j * total_elements)));
+    }
+    /* zmm[j] now holds elements j, 16 + j, 32 + j and 48 + j */
+    transpose_bytes16x16_avx512(zmm, zmm);
+    for (j = 0; j < 4; j++) {
+      for (k = 0; k < 4; k++) lanes[k] = zmm[4 * j + k];
+      transpose_lanes4x4_avx512(lanes);
+      for (k = 0; k < 4; k++) {
+        _mm512_storeu_si512((void*)(dest + ((i + 16 * k + 4 * j) * bytesoftype)), lanes[k]);
+      }
     }
   }
 }
 
-#if defined (__AVX2__)
+// runs the AVX-512 kernel for bytesoftype, if there is one, to up to
+// `elements` elements of a block of total_elements, and returns how many it handled
+QIO_TARGET_AVX512
+static uint64_t unshuffle_avx512(const uint8_t * const src, uint8_t * const dest, const uint64_t elements,
+                                const uint64_t total_elements, const uint64_t bytesoftype) {
+  const uint64_t vectorizable_elements = elements - (elements % sizeof(__m512i));
+  switch(bytesoftype) {
+  case 4:
+    unshuffle4_avx512(dest, src, vectorizable_elements, total_elements);
+    return vectorizable_elements;
+  case 8:
+    unshuffle8_avx512(dest, src, vectorizable_elements, total_elements);
+    return vectorizable_elements;
+  case 16:
+    unshuffle16_avx512(dest, src, vectorizable_elements, total_elements);
+    return vectorizable_elements;
+  default: // no vectorized routine for this element size
+    return 0;
+  }
+}
+
+QIO_AVX512_DIAGNOSTICS_POP
+
+#endif
 
+#if defined(QIO_HAS_AVX2)
+
+QIO_TARGET_AVX2
 static void unshuffle4_avx2(uint8_t* const dest, const uint8_t* const src,
                             const uint64_t vectorizable_elements, const uint64_t total_elements) {
   static const uint64_t bytesoftype = 4;
@@ -71,6 +170,7 @@ static void unshuffle4_avx2(uint8_t* const dest, const uint8_t* const src,
   }
 }
 
+QIO_TARGET_AVX2
 static void unshuffle8_avx2(uint8_t* const dest, const uint8_t* const src,
                   const uint64_t vectorizable_elements, const uint64_t total_elements) {
   static const uint64_t bytesoftype = 8;
@@ -124,8 +224,29 @@ static void unshuffle8_avx2(uint8_t* const dest, const uint8_t* const src,
 
 
 
-#elif defined(__SSE2__)
+// runs the AVX2 kernel for bytesoftype, if there is one, to up to
+// `elements` elements of a block of total_elements, and returns how many it handled
+QIO_TARGET_AVX2
+static uint64_t unshuffle_avx2(const uint8_t * const src, uint8_t * const dest, const uint64_t elements,
+                                const uint64_t total_elements, const uint64_t bytesoftype) {
+  const uint64_t vectorizable_elements = elements - (elements % sizeof(__m256i));
+  switch(bytesoftype) {
+  case 4:
+    unshuffle4_avx2(dest, src, vectorizable_elements, total_elements);
+    return vectorizable_elements;
+  case 8:
+    unshuffle8_avx2(dest, src, vectorizable_elements, total_elements);
+    return vectorizable_elements;
+  default: // no vectorized routine for this element size
+    return 0;
+  }
+}
+
+#endif
+
+#if defined(QIO_HAS_SSE2)
 
+QIO_TARGET_SSE2
 static void unshuffle4_sse2(uint8_t* const dest, const uint8_t* const src,
                   const uint64_t vectorizable_elements, const uint64_t total_elements) {
     static const uint64_t bytesoftype = 4;
@@ -162,6 +283,7 @@ static void unshuffle4_sse2(uint8_t* const dest, const uint8_t* const src,
   }
 
 /* Routine optimized for unshuffling a buffer for a type size of 8 bytes. */
+QIO_TARGET_SSE2
 static void unshuffle8_sse2(uint8_t* const dest, const uint8_t* const src,
                   const uint64_t vectorizable_elements, const uint64_t total_elements) {
     static const uint64_t bytesoftype = 8;
@@ -208,41 +330,60 @@ static void unshuffle8_sse2(uint8_t* const dest, const uint8_t* const src,
     }
   }
 
-#else
-// if neither supported, no other functions needed
-#endif
 
-// shuffle dispatcher
-static void blosc_unshuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
-  #if defined (__AVX2__)
-  uint64_t total_elements = blocksize / bytesoftype;
-  uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m256i);
-  uint64_t vectorizable_bytes = blocksize - (blocksize % vectorized_chunk_size);
-  uint64_t vectorizable_elements = vectorizable_bytes / bytesoftype;
-  switch(bytesoftype) {
-  case 4:
-    unshuffle4_avx2(dest, src, vectorizable_elements, total_elements);
-    break;
-  case 8:
-    unshuffle8_avx2(dest, src, vectorizable_elements, total_elements);
-    break;
-  }
-  unshuffle_generic_inline(bytesoftype, vectorizable_elements, blocksize, src, dest);
-#elif defined(__SSE2__)
-  uint64_t total_elements = blocksize / bytesoftype;
-  uint64_t vectorized_chunk_size = bytesoftype * sizeof(__m128i);
-  uint64_t vectorizable_bytes = blocksize - (blocksize % vectorized_chunk_size);
-  uint64_t vectorizable_elements = vectorizable_bytes / bytesoftype;
+// runs the SSE2 kernel for bytesoftype, if there is one, to up to
+// `elements` elements of a block of total_elements, and returns how many it handled
+QIO_TARGET_SSE2
+static uint64_t unshuffle_sse2(const uint8_t * const src, uint8_t * const dest, const uint64_t elements,
+                                const uint64_t total_elements, const uint64_t bytesoftype) {
+  const uint64_t vectorizable_elements = elements - (elements % sizeof(__m128i));
   switch(bytesoftype) {
   case 4:
     unshuffle4_sse2(dest, src, vectorizable_elements, total_elements);
-    break;
+    return vectorizable_elements;
   case 8:
     unshuffle8_sse2(dest, src, vectorizable_elements, total_elements);
-    break;
+    return vectorizable_elements;
+  default: // no vectorized routine for this element size
+    return 0;
   }
-  unshuffle_generic_inline(bytesoftype, vectorizable_elements, blocksize, src, dest);
-#else
-  unshuffle_generic_inline(bytesoftype, 0, blocksize, src, dest);
+}
+
+#endif
+
+// Unshuffles elements [first, last) of a shuffled block of total_elements
+// elements into dest, which receives element first at its start. The kernels
+// read each byte plane at a fixed stride, so offsetting src by first selects
+// the range. The kernel set is chosen at runtime (simd_dispatch.h)
+static void blosc_unshuffle_elements(const uint8_t * const src, uint8_t * const dest, const uint64_t total_elements,
+                                     const uint64_t first, const uint64_t last, const uint64_t bytesoftype) {
+  const uint8_t * const range_src = src + first;
+  const uint64_t elements = last - first;
+  uint64_t vectorizable_elements = 0;
+  switch(qio_simd_level()) {
+#if defined(QIO_HAS_AVX512)
+  case QIO_SIMD_AVX512:
+    vectorizable_elements = unshuffle_avx512(range_src, dest, elements, total_elements, bytesoftype);
+    break;
+#endif
+#if defined(QIO_HAS_AVX2)
+  case QIO_SIMD_AVX2:
+    vectorizable_elements = unshuffle_avx2(range_src, dest, elements, total_elements, bytesoftype);
+    break;
+#endif
+#if defined(QIO_HAS_SSE2)
+  case QIO_SIMD_SSE2:
+    vectorizable_elements = unshuffle_sse2(range_src, dest, elements, total_elements, bytesoftype);
+    break;
 #endif
+  default:
+    break;
+  }
+  unshuffle_generic_inline(bytesoftype, vectorizable_elements, elements, total_elements, range_src, dest);
+}
+
+// unshuffle dispatcher for a whole block
+static void blosc_unshuffle(const uint8_t * const src, uint8_t * const dest, const uint64_t blocksize, const uint64_t bytesoftype) {
+  const uint64_t total_elements = blocksize / bytesoftype;
+  blosc_unshuffle_elements(src, dest, total_elements, 0, total_elements, bytesoftype);
 }
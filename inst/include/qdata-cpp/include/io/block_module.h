@@ -10,27 +10,48 @@ struct BlockCompressWriter {
     stream_writer & myFile;
     compressor cp;
     hasher hp;
-    std::unique_ptr<char[]> block;
-    std::unique_ptr<char[]> zblock;
+    QioBlock block;
+    QioBlock zblock;
     uint32_t current_blocksize;
+    QioElemsizeTally current_elemsizes;
     const int compress_level;
-    BlockCompressWriter(stream_writer & f, const int compress_level) : 
+    const QioFormat format;
+    const QioWriteOptions options;
+    const uint32_t block_size;
+    const uint32_t min_block_size;
+    const uint32_t max_zblock_size;
+    QioBlockIndex index;
+    BlockCompressWriter(stream_writer & f, const int compress_level, const QioFormat format = QioFormat(),
+                        const QioWriteOptions options = QioWriteOptions()) : 
         myFile(f),
         cp(),
         hp(),
-        block(MAKE_UNIQUE_BLOCK(MAX_BLOCKSIZE)),
-        zblock(MAKE_UNIQUE_BLOCK(MAX_ZBLOCKSIZE)),
+        block(qio_pooled_block(format.block_size())),
+        zblock(qio_pooled_block(format.max_zblock_size())),
         current_blocksize(0),
-        compress_level(compress_level) {}
+        current_elemsizes(),
+        compress_level(compress_level),
+        format(format),
+        options(options),
+        block_size(format.block_size()),
+        min_block_size(format.min_block_size()),
+        max_zblock_size(format.max_zblock_size()),
+        index(format) {
+        qio_set_dictionary(cp, qio_stream_dictionary(format, options.dictionary));
+        qio_set_long_range(cp, format);
+    }
     private:
     // Once per block, so the guard is off the per-push path. The stream may
     // throw (ofstream failbit, or bad_alloc while a memory buffer grows) and
     // this can run underneath R's serializer, where an escaping exception would
     // cross R's C frames. Raise after the catch so the exception object is gone.
-    void write_and_update(const char * const inbuffer, const uint64_t len) {
+    void write_only(const char * const inbuffer, const uint64_t len) {
         bool ok = true;
         try { myFile.write(inbuffer, len); } catch(...) { ok = false; }
         if(!ok) cleanup_and_throw("Failed to write output");
+    }
+    void write_and_update(const char * const inbuffer, const uint64_t len) {
+        write_only(inbuffer, len);
         hp.update(inbuffer, len);
     }
     template <typename POD>
@@ -40,21 +61,43 @@ struct BlockCompressWriter {
         if(!ok) cleanup_and_throw("Failed to write output");
         hp.update(value);
     }
+    void write_zblock(const uint32_t zsize, const uint32_t blocksize) {
+        write_and_update(zsize);
+        // zsize contains metadata, filter it out to get size of write
+        const uint32_t zbytes = compressed_block_size(zsize);
+        if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+            write_only(zblock.get(), zbytes);
+            write_and_update(qio_block_hash(zblock.get(), zbytes));
+        } else {
+            write_and_update(zblock.get(), zbytes);
+        }
+        if(format.has(QIO_FEATURE_BLOCK_INDEX) && !index.add(zsize, blocksize)) {
+            cleanup_and_throw("Failed to allocate block index");
+        }
+    }
+    uint32_t compress_block(const char * const inbuffer, const uint32_t blocksize, const uint32_t elemsize) {
+        uint32_t zsize = cp.compress(zblock.get(), max_zblock_size, inbuffer, blocksize, compress_level,
+                                     format.shuffle_elemsize(elemsize), format.has(QIO_FEATURE_BITSHUFFLE),
+                                     options.shuffle_decision_reuse);
+        if(compressor::is_error(zsize)) {
+            cleanup_and_throw("Compression error");
+        }
+        return qio_store_if_incompressible(format, zblock.get(), zsize, inbuffer, blocksize);
+    }
     void flush() {
         if(current_blocksize > 0) {
-            uint32_t zsize = cp.compress(zblock.get(), MAX_ZBLOCKSIZE, block.get(), current_blocksize, compress_level);
-            if(compressor::is_error(zsize)) {
-                cleanup_and_throw("Compression error");
-            }
-            write_and_update(zsize);
-            // zsize contains metadata, filter it out to get size of write
-            write_and_update(zblock.get(), zsize & (~BLOCK_METADATA));
+            const uint32_t zsize = compress_block(block.get(), current_blocksize, current_elemsizes.elemsize());
+            write_zblock(zsize, current_blocksize);
             current_blocksize = 0;
+            current_elemsizes.clear();
         }
     }
     public:
     uint64_t finish() {
         flush();
+        if(format.has(QIO_FEATURE_BLOCK_INDEX)) {
+            index.write_footer([this](const auto value) { write_and_update(value); });
+        }
         return hp.digest();
     }
     void cleanup() noexcept {
@@ -63,32 +106,29 @@ struct BlockCompressWriter {
     void cleanup_and_throw(const char * const msg) {
         throw_error<error_policy>(msg);
     }
-    void push_data(const char * const inbuffer, const uint64_t len) {
+    // elemsize: element size of the data, used for shuffling with QIO_FEATURE_SHUFFLE_ELEMSIZE
+    void push_data(const char * const inbuffer, const uint64_t len, const uint32_t elemsize = SHUFFLE_ELEMSIZE) {
         uint64_t current_pointer_consumed = 0;
 
         // if data exists in current_block, then append to it first
-        if(current_blocksize >= MAX_BLOCKSIZE) { flush(); }
+        if(current_blocksize >= block_size) { flush(); }
         if(current_blocksize > 0) {
             // append the minimum between remaining_len and remaining_block_space
-            uint32_t add_length = std::min<uint64_t>(len - current_pointer_consumed, MAX_BLOCKSIZE - current_blocksize);
+            uint32_t add_length = std::min<uint64_t>(len - current_pointer_consumed, block_size - current_blocksize);
             std::memcpy(block.get() + current_blocksize, inbuffer + current_pointer_consumed, add_length);
             current_blocksize += add_length;
+            current_elemsizes.add(elemsize, add_length);
             current_pointer_consumed += add_length;
         }
 
         // after appending to non-empty block any additional data push assumes that current_blocksize is zero
         // True bc either inbuffer was fully consumed already (no more data to push) or block was filled and flushed (sets current_blocksize to zero)
-        if(current_blocksize >= MAX_BLOCKSIZE) { flush(); }
-        while(len - current_pointer_consumed >= MAX_BLOCKSIZE) {
-            uint32_t zsize = cp.compress(zblock.get(), MAX_ZBLOCKSIZE, inbuffer + current_pointer_consumed, MAX_BLOCKSIZE, compress_level);
-            if(compressor::is_error(zsize)) {
-                cleanup_and_throw("Compression error");
-            }
-            write_and_update(zsize);
-            // zsize contains metadata, filter it out to get size of write
-            write_and_update(zblock.get(), zsize & (~BLOCK_METADATA));
+        if(current_blocksize >= block_size) { flush(); }
+        while(len - current_pointer_consumed >= block_size) {
+            const uint32_t zsize = compress_block(inbuffer + current_pointer_consumed, block_size, elemsize);
+            write_zblock(zsize, block_size);
             // current_blocksize = 0; // If we are in this loop, current_blocksize is already zero
-            current_pointer_consumed += MAX_BLOCKSIZE;
+            current_pointer_consumed += block_size;
         }
 
         // check if there is any remaining_len after appending full blocks
@@ -96,12 +136,13 @@ struct BlockCompressWriter {
             uint32_t add_length = len - current_pointer_consumed;
             std::memcpy(block.get(), inbuffer + current_pointer_consumed, add_length);
             current_blocksize = add_length;
+            current_elemsizes.add(elemsize, add_length);
             // current_pointer_consumed += add_length; // unnecessary since we are returning now
         }
     }
 
     template<typename POD> void push_pod(const POD pod) {
-        if(current_blocksize > MIN_BLOCKSIZE) { flush(); }
+        if(current_blocksize > min_block_size) { flush(); }
         const char * ptr = reinterpret_cast<const char*>(&pod);
         std::memcpy(block.get() + current_blocksize, ptr, sizeof(POD));
         current_blocksize += sizeof(POD);
@@ -125,60 +166,125 @@ struct BlockCompressReader {
     stream_reader & myFile;
     decompressor dp;
     xxHashEnv hp;
-    std::unique_ptr<char[]> block;
-    std::unique_ptr<char[]> zblock;
+    QioBlock block;
+    QioBlock zblock;
+    const char * block_data; // block, or a stored block's bytes in zblock or the stream
     uint32_t current_blocksize;
     uint32_t data_offset;
-    BlockCompressReader(stream_reader & f) : 
+    const QioFormat format;
+    const uint32_t block_size;
+    const uint32_t max_zblock_size;
+    uint64_t blocks_read;
+    uint64_t first_corrupt_block;
+    const std::shared_ptr<const QioDictionary> dictionary; // kept alive for dp
+    BlockCompressReader(stream_reader & f, const QioFormat format = QioFormat(), const QioReadOptions options = QioReadOptions()) : 
         myFile(f),
         dp(),
         hp(),
-        block(MAKE_UNIQUE_BLOCK(MAX_BLOCKSIZE)),
-        zblock(MAKE_UNIQUE_BLOCK(MAX_ZBLOCKSIZE)),
+        block(qio_pooled_block(format.block_size())),
+        zblock(qio_pooled_block(format.max_zblock_size())),
+        block_data(block.get()),
         current_blocksize(0), 
-        data_offset(0) {}
+        data_offset(0),
+        format(format),
+        block_size(format.block_size()),
+        max_zblock_size(format.max_zblock_size()),
+        blocks_read(0),
+        first_corrupt_block(QIO_NO_CORRUPT_BLOCK),
+        dictionary(options.dictionary) {
+        qio_set_dictionary(dp, qio_stream_dictionary(format, dictionary));
+        qio_set_long_range(dp, format);
+    }
     private:
-    void decompress_block() {
-        uint32_t zsize;
+    // reads and hashes the next compressed block; the returned pointer is either
+    // zblock or, for streams that can lend their buffer, a pointer into the stream
+    const char * read_zblock(uint32_t & zsize) {
         bool ok = myFile.readInteger(zsize);
-        if(!ok) {
+        if(!ok || zsize == BLOCK_STREAM_TERMINATOR) {
             cleanup_and_throw("Unexpected end of file while reading next block size");
         }
         const uint32_t zbytes = compressed_block_size(zsize);
-        if(!compressed_block_size_fits_buffer(zsize)) {
+        if(!compressed_block_size_fits_buffer(zsize, format)) {
             cleanup_and_throw("Compressed block size exceeds internal maximum");
         }
         hp.update(zsize);
-        uint32_t bytes_read = myFile.read(zblock.get(), zbytes);
+        const char * zdata = nullptr;
+        uint32_t bytes_read = qio_read_or_borrow(myFile, zblock.get(), zdata, zbytes);
         if(bytes_read != zbytes) {
             cleanup_and_throw("Unexpected end of file while reading next block");
         }
-        hp.update(zblock.get(), bytes_read);
-        current_blocksize = dp.decompress(block.get(), MAX_BLOCKSIZE, zblock.get(), zsize);
-        if(decompressor::is_error(current_blocksize)) { cleanup_and_throw("Decompression error"); }
+        if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+            uint64_t stored_block_hash;
+            if(!myFile.readInteger(stored_block_hash)) {
+                cleanup_and_throw("Unexpected end of file while reading block hash");
+            }
+            hp.update(stored_block_hash);
+            if(qio_block_hash(zdata, bytes_read) != stored_block_hash && first_corrupt_block == QIO_NO_CORRUPT_BLOCK) {
+                first_corrupt_block = blocks_read;
+            }
+        } else {
+            hp.update(zdata, bytes_read);
+        }
+        blocks_read++;
+        return zdata;
     }
-    void decompress_direct(char * outbuffer) {
+    // corrupted data usually fails to decompress before the hash can be compared
+    const char * decompression_error_message() const {
+        return first_corrupt_block == QIO_NO_CORRUPT_BLOCK ? "Decompression error" : "Block checksum mismatch";
+    }
+    bool stored_block(const uint32_t zsize) {
+        if(!format.has(QIO_FEATURE_STORED_BLOCKS) || !is_stored_block(zsize)) return false;
+        if(compressed_block_size(zsize) > block_size) { cleanup_and_throw("Corrupted block data"); }
+        return true;
+    }
+    // a stored block is read in place: zdata stays valid until the next read_zblock,
+    // which only happens once this block has been consumed
+    void decompress_block() {
         uint32_t zsize;
-        bool ok = myFile.readInteger(zsize);
-        if(!ok) {
-            cleanup_and_throw("Unexpected end of file while reading next block size");
+        const char * zdata = read_zblock(zsize);
+        if(stored_block(zsize)) {
+            block_data = zdata;
+            current_blocksize = compressed_block_size(zsize);
+            return;
         }
-        const uint32_t zbytes = compressed_block_size(zsize);
-        if(!compressed_block_size_fits_buffer(zsize)) {
-            cleanup_and_throw("Compressed block size exceeds internal maximum");
+        block_data = block.get();
+        current_blocksize = dp.decompress(block.get(), block_size, zdata, zsize);
+        if(decompressor::is_error(current_blocksize)) { cleanup_and_throw(decompression_error_message()); }
+    }
+    void decompress_direct(char * outbuffer) {
+        uint32_t zsize;
+        const char * zdata = read_zblock(zsize);
+        if(stored_block(zsize)) {
+            current_blocksize = compressed_block_size(zsize);
+            std::memcpy(outbuffer, zdata, current_blocksize);
+            return;
         }
-        hp.update(zsize);
-        uint32_t bytes_read = myFile.read(zblock.get(), zbytes);
-        if(bytes_read != zbytes) {
-            cleanup_and_throw("Unexpected end of file while reading next block");
+        current_blocksize = dp.decompress(outbuffer, block_size, zdata, zsize);
+        if(decompressor::is_error(current_blocksize)) { cleanup_and_throw(decompression_error_message()); }
+    }
+    // decompress_block for a read that ends inside the block: its first head_len
+    // bytes go straight to head, and the block keeps the rest for later reads
+    void decompress_block_split(char * head, const uint32_t head_len) {
+        uint32_t zsize;
+        const char * zdata = read_zblock(zsize);
+        if(stored_block(zsize)) {
+            block_data = zdata;
+            current_blocksize = compressed_block_size(zsize);
+            if(current_blocksize < head_len) { cleanup_and_throw("Corrupted block data"); }
+            byte_copier::copy(head, block_data, head_len);
+            return;
         }
-        hp.update(zblock.get(), bytes_read);
-        current_blocksize = dp.decompress(outbuffer, MAX_BLOCKSIZE, zblock.get(), zsize);
-        if(decompressor::is_error(current_blocksize)) { cleanup_and_throw("Decompression error"); }
+        block_data = block.get();
+        current_blocksize = dp.decompress_split(head, head_len, block.get(), block_size, zdata, zsize);
+        if(decompressor::is_error(current_blocksize)) { cleanup_and_throw(decompression_error_message()); }
+        if(current_blocksize < head_len) { cleanup_and_throw("Corrupted block data"); }
     }
     public:
     void finish() {
-        // nothing
+        // all blocks have been consumed; the footer is only hashed
+        if(format.has(QIO_FEATURE_BLOCK_INDEX)) {
+            qio_hash_remaining(myFile, hp, zblock.get(), max_zblock_size);
+        }
     }
     void cleanup() noexcept {
         // nothing
@@ -189,14 +295,17 @@ struct BlockCompressReader {
         throw_error<error_policy>(msg);
     }
     uint64_t get_hash_digest() {
-        return hp.digest();
+        return first_corrupt_block == QIO_NO_CORRUPT_BLOCK ? hp.digest() : 0;
+    }
+    uint64_t corrupt_block() const {
+        return first_corrupt_block;
     }
     const char * current_data() {
         if(current_blocksize == data_offset) {
             decompress_block();
             data_offset = 0;
         }
-        return block.get() + data_offset;
+        return block_data + data_offset;
     }
     uint32_t remaining_data() {
         if(current_blocksize == data_offset) {
@@ -213,26 +322,22 @@ struct BlockCompressReader {
     }
     void get_data(char * outbuffer, const uint64_t len) {
         if(current_blocksize - data_offset >= len) {
-            byte_copier::copy(outbuffer, block.get()+data_offset, len);
+            byte_copier::copy(outbuffer, block_data+data_offset, len);
             data_offset += len;
         } else {
             // remainder of current block, may be zero
             uint64_t bytes_accounted = current_blocksize - data_offset;
-            byte_copier::copy(outbuffer, block.get()+data_offset, bytes_accounted);
-            while(len - bytes_accounted >= MAX_BLOCKSIZE) {
+            byte_copier::copy(outbuffer, block_data+data_offset, bytes_accounted);
+            while(len - bytes_accounted >= block_size) {
                 decompress_direct(outbuffer + bytes_accounted);
-                if(current_blocksize != MAX_BLOCKSIZE) {
+                if(current_blocksize != block_size) {
                     cleanup_and_throw("Corrupted block data");
                 }
-                bytes_accounted += MAX_BLOCKSIZE;
-                data_offset = MAX_BLOCKSIZE;
+                bytes_accounted += block_size;
+                data_offset = block_size;
             }
-            if(len - bytes_accounted > 0) { // but less than MAX_BLOCKSIZE
-                decompress_block();
-                if(current_blocksize < len - bytes_accounted) {
-                    cleanup_and_throw("Corrupted block data");
-                }
-                byte_copier::copy(outbuffer + bytes_accounted, block.get(), len - bytes_accounted);
+            if(len - bytes_accounted > 0) { // but less than block_size
+                decompress_block_split(outbuffer + bytes_accounted, len - bytes_accounted);
                 data_offset = len - bytes_accounted;
                 // bytes_accounted += data_offset; // no need to update since we are returning
             }
@@ -241,7 +346,7 @@ struct BlockCompressReader {
 
     const char * get_ptr(const uint64_t len) {
         if(current_blocksize - data_offset >= len) {
-            const char * ptr = block.get() + data_offset;
+            const char * ptr = block_data + data_offset;
             data_offset += len;
             return ptr;
         } else {
@@ -264,7 +369,7 @@ struct BlockCompressReader {
             cleanup_and_throw("Corrupted block data");
         }
         POD pod;
-        memcpy(&pod, block.get()+data_offset, sizeof(POD));
+        memcpy(&pod, block_data+data_offset, sizeof(POD));
         data_offset += sizeof(POD);
         return pod;
     }
@@ -274,7 +379,7 @@ struct BlockCompressReader {
             cleanup_and_throw("Corrupted block data");
         }
         POD pod;
-        memcpy(&pod, block.get()+data_offset, sizeof(POD));
+        memcpy(&pod, block_data+data_offset, sizeof(POD));
         data_offset += sizeof(POD);
         return pod;
     }
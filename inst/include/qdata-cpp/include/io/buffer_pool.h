@@ -0,0 +1,206 @@
+#ifndef _QS2_BUFFER_POOL_H
+#define _QS2_BUFFER_POOL_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "zstd.h"
+
+// Process-wide pool of the block buffers and zstd contexts the block modules
+// use. A writer or reader borrows them when it is constructed and returns them
+// when it is destroyed, so a run of small saves and reads skips the large
+// allocations, their page faults and the context setup after the first call.
+// Buffers are pooled by exact size: block sizes are powers of two and each has
+// one compressed block size, so the classes stay few. Everything kept counts
+// toward one limit in bytes; what does not fit is freed.
+static constexpr uint64_t QIO_DEFAULT_BUFFER_POOL_LIMIT = uint64_t(64) << 20;
+
+class QioBufferPool {
+    struct SizeClass {
+        uint32_t size;
+        std::vector<char *> buffers;
+    };
+    struct PooledCCtx {
+        ZSTD_CCtx * cctx;
+        uint64_t bytes;
+    };
+    struct PooledDCtx {
+        ZSTD_DCtx * dctx;
+        uint64_t bytes;
+    };
+    std::mutex mutex;
+    uint64_t limit_bytes;
+    uint64_t held_bytes;
+    std::vector<SizeClass> classes;
+    std::vector<PooledCCtx> cctxs;
+    std::vector<PooledDCtx> dctxs;
+
+    // called with the mutex held
+    bool fits(const uint64_t bytes) const {
+        return bytes <= limit_bytes && held_bytes <= limit_bytes - bytes;
+    }
+    void trim() {
+        for(SizeClass & size_class : classes) {
+            while(held_bytes > limit_bytes && !size_class.buffers.empty()) {
+                delete[] size_class.buffers.back();
+                size_class.buffers.pop_back();
+                held_bytes -= size_class.size;
+            }
+        }
+        while(held_bytes > limit_bytes && !cctxs.empty()) {
+            ZSTD_freeCCtx(cctxs.back().cctx);
+            held_bytes -= cctxs.back().bytes;
+            cctxs.pop_back();
+        }
+        while(held_bytes > limit_bytes && !dctxs.empty()) {
+            ZSTD_freeDCtx(dctxs.back().dctx);
+            held_bytes -= dctxs.back().bytes;
+            dctxs.pop_back();
+        }
+    }
+
+    public:
+    QioBufferPool() : mutex(), limit_bytes(QIO_DEFAULT_BUFFER_POOL_LIMIT), held_bytes(0), classes(), cctxs(), dctxs() {}
+    QioBufferPool(const QioBufferPool &) = delete;
+    QioBufferPool & operator=(const QioBufferPool &) = delete;
+
+    // uninitialized; throws std::bad_alloc like new
+    char * acquire_buffer(const uint32_t size) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(SizeClass & size_class : classes) {
+                if(size_class.size == size && !size_class.buffers.empty()) {
+                    char * const buffer = size_class.buffers.back();
+                    size_class.buffers.pop_back();
+                    held_bytes -= size;
+                    return buffer;
+                }
+            }
+        }
+        return new char[size];
+    }
+    void release_buffer(char * const buffer, const uint32_t size) noexcept {
+        if(buffer == nullptr) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(fits(size)) {
+                try {
+                    SizeClass * size_class = nullptr;
+                    for(SizeClass & candidate : classes) {
+                        if(candidate.size == size) size_class = &candidate;
+                    }
+                    if(size_class == nullptr) {
+                        classes.push_back(SizeClass{size, std::vector<char *>()});
+                        size_class = &classes.back();
+                    }
+                    size_class->buffers.push_back(buffer);
+                    held_bytes += size;
+                    return;
+                } catch(...) {}
+            }
+        }
+        delete[] buffer;
+    }
+
+    // nullptr if zstd cannot create a context, as with ZSTD_createCCtx
+    ZSTD_CCtx * acquire_cctx() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!cctxs.empty()) {
+                const PooledCCtx pooled = cctxs.back();
+                cctxs.pop_back();
+                held_bytes -= pooled.bytes;
+                return pooled.cctx;
+            }
+        }
+        return ZSTD_createCCtx();
+    }
+    // parameters set on the context are cleared before it is pooled
+    void release_cctx(ZSTD_CCtx * const cctx) noexcept {
+        if(cctx == nullptr) return;
+        if(!ZSTD_isError(ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters))) {
+            const uint64_t bytes = ZSTD_sizeof_CCtx(cctx);
+            std::lock_guard<std::mutex> lock(mutex);
+            if(fits(bytes)) {
+                try {
+                    cctxs.push_back(PooledCCtx{cctx, bytes});
+                    held_bytes += bytes;
+                    return;
+                } catch(...) {}
+            }
+        }
+        ZSTD_freeCCtx(cctx);
+    }
+    ZSTD_DCtx * acquire_dctx() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!dctxs.empty()) {
+                const PooledDCtx pooled = dctxs.back();
+                dctxs.pop_back();
+                held_bytes -= pooled.bytes;
+                return pooled.dctx;
+            }
+        }
+        return ZSTD_createDCtx();
+    }
+    void release_dctx(ZSTD_DCtx * const dctx) noexcept {
+        if(dctx == nullptr) return;
+        if(!ZSTD_isError(ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters))) {
+            const uint64_t bytes = ZSTD_sizeof_DCtx(dctx);
+            std::lock_guard<std::mutex> lock(mutex);
+            if(fits(bytes)) {
+                try {
+                    dctxs.push_back(PooledDCtx{dctx, bytes});
+                    held_bytes += bytes;
+                    return;
+                } catch(...) {}
+            }
+        }
+        ZSTD_freeDCtx(dctx);
+    }
+
+    // Most bytes kept between calls; 0 turns pooling off. Lowering the limit
+    // frees what no longer fits. Returns the previous limit.
+    uint64_t set_limit(const uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const uint64_t previous = limit_bytes;
+        limit_bytes = bytes;
+        trim();
+        return previous;
+    }
+    uint64_t limit() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return limit_bytes;
+    }
+    // bytes currently kept, buffers and contexts
+    uint64_t held() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return held_bytes;
+    }
+};
+
+// Never destroyed, so writers and readers that outlive static destruction,
+// e.g. in other static objects, can still return their buffers.
+inline QioBufferPool & qio_buffer_pool() {
+    static QioBufferPool * const pool = new QioBufferPool();
+    return *pool;
+}
+
+// A block buffer that goes back to the pool instead of being freed
+struct QioPooledDeleter {
+    uint32_t size;
+    QioPooledDeleter() : size(0) {}
+    explicit QioPooledDeleter(const uint32_t size) : size(size) {}
+    void operator()(char * const buffer) const noexcept {
+        qio_buffer_pool().release_buffer(buffer, size);
+    }
+};
+using QioBlock = std::unique_ptr<char[], QioPooledDeleter>;
+
+inline QioBlock qio_pooled_block(const uint32_t size) {
+    return QioBlock(qio_buffer_pool().acquire_buffer(size), QioPooledDeleter(size));
+}
+
+#endif
@@ -31,6 +31,15 @@ struct IfStreamReader {
         con.seekg(pos);
     }
     uint64_t tellg() { return con.tellg(); }
+    // total stream length; the read position is preserved
+    uint64_t size() {
+        con.clear();
+        const std::streampos current = con.tellg();
+        con.seekg(0, std::ios::end);
+        const uint64_t length = con.tellg();
+        con.seekg(current);
+        return length;
+    }
 };
 
 struct OfStreamWriter {
@@ -6,28 +6,233 @@
 #include <memory>
 #include <cstring>
 #include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "error_policy.h"
 
 #include "zstd.h"
+#include "buffer_pool.h"
+#include "zstd_dictionary.h"
 #define XXH_INLINE_ALL
 #include "../xxhash/xxhash.h"
 #undef XXH_INLINE_ALL
 
 #include "../blosc/shuffle_routines.h"
 #include "../blosc/unshuffle_routines.h"
+#include "../blosc/bitshuffle_routines.h"
 
+// Default block size, and the only one before QIO_FEATURE_BLOCK_SIZE. Every
+// block but the last holds exactly the stream's block size.
 static constexpr uint32_t MAX_BLOCKSIZE = 1048576UL;
 static constexpr uint32_t BLOCK_RESERVE = 64UL;
 static constexpr uint32_t MIN_BLOCKSIZE = MAX_BLOCKSIZE - BLOCK_RESERVE; // smallest allowable block size, except for last block
 static constexpr uint32_t MAX_ZBLOCKSIZE = static_cast<uint32_t>(ZSTD_COMPRESSBOUND(MAX_BLOCKSIZE));
-// 2^20 ... we save blocksize as uint32_t, so the last 12 MSBs can be used to store metadata
+// 2^20 ... we save blocksize as uint32_t, so the MSBs above the largest block size can be used to store metadata
 // This blocksize is 2x larger than `qs` and seems to be a better tradeoff overall in benchmarks
 
-// 11111111 11110000 00000000 00000000 in binary, First 12 MSBs can be used for metadata in either zblock or block
-// currently only using the first bit for metadata
-static constexpr uint32_t BLOCK_METADATA = 0x80000000; // 10000000 00000000 00000000 00000000
+// Block sizes selectable at write time, as log2: 64 KiB to 16 MiB. A 16 MiB
+// block compresses to at most 25 bits, leaving the first 7 MSBs for metadata.
+static constexpr uint8_t QIO_DEFAULT_BLOCK_SHIFT = 20;
+static constexpr uint8_t QIO_MIN_BLOCK_SHIFT = 16;
+static constexpr uint8_t QIO_MAX_BLOCK_SHIFT = 24;
+
+// 11111110 00000000 00000000 00000000 in binary, First 7 MSBs can be used for metadata in either zblock or block
+// currently using the first five bits for metadata
+static constexpr uint32_t BLOCK_METADATA = 0xF8000000; // 11111000 00000000 00000000 00000000
 static constexpr uint32_t SHUFFLE_MASK = (1ULL << 31);
+static constexpr uint32_t STORED_MASK = (1ULL << 30); // QIO_FEATURE_STORED_BLOCKS: block data follows uncompressed
+static constexpr uint32_t BITSHUFFLE_MASK = (1ULL << 27); // QIO_FEATURE_BITSHUFFLE: with SHUFFLE_MASK, bit rather than byte shuffled
+// QIO_FEATURE_SHUFFLE_ELEMSIZE: element size a shuffled block was shuffled with,
+// as a 2 bit code. Code 0 is SHUFFLE_ELEMSIZE, the only element size before the
+// feature, so blocks of older streams decode unchanged. Code 3 is reserved and
+// rejected by readers.
+static constexpr uint32_t SHUFFLE_ELEMSIZE_BITS = 0x30000000;
+static constexpr uint32_t SHUFFLE_ELEMSIZE_RESERVED = 0x30000000;
+static constexpr uint32_t SHUFFLE_ELEMSIZE_SHIFT = 28;
+static constexpr uint32_t SHUFFLE_ELEMSIZE = 8;
+
+// Optional block stream features. The writer records them in the reserved
+// header bytes (see file_headers.h) and readers are constructed with the same
+// set, so the layout of the stream is known before the first block is read.
+static constexpr uint8_t QIO_FEATURE_BLOCK_INDEX = 0x01; // block index footer after the last block
+static constexpr uint8_t QIO_FEATURE_BLOCK_HASH = 0x02;  // uint64 hash after each compressed block
+static constexpr uint8_t QIO_FEATURE_BLOCK_SIZE = 0x04;  // block size other than MAX_BLOCKSIZE, log2 stored in the header
+static constexpr uint8_t QIO_FEATURE_STORED_BLOCKS = 0x08; // blocks that do not shrink are stored as is (STORED_MASK)
+static constexpr uint8_t QIO_FEATURE_SHUFFLE_ELEMSIZE = 0x10; // per block shuffle element size (SHUFFLE_ELEMSIZE_BITS)
+static constexpr uint8_t QIO_FEATURE_BITSHUFFLE = 0x20; // shuffle heuristic may pick a bit shuffle (BITSHUFFLE_MASK)
+static constexpr uint8_t QIO_FEATURE_DICTIONARY = 0x40; // blocks are compressed with a zstd dictionary, its ID stored in the header
+static constexpr uint8_t QIO_FEATURE_LONG_RANGE = 0x80; // blocks continue one zstd frame with long distance matching
+// The feature byte is full. Later features go in a second feature byte (header
+// byte 10), which readers require to be zero until one is defined there.
+
+// QIO_FEATURE_LONG_RANGE: log2 of the zstd window, i.e. how far back a match
+// may reach, as with zstd --long. Readers refuse frames with a larger window.
+static constexpr int QIO_LONG_RANGE_WINDOW_LOG = 27;
+
+struct QioFormat {
+    uint8_t features;
+    uint8_t block_shift; // log2 of the block size
+    uint32_t dictionary_id; // QIO_FEATURE_DICTIONARY only
+    QioFormat() : features(0), block_shift(QIO_DEFAULT_BLOCK_SHIFT), dictionary_id(0) {}
+    explicit QioFormat(const uint8_t features) : features(features), block_shift(QIO_DEFAULT_BLOCK_SHIFT), dictionary_id(0) {}
+    bool has(const uint8_t feature) const { return (features & feature) != 0; }
+    uint32_t block_size() const { return uint32_t(1) << block_shift; }
+    uint32_t max_zblock_size() const { return static_cast<uint32_t>(ZSTD_COMPRESSBOUND(block_size())); }
+    // smallest allowable block size, except for last block
+    uint32_t min_block_size() const { return block_size() - BLOCK_RESERVE; }
+    // element size a block writer shuffles pushed data with; without the
+    // feature every block is shuffled as 8 byte elements
+    uint32_t shuffle_elemsize(const uint32_t elemsize) const {
+        return has(QIO_FEATURE_SHUFFLE_ELEMSIZE) ? elemsize : SHUFFLE_ELEMSIZE;
+    }
+    static bool valid_block_shift(const uint8_t shift) {
+        return shift >= QIO_MIN_BLOCK_SHIFT && shift <= QIO_MAX_BLOCK_SHIFT;
+    }
+    // false, leaving the format unchanged, unless block_size is a power of two
+    // in the selectable range. Only a non-default size sets the feature bit.
+    bool set_block_size(const uint32_t block_size) {
+        uint8_t shift = 0;
+        while(shift < 31 && (uint32_t(1) << shift) < block_size) shift++;
+        if((uint32_t(1) << shift) != block_size || !valid_block_shift(shift)) return false;
+        block_shift = shift;
+        if(shift == QIO_DEFAULT_BLOCK_SHIFT) {
+            features &= static_cast<uint8_t>(~QIO_FEATURE_BLOCK_SIZE);
+        } else {
+            features |= QIO_FEATURE_BLOCK_SIZE;
+        }
+        return true;
+    }
+    // blocks are compressed with the dictionary of this ID (QioDictionary::id());
+    // 0 means none
+    void set_dictionary(const uint32_t id) {
+        dictionary_id = id;
+        if(id == 0) {
+            features &= static_cast<uint8_t>(~QIO_FEATURE_DICTIONARY);
+        } else {
+            features |= QIO_FEATURE_DICTIONARY;
+        }
+    }
+    // Every block continues the zstd frame of the blocks before it, so matches
+    // reach back QIO_LONG_RANGE_WINDOW_LOG rather than stopping at the block.
+    // Such a stream must be written and read in order by the single-threaded
+    // block modules (see qio_parallel_blocks), and no block can be stored, as
+    // the reader has to see all of the data to keep the frame in step.
+    void set_long_range(const bool long_range) {
+        if(long_range) {
+            features |= QIO_FEATURE_LONG_RANGE;
+            features &= static_cast<uint8_t>(~QIO_FEATURE_STORED_BLOCKS);
+        } else {
+            features &= static_cast<uint8_t>(~QIO_FEATURE_LONG_RANGE);
+        }
+    }
+};
+
+// Whether the blocks of this format can be compressed and decompressed on their
+// own, as the multithreaded block modules do. Callers pick the single-threaded
+// ones for other streams whatever nthreads is.
+inline bool qio_parallel_blocks(const QioFormat format) {
+    return !format.has(QIO_FEATURE_LONG_RANGE);
+}
+
+// Block modules switch codecs that support it to QIO_FEATURE_LONG_RANGE
+// streaming (the Zstd compressors and decompressors); others, such as test
+// doubles, compress every block on its own.
+template <class codec, class = void>
+struct qio_takes_long_range : std::false_type {};
+
+template <class codec>
+struct qio_takes_long_range<codec, std::void_t<decltype(std::declval<codec&>().set_long_range(true))>> : std::true_type {};
+
+template <class codec>
+inline void qio_set_long_range(codec & c, const QioFormat format) {
+    if constexpr (qio_takes_long_range<codec>::value) {
+        c.set_long_range(format.has(QIO_FEATURE_LONG_RANGE));
+    } else {
+        (void)c;
+        (void)format;
+    }
+}
+
+// The multithreaded block modules run on oneTBB when QIO_HAS_TBB is defined,
+// or else on std::thread when QIO_HAS_THREADS is (link the platform's thread
+// library, e.g. -pthread). Without either, callers use the single-threaded ones.
+#if defined(QIO_HAS_TBB) || defined(QIO_HAS_THREADS)
+#define QIO_HAS_MULTITHREADING 1
+#endif
+
+// Reader settings chosen by the caller rather than recorded in the file. Readers
+// ignore the fields that do not apply to them.
+static constexpr uint32_t QIO_READ_AHEAD_BLOCKS_PER_THREAD = 4;
+struct QioReadOptions {
+    // BlockCompressReaderMT: most blocks read but not yet consumed, bounding its
+    // memory to about this many decompressed and compressed blocks. 0 = 4 per thread.
+    uint32_t read_ahead_blocks;
+    // Format readers: with checksum validation on, hash the blocks as they are
+    // decompressed and check before returning, instead of a hashing pass first.
+    bool single_pass_checksum;
+    // BlockCompressReaderMT: threads to decompress on, which picks the shared
+    // arena it runs in, at most the tbb::global_control limit (the machine's
+    // cores without TBB). 0 = that limit.
+    uint32_t nthreads;
+    // Streams with QIO_FEATURE_DICTIONARY: the dictionary their blocks were
+    // compressed with (see qio_dictionary_error). Ignored for other streams.
+    std::shared_ptr<const QioDictionary> dictionary;
+    QioReadOptions() : read_ahead_blocks(0), single_pass_checksum(false), nthreads(0), dictionary() {}
+};
+
+static constexpr uint32_t QIO_WRITE_BLOCKS_PER_THREAD = 4;
+struct QioWriteOptions {
+    // ZstdShuffleCompressor: following blocks that may reuse a shuffle heuristic
+    // decision instead of sampling their own data. 0 = decide every block.
+    uint32_t shuffle_decision_reuse;
+    // BlockCompressWriterMT: most blocks submitted but not yet written out; the
+    // producer waits once this many are, so a slow stream bounds its memory to
+    // about this many uncompressed and compressed blocks. 0 = 4 per thread.
+    uint32_t write_queue_blocks;
+    // BlockCompressWriterMT: threads to compress on, which picks the shared
+    // arena it runs in, at most the tbb::global_control limit (the machine's
+    // cores without TBB). 0 = that limit.
+    uint32_t nthreads;
+    // Formats with QIO_FEATURE_DICTIONARY: the dictionary to compress with,
+    // whose ID the format records (QioFormat::set_dictionary).
+    std::shared_ptr<const QioDictionary> dictionary;
+    QioWriteOptions() : shuffle_decision_reuse(0), write_queue_blocks(0), nthreads(0), dictionary() {}
+};
+
+// the dictionary a block module uses for a stream of this format, if any
+inline const QioDictionary * qio_stream_dictionary(const QioFormat format, const std::shared_ptr<const QioDictionary> & dictionary) {
+    return format.has(QIO_FEATURE_DICTIONARY) ? dictionary.get() : nullptr;
+}
+
+// Why a reader given this dictionary cannot decompress a stream of this
+// format, or nullptr if it can. Callers check before constructing the reader,
+// which would otherwise only fail on the first block.
+inline const char * qio_dictionary_error(const QioFormat format, const QioDictionary * const dictionary) {
+    if(!format.has(QIO_FEATURE_DICTIONARY)) return nullptr;
+    if(dictionary == nullptr) return "Data was compressed with a zstd dictionary, which must be supplied to read it";
+    if(dictionary->id() != format.dictionary_id) return "Supplied zstd dictionary does not match the one the data was compressed with";
+    return nullptr;
+}
+
+// Block readers report the first block whose data did not match its stored
+// hash; such a stream's hash digest is 0, which never matches a stored hash
+static constexpr uint64_t QIO_NO_CORRUPT_BLOCK = ~uint64_t(0);
+
+// A real block never has a zero size prefix (a zstd frame is never empty), so
+// zero marks the end of the block stream when a footer follows the last block
+static constexpr uint32_t BLOCK_STREAM_TERMINATOR = 0;
+
+// Offsets are relative to the start of the block stream, i.e. the first byte
+// after the file header
+struct QioBlockIndexEntry {
+    uint64_t offset;             // position of the block's uint32 size prefix
+    uint32_t zsize;              // size prefix as stored, including metadata bits
+    uint64_t uncompressed_start; // position of the block's first byte in the uncompressed stream
+};
+static constexpr uint64_t BLOCK_INDEX_ENTRY_BYTES = 20;   // packed: offset, zsize, uncompressed_start
+static constexpr uint64_t BLOCK_INDEX_TRAILER_BYTES = 24; // uncompressed size, block count, footer offset
 
 struct QioByteCopier {
     static void copy(void * const destination, const void * const source, const std::size_t size) {
@@ -39,11 +244,160 @@ inline constexpr uint32_t compressed_block_size(const uint32_t zsize) noexcept {
     return zsize & (~BLOCK_METADATA);
 }
 
-inline constexpr bool compressed_block_size_fits_buffer(const uint32_t zsize) noexcept {
-    return static_cast<uint64_t>(compressed_block_size(zsize)) <= MAX_ZBLOCKSIZE;
+inline constexpr bool is_stored_block(const uint32_t zsize) noexcept {
+    return (zsize & STORED_MASK) != 0;
+}
+
+// With QIO_FEATURE_STORED_BLOCKS, a compressed block that is no smaller than
+// its input is replaced by the input, so reading it back is a copy (or, for
+// streams that lend their buffer, no copy at all) instead of a zstd pass.
+// zblock holds at least max_zblock_size() >= blocksize bytes.
+inline uint32_t qio_store_if_incompressible(const QioFormat format, char * const zblock, const uint32_t zsize,
+                                            const char * const block, const uint32_t blocksize) noexcept {
+    if(!format.has(QIO_FEATURE_STORED_BLOCKS) || format.has(QIO_FEATURE_LONG_RANGE) ||
+       compressed_block_size(zsize) < blocksize) return zsize;
+    std::memcpy(zblock, block, blocksize);
+    return blocksize | STORED_MASK;
+}
+
+// Element sizes with a code: qdata's logical and integer (4), real (8) and
+// complex (16) payloads. Others are shuffled as SHUFFLE_ELEMSIZE.
+inline constexpr uint32_t shuffle_elemsize_code(const uint32_t elemsize) noexcept {
+    return elemsize == 4 ? 1 : elemsize == 16 ? 2 : 0;
 }
 
-// MAKE_UNIQUE_BLOCK and MAKE_SHARED_BLOCK macros should be used ONLY in initializer lists
+inline constexpr uint32_t supported_shuffle_elemsize(const uint32_t elemsize) noexcept {
+    return shuffle_elemsize_code(elemsize) == 0 ? SHUFFLE_ELEMSIZE : elemsize;
+}
+
+// size prefix bits of a block shuffled with elemsize
+inline constexpr uint32_t shuffled_block_metadata(const uint32_t elemsize, const bool bitshuffled = false) noexcept {
+    return SHUFFLE_MASK | (bitshuffled ? BITSHUFFLE_MASK : 0) | (shuffle_elemsize_code(elemsize) << SHUFFLE_ELEMSIZE_SHIFT);
+}
+
+// code 3 never reaches here, compressed_block_size_fits_buffer() rejects it
+inline constexpr uint32_t shuffled_block_elemsize(const uint32_t zsize) noexcept {
+    constexpr uint32_t elemsizes[4] = {SHUFFLE_ELEMSIZE, 4, 16, SHUFFLE_ELEMSIZE};
+    return elemsizes[(zsize & SHUFFLE_ELEMSIZE_BITS) >> SHUFFLE_ELEMSIZE_SHIFT];
+}
+
+// Bytes pushed into the block being filled, by shuffle element size. A block
+// holding several payload types is shuffled for the one that filled most of it.
+struct QioElemsizeTally {
+    uint32_t bytes[3];
+    QioElemsizeTally() : bytes() {}
+    void add(const uint32_t elemsize, const uint32_t len) { bytes[shuffle_elemsize_code(elemsize)] += len; }
+    void clear() { std::fill(bytes, bytes + 3, 0); }
+    uint32_t elemsize() const {
+        constexpr uint32_t elemsizes[3] = {SHUFFLE_ELEMSIZE, 4, 16};
+        return elemsizes[std::max_element(bytes, bytes + 3) - bytes];
+    }
+};
+
+// Stored, element size and bitshuffle bits are part of the size in streams
+// without their feature, where they make it too large
+inline bool compressed_block_size_fits_buffer(const uint32_t zsize, const QioFormat format = QioFormat()) noexcept {
+    if((zsize & STORED_MASK) != 0 && !format.has(QIO_FEATURE_STORED_BLOCKS)) return false;
+    if((zsize & SHUFFLE_ELEMSIZE_BITS) != 0 && !format.has(QIO_FEATURE_SHUFFLE_ELEMSIZE)) return false;
+    if((zsize & SHUFFLE_ELEMSIZE_BITS) == SHUFFLE_ELEMSIZE_RESERVED) return false;
+    if((zsize & BITSHUFFLE_MASK) != 0 && !format.has(QIO_FEATURE_BITSHUFFLE)) return false;
+    return static_cast<uint64_t>(compressed_block_size(zsize)) <= format.max_zblock_size();
+}
+
+// Bytes a block takes in the stream: size prefix, compressed data and, with
+// QIO_FEATURE_BLOCK_HASH, the block hash
+inline uint64_t qio_block_stream_size(const uint32_t zsize, const QioFormat format) noexcept {
+    return sizeof(uint32_t) + compressed_block_size(zsize) + (format.has(QIO_FEATURE_BLOCK_HASH) ? sizeof(uint64_t) : 0);
+}
+
+// Collects the block index as blocks are written, in stream order. Footer layout:
+//   uint32 BLOCK_STREAM_TERMINATOR
+//   per block: uint64 offset, uint32 zsize, uint64 uncompressed_start
+//   uint64 uncompressed size, uint64 block count, uint64 footer offset
+// The fixed size trailer lets a reader find the index from the end of the file.
+struct QioBlockIndex {
+    std::vector<QioBlockIndexEntry> entries;
+    uint64_t stream_offset;
+    uint64_t uncompressed_offset;
+    const QioFormat format;
+    explicit QioBlockIndex(const QioFormat format) : entries(), stream_offset(0), uncompressed_offset(0), format(format) {}
+    // false if the entry could not be stored; the writer decides how to raise
+    bool add(const uint32_t zsize, const uint32_t blocksize) noexcept {
+        try {
+            entries.push_back(QioBlockIndexEntry{stream_offset, zsize, uncompressed_offset});
+        } catch(...) {
+            return false;
+        }
+        stream_offset += qio_block_stream_size(zsize, format);
+        uncompressed_offset += blocksize;
+        return true;
+    }
+    // write_pod is called once per field, so the writer can hash as it goes
+    template <class pod_writer>
+    void write_footer(pod_writer && write_pod) const {
+        const uint64_t footer_offset = stream_offset;
+        write_pod(BLOCK_STREAM_TERMINATOR);
+        for(const QioBlockIndexEntry & entry : entries) {
+            write_pod(entry.offset);
+            write_pod(entry.zsize);
+            write_pod(entry.uncompressed_start);
+        }
+        write_pod(uncompressed_offset);
+        write_pod(static_cast<uint64_t>(entries.size()));
+        write_pod(footer_offset);
+    }
+};
+
+// Readers do not decode the footer, but it is covered by the stored hash, so
+// once the terminator is reached the rest of the stream is hashed as is
+template <class stream_reader, class hasher>
+inline void qio_hash_remaining(stream_reader & reader, hasher & hp, char * const buffer, const uint32_t buffer_size) {
+    uint32_t bytes_read;
+    while( (bytes_read = reader.read(buffer, buffer_size)) > 0 ) {
+        hp.update(buffer, bytes_read);
+    }
+}
+
+// Streams backed by contiguous memory (e.g. MmapFileReader) can lend a pointer
+// into their buffer instead of copying. borrow(ptr, count) advances the read
+// position exactly like read() and returns the number of bytes available; the
+// pointer stays valid for the lifetime of the stream.
+template <class stream_reader, class = void>
+struct qio_can_borrow : std::false_type {};
+
+template <class stream_reader>
+struct qio_can_borrow<stream_reader, std::void_t<decltype(
+    std::declval<stream_reader&>().borrow(std::declval<const char *&>(), uint32_t(0)))>> : std::true_type {};
+
+// points data at count bytes of the stream, copying into buffer only if the stream cannot lend them
+template <class stream_reader>
+inline uint32_t qio_read_or_borrow(stream_reader & reader, char * const buffer, const char *& data, const uint32_t count) {
+    if constexpr (qio_can_borrow<stream_reader>::value) {
+        return reader.borrow(data, count);
+    } else {
+        data = buffer;
+        return reader.read(buffer, count);
+    }
+}
+
+// Where upcoming get_data calls will put their bytes, in stream order
+struct QioPayloadSpan {
+    char * data;
+    uint64_t size;
+};
+
+// Block readers that can decompress into the caller's memory ahead of time
+// (BlockCompressReaderMT) accept plan_payloads(spans): the destinations of
+// the next get_data calls, made back to back with exactly these arguments.
+template <class block_reader, class = void>
+struct qio_can_plan_payloads : std::false_type {};
+
+template <class block_reader>
+struct qio_can_plan_payloads<block_reader, std::void_t<decltype(
+    std::declval<block_reader&>().plan_payloads(std::declval<std::vector<QioPayloadSpan>>()))>> : std::true_type {};
+
+// MAKE_UNIQUE_BLOCK should be used ONLY in initializer lists; block module
+// buffers come from qio_pooled_block() instead
 #define MAKE_UNIQUE_BLOCK(SIZE) std::unique_ptr<char[]>(new char[SIZE])
 
 #if __cplusplus >= 201402L // Check for C++14 or above
@@ -52,26 +406,6 @@ inline constexpr bool compressed_block_size_fits_buffer(const uint32_t zsize) no
     #define MAKE_UNIQUE_BLOCK_CUSTOM(_TYPE_, SIZE) new _TYPE_[SIZE]
 #endif
 
-// Shared char buffer for the multithreaded pipeline (blocks are passed by
-// shared_ptr between TBB flow-graph nodes). qio_make_block<N>() does a single
-// allocation, leaves the bytes uninitialized, and hands back a shared_ptr<char[]>.
-template <std::size_t N>
-struct qio_uninit_block {
-    alignas(16) char data[N];
-    qio_uninit_block() {}  // user-provided + empty => 'data' left uninitialized
-};
-
-template <std::size_t N>
-inline std::shared_ptr<char[]> qio_make_block() {
-    std::shared_ptr<qio_uninit_block<N>> holder = std::make_shared<qio_uninit_block<N>>();
-    char* data = holder->data;  // read before the move below
-    // aliasing ctor: no allocation; move form (C++20) hands off without a refcount op
-    return std::shared_ptr<char[]>(std::move(holder), data);
-}
-
-#define MAKE_SHARED_BLOCK(SIZE)            qio_make_block<SIZE>()
-#define MAKE_SHARED_BLOCK_ASSIGNMENT(SIZE) qio_make_block<SIZE>()
-
 // https://stackoverflow.com/a/36835959/2723734
 #ifndef QDATA_U8_LITERAL_DEFINED
 #define QDATA_U8_LITERAL_DEFINED
@@ -0,0 +1,88 @@
+// include guard
+#ifndef _QS2_MMAP_MODULE_H
+#define _QS2_MMAP_MODULE_H
+
+#include "io_common.h"
+
+// Memory-mapped alternative to IfStreamReader. The whole file is mapped read-only
+// and compressed blocks are lent to the block readers through borrow(), so zstd
+// reads them straight from the page cache without an intermediate copy.
+// POSIX only; QIO_HAS_MMAP is left undefined elsewhere and callers fall back to IfStreamReader.
+
+#if !defined(_WIN32)
+#define QIO_HAS_MMAP 1
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct MmapFileReader {
+    const char * data;
+    uint64_t length;
+    uint64_t position;
+    bool valid;
+    MmapFileReader(const char * const path) : data(nullptr), length(0), position(0), valid(false) {
+        const int fd = ::open(path, O_RDONLY);
+        if(fd < 0) return;
+        struct stat info;
+        if(::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) ||
+           static_cast<uint64_t>(info.st_size) > static_cast<uint64_t>(SIZE_MAX)) {
+            ::close(fd);
+            return;
+        }
+        length = static_cast<uint64_t>(info.st_size);
+        if(length > 0) {
+            void * const mapping = ::mmap(nullptr, static_cast<size_t>(length), PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping == MAP_FAILED) {
+                ::close(fd);
+                length = 0;
+                return;
+            }
+            data = static_cast<const char *>(mapping);
+            // the file is read front to back once: prefetch it and drop pages behind the reader
+#ifdef MADV_SEQUENTIAL
+            ::madvise(mapping, static_cast<size_t>(length), MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+            ::madvise(mapping, static_cast<size_t>(length), MADV_WILLNEED);
+#endif
+        }
+        ::close(fd); // the mapping keeps its own reference to the file
+        valid = true;
+    }
+    ~MmapFileReader() {
+        if(data != nullptr) {
+            ::munmap(const_cast<char *>(data), static_cast<size_t>(length));
+        }
+    }
+    MmapFileReader(const MmapFileReader &) = delete;
+    MmapFileReader & operator=(const MmapFileReader &) = delete;
+    bool isValid() { return valid; }
+    uint32_t borrow(const char *& ptr, const uint32_t count) {
+        const uint64_t bytes = std::min<uint64_t>(count, length - position);
+        ptr = data + position;
+        position += bytes;
+        return static_cast<uint32_t>(bytes);
+    }
+    uint32_t read(char * const ptr, const uint32_t count) {
+        const char * source;
+        const uint32_t bytes = borrow(source, count);
+        if(bytes > 0) {
+            std::memcpy(ptr, source, bytes);
+        }
+        return bytes;
+    }
+    // return whether enough bytes were read to fill the value
+    template <typename T> bool readInteger(T & value) {
+        return read(reinterpret_cast<char*>(&value), sizeof(T)) == sizeof(T);
+    }
+    bool isSeekable() const { return true; }
+    void seekg(const uint64_t pos) { position = std::min(pos, length); }
+    uint64_t tellg() { return position; }
+    uint64_t size() { return length; }
+};
+
+#endif
+
+#endif
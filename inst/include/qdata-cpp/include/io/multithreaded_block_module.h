@@ -5,144 +5,218 @@
 #include "xxhash_module.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <utility>
-#include <tbb/concurrent_queue.h>
-#include <tbb/concurrent_vector.h>
+
+#ifdef QIO_HAS_TBB
 #include <tbb/enumerable_thread_specific.h>
-#include <tbb/flow_graph.h>
-
-// qdata-cpp uses the oneTBB flow-graph API: input_node with a
-// T(tbb::flow_control &) body. Classic TBB (2020.3 and earlier) spells this
-// source_node with a bool(T &) body and is not supported. Classic
-// flow_graph.h pulls in tbb_stddef.h, so the macro is present to catch it
-// here; oneTBB wrappers such as RcppParallel's do not always define it, and
-// for those the missing tbb::flow::input_node is the diagnostic.
+#include <tbb/global_control.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+
+// qdata-cpp requires oneTBB 2021.1 or newer; classic TBB (2020.3 and earlier)
+// is not supported. Classic headers define the interface version through
+// tbb_stddef.h, so the macro is present to catch it here; oneTBB wrappers such
+// as RcppParallel's do not always define it.
 #if defined(TBB_INTERFACE_VERSION) && TBB_INTERFACE_VERSION < 12000
 #error "qdata-cpp requires oneTBB 2021.1 or newer (TBB_INTERFACE_VERSION >= 12000)."
 #endif
 
-struct OrderedBlock {
-    std::shared_ptr<char[]> block;
+using QioTaskArena = tbb::task_arena;
+template <class T> using QioThreadLocal = tbb::enumerable_thread_specific<T>;
+
+// the tbb::global_control limit: by default the machine's cores, or what the
+// application has set
+inline size_t qio_thread_limit() {
+    return tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism);
+}
+
+template <class F>
+void qio_parallel_for(QioTaskArena & arena, const uint64_t n, const F & body) {
+    arena.execute([&] { tbb::parallel_for(uint64_t(0), n, body); });
+}
+#elif defined(QIO_HAS_THREADS)
+#include "thread_pool.h"
+
+using QioTaskArena = QioThreadArena;
+template <class T> using QioThreadLocal = QioThreadSpecific<T>;
+
+// the machine's cores, as TBB would default to
+inline size_t qio_thread_limit() {
+    return std::thread::hardware_concurrency();
+}
+
+template <class F>
+void qio_parallel_for(QioTaskArena & arena, const uint64_t n, const F & body) {
+    arena.parallel_for(n, body);
+}
+#else
+#error "multithreaded_block_module.h needs QIO_HAS_TBB or QIO_HAS_THREADS."
+#endif
+
+// Threads a multithreaded block module runs on: the caller's count, or else
+// the backend's limit, which also caps the caller's count since TBB starts no
+// more workers than it allows.
+inline int qio_thread_count(const uint32_t nthreads) {
+    const size_t limit = std::max<size_t>(qio_thread_limit(), 1);
+    return static_cast<int>(nthreads > 0 ? std::min<size_t>(nthreads, limit) : limit);
+}
+
+// The multithreaded block modules run their tasks in an arena per thread
+// count (without TBB, a QioThreadArena on the one shared QioThreadPool, as TBB
+// arenas share its global workers), created and started on first use and
+// then kept, so a call neither waits for an arena's workers to start nor sets
+// tbb::global_control for the whole process. Calls with the same thread count
+// share an arena; each module waits only for its own tasks. The calling
+// thread only produces or consumes blocks and sleeps while it waits. Never
+// destroyed, like the buffer pool.
+inline QioTaskArena & qio_task_arena(const int threads) {
+    struct Arenas {
+        std::mutex mutex;
+        std::map<int, std::unique_ptr<QioTaskArena>> by_threads;
+    };
+    static Arenas * const arenas = new Arenas();
+    std::lock_guard<std::mutex> lock(arenas->mutex);
+    std::unique_ptr<QioTaskArena> & arena = arenas->by_threads[threads];
+    if(!arena) {
+        arena.reset(new QioTaskArena(threads));
+        arena->initialize();
+    }
+    return *arena;
+}
+
+// Block k of the multithreaded writer and reader always uses slot k % slots,
+// and a slot is only refilled once the block before it in that slot is done
+// with. Blocks therefore come out of the ring in order without a sequencer,
+// and the number of slots bounds the blocks in flight.
+struct QioWriterSlot {
+    enum : int { FREE, COMPRESSING, COMPRESSED };
+    std::atomic<int> state;
+    QioBlock block; // the producer's buffer, traded for its current one
+    const char * input;            // block, or the caller's memory for a direct block
     uint32_t blocksize;
-    uint64_t blocknumber;
-    OrderedBlock(std::shared_ptr<char[]> block, uint32_t blocksize, uint64_t blocknumber) :
-    block(block), blocksize(blocksize), blocknumber(blocknumber) {}
-    OrderedBlock() : block(), blocksize(0), blocknumber(0) {}
+    uint32_t elemsize;
+    QioBlock zblock;
+    uint32_t zsize;
+    uint64_t blockhash; // QIO_FEATURE_BLOCK_HASH only
+    QioWriterSlot() : state(FREE), block(), input(nullptr), blocksize(0), elemsize(SHUFFLE_ELEMSIZE),
+                      zblock(), zsize(0), blockhash(0) {}
 };
 
-struct OrderedPtr {
-    const char * block;
-    uint64_t blocknumber;
-    OrderedPtr(const char * block, uint64_t blocknumber) :
-    block(block), blocknumber(blocknumber) {}
-    OrderedPtr() : block(), blocknumber(0) {}
+struct QioReaderSlot {
+    enum : int { FREE, READ, READY };
+    std::atomic<int> state;
+    QioBlock zblock;
+    uint32_t zsize;
+    uint64_t blockhash; // QIO_FEATURE_BLOCK_HASH only
+    QioBlock block;
+    char * data;        // block, zblock for a stored block, or a planned destination
+    uint32_t blocksize;
+    QioReaderSlot() : state(FREE), zblock(), zsize(0), blockhash(0), block(), data(nullptr), blocksize(0) {}
 };
 
+// Blocks are compressed independently, so a QIO_FEATURE_LONG_RANGE stream,
+// whose blocks are one zstd frame, is written by BlockCompressWriter instead
+// (qio_parallel_blocks); the same holds for the reader below.
 template <class stream_writer, class compressor, class hasher, class error_policy, bool direct_mem>
 struct BlockCompressWriterMT {
     stream_writer & myFile;
-    tbb::enumerable_thread_specific<compressor> cp;
+    QioThreadLocal<compressor> cp;
     hasher hp;
     const int compress_level;
+    const QioFormat format;
+    // shuffle_decision_reuse is per compressor, i.e. per thread, so which blocks
+    // reuse a decision depends on scheduling when it is nonzero
+    const QioWriteOptions options;
+    const QioDictionary * const dictionary; // owned through options
+    const uint32_t block_size;
+    const uint32_t min_block_size;
+    const uint32_t max_zblock_size;
+    QioBlockIndex index; // only touched while writing blocks out, then by finish()
 
-    tbb::concurrent_queue<std::shared_ptr<char[]>> available_blocks;
-    tbb::concurrent_queue<std::shared_ptr<char[]>> available_zblocks;
-
-    std::shared_ptr<char[]> current_block;
+    QioBlock current_block;
     uint32_t current_blocksize;
     uint64_t current_blocknumber;
+    QioElemsizeTally current_elemsizes;
+
+    std::vector<QioWriterSlot> slots;
+    std::atomic<uint64_t> next_write; // first block not yet written
+    std::atomic<bool> writing;        // held by the task writing blocks out
+    std::atomic<bool> failed;
 
-    tbb::task_group_context tgc;
-    tbb::flow::graph myGraph;
-    tbb::flow::function_node<OrderedBlock, OrderedBlock> compressor_node;
-    tbb::flow::function_node<OrderedPtr, OrderedBlock> compressor_direct_node;
-    tbb::flow::sequencer_node<OrderedBlock> sequencer_node;
-    tbb::flow::function_node<OrderedBlock, int, tbb::flow::rejecting> writer_node;
+    // guards pending_tasks and error; state_cv wakes the producer when a slot
+    // is freed, a task fails or the last task finishes
+    std::mutex state_mutex;
+    std::condition_variable state_cv;
+    uint64_t pending_tasks;
+    std::exception_ptr error;
 
-    BlockCompressWriterMT(stream_writer & f, const int cl) :
+    const int threads;
+    QioTaskArena & arena;
+
+    size_t write_queue_limit(const QioWriteOptions & options) const {
+        if(options.write_queue_blocks > 0) return options.write_queue_blocks;
+        return QIO_WRITE_BLOCKS_PER_THREAD * static_cast<size_t>(threads);
+    }
+    BlockCompressWriterMT(stream_writer & f, const int cl, const QioFormat format = QioFormat(),
+                          const QioWriteOptions options = QioWriteOptions()) :
     myFile(f),
     cp(),
     hp(),
     compress_level(cl),
-    available_blocks(),
-    available_zblocks(),
-    current_block(MAKE_SHARED_BLOCK(MAX_BLOCKSIZE)),
+    format(format),
+    options(options),
+    dictionary(qio_stream_dictionary(format, this->options.dictionary)),
+    block_size(format.block_size()),
+    min_block_size(format.min_block_size()),
+    max_zblock_size(format.max_zblock_size()),
+    index(format),
+    current_block(qio_pooled_block(block_size)),
     current_blocksize(0),
     current_blocknumber(0),
-    tgc(),
-    myGraph(this->tgc),
-    compressor_node(this->myGraph, tbb::flow::unlimited,
-    [this](OrderedBlock block) {
-        OrderedBlock zblock;
-        try {
-            if(!available_zblocks.try_pop(zblock.block)) {
-                zblock.block = MAKE_SHARED_BLOCK_ASSIGNMENT(MAX_ZBLOCKSIZE);
-            }
-            typename tbb::enumerable_thread_specific<compressor>::reference cp_local = cp.local();
-            zblock.blocksize = cp_local.compress(zblock.block.get(), MAX_ZBLOCKSIZE,
-                                                 block.block.get(), block.blocksize,
-                                                 compress_level);
-            if(compressor::is_error(zblock.blocksize)) {
-                throw std::runtime_error("Compression error");
-            }
-        } catch(...) {
-            recycle_block(block.block);
-            recycle_zblock(zblock.block);
-            throw;
-        }
-        zblock.blocknumber = block.blocknumber;
-        recycle_block(block.block);
-        return zblock;
-    }),
-    compressor_direct_node(this->myGraph, tbb::flow::unlimited,
-    [this](OrderedPtr ptr) {
-        OrderedBlock zblock;
-        try {
-            if(!available_zblocks.try_pop(zblock.block)) {
-                zblock.block = MAKE_SHARED_BLOCK_ASSIGNMENT(MAX_ZBLOCKSIZE);
-            }
-            typename tbb::enumerable_thread_specific<compressor>::reference cp_local = cp.local();
-            zblock.blocksize = cp_local.compress(zblock.block.get(), MAX_ZBLOCKSIZE,
-                                                 ptr.block, MAX_BLOCKSIZE,
-                                                 compress_level);
-            if(compressor::is_error(zblock.blocksize)) {
-                throw std::runtime_error("Compression error");
-            }
-        } catch(...) {
-            recycle_zblock(zblock.block);
-            throw;
-        }
-        zblock.blocknumber = ptr.blocknumber;
-        return zblock;
-    }),
-    sequencer_node(this->myGraph,
-    [](const OrderedBlock & zblock) {
-        return zblock.blocknumber;
-    }),
-    writer_node(this->myGraph, tbb::flow::serial,
-    [this](OrderedBlock zblock) {
-        write_and_update(static_cast<uint32_t>(zblock.blocksize));
-        write_and_update(zblock.block.get(), zblock.blocksize & (~BLOCK_METADATA));
-        available_zblocks.push(zblock.block);
-        return 0;
-    })
+    current_elemsizes(),
+    slots(),
+    next_write(0),
+    writing(false),
+    failed(false),
+    state_mutex(),
+    state_cv(),
+    pending_tasks(0),
+    error(),
+    threads(qio_thread_count(options.nthreads)),
+    arena(qio_task_arena(threads))
     {
-        tbb::flow::make_edge(compressor_node, sequencer_node);
-        if constexpr (direct_mem) {
-            tbb::flow::make_edge(compressor_direct_node, sequencer_node);
-        }
-        tbb::flow::make_edge(sequencer_node, writer_node);
+        slots = std::vector<QioWriterSlot>(write_queue_limit(options));
     }
-    private:
-    void recycle_block(const std::shared_ptr<char[]> & block) noexcept {
-        if(!block) return;
-        try { available_blocks.push(block); } catch(...) {}
+    // the tasks point into this writer
+    ~BlockCompressWriterMT() {
+        cleanup();
     }
-    void recycle_zblock(const std::shared_ptr<char[]> & block) noexcept {
-        if(!block) return;
-        try { available_zblocks.push(block); } catch(...) {}
+    private:
+    // notifying under the lock keeps the writer alive until the waiter wakes
+    void notify_producer() {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        state_cv.notify_all();
+    }
+    void fail(std::exception_ptr e) noexcept {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        if(!error) error = e;
+        failed.store(true);
+        state_cv.notify_all();
+    }
+    void task_done() noexcept {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        pending_tasks -= 1;
+        state_cv.notify_all();
+    }
+    void wait_for_tasks() noexcept {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        state_cv.wait(lock, [this] { return pending_tasks == 0; });
     }
     void write_and_update(const char * const inbuffer, const uint64_t len) {
         myFile.write(inbuffer, len);
@@ -153,34 +227,123 @@ struct BlockCompressWriterMT {
         myFile.writeInteger(value);
         hp.update(value);
     }
-    inline void submit_block(std::shared_ptr<char[]> block, const uint32_t blocksize, const uint64_t blocknumber) {
-        compressor_node.try_put(OrderedBlock(block, blocksize, blocknumber));
+    void write_slot(QioWriterSlot & slot) {
+        write_and_update(slot.zsize);
+        const uint32_t zbytes = compressed_block_size(slot.zsize);
+        if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+            myFile.write(slot.zblock.get(), zbytes);
+            write_and_update(slot.blockhash);
+        } else {
+            write_and_update(slot.zblock.get(), zbytes);
+        }
+        if(format.has(QIO_FEATURE_BLOCK_INDEX) && !index.add(slot.zsize, slot.blocksize)) {
+            throw std::runtime_error("Failed to allocate block index");
+        }
+    }
+    // Whichever task finds the next block compressed writes it and every
+    // compressed block after it. A task that finds the writing taken leaves its
+    // block to the writer, which checks again after letting go.
+    void write_ready_blocks() {
+        while(!writing.exchange(true)) {
+            try {
+                while(!failed.load()) {
+                    QioWriterSlot & slot = slots[next_write.load() % slots.size()];
+                    if(slot.state.load() != QioWriterSlot::COMPRESSED) break;
+                    write_slot(slot);
+                    slot.state.store(QioWriterSlot::FREE);
+                    next_write.fetch_add(1);
+                    notify_producer();
+                }
+            } catch(...) {
+                writing.store(false);
+                throw;
+            }
+            writing.store(false);
+            if(failed.load() || slots[next_write.load() % slots.size()].state.load() != QioWriterSlot::COMPRESSED) return;
+        }
     }
-    inline void submit_direct_block(const char * const block, const uint64_t blocknumber) {
-        compressor_direct_node.try_put(OrderedPtr(block, blocknumber));
+    // runs on a worker, so block hashes are computed in parallel
+    void compress_slot(QioWriterSlot & slot) noexcept {
+        try {
+            if(!failed.load()) {
+                if(!slot.zblock) slot.zblock = qio_pooled_block(max_zblock_size);
+                typename QioThreadLocal<compressor>::reference cp_local = cp.local();
+                qio_set_dictionary(cp_local, dictionary);
+                slot.zsize = cp_local.compress(slot.zblock.get(), max_zblock_size,
+                                               slot.input, slot.blocksize,
+                                               compress_level, format.shuffle_elemsize(slot.elemsize),
+                                               format.has(QIO_FEATURE_BITSHUFFLE),
+                                               options.shuffle_decision_reuse);
+                if(compressor::is_error(slot.zsize)) {
+                    throw std::runtime_error("Compression error");
+                }
+                slot.zsize = qio_store_if_incompressible(format, slot.zblock.get(), slot.zsize,
+                                                         slot.input, slot.blocksize);
+                if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+                    slot.blockhash = qio_block_hash(slot.zblock.get(), compressed_block_size(slot.zsize));
+                }
+                slot.state.store(QioWriterSlot::COMPRESSED);
+                write_ready_blocks();
+            }
+        } catch(...) {
+            fail(std::current_exception());
+        }
+        task_done();
+    }
+    // Waits for the slot of the current block number, then hands the block to
+    // a worker: the producer's buffer is traded for the slot's, or for a
+    // direct block the slot points at the caller's memory. After a failure
+    // the block is dropped; finish() reports the failure.
+    void submit_block(const char * const direct, const uint32_t blocksize, const uint32_t elemsize) {
+        QioWriterSlot & slot = slots[current_blocknumber % slots.size()];
+        if(slot.state.load() != QioWriterSlot::FREE) {
+            std::unique_lock<std::mutex> lock(state_mutex);
+            state_cv.wait(lock, [&] { return failed.load() || slot.state.load() == QioWriterSlot::FREE; });
+        }
+        if(failed.load()) return;
+        if(direct != nullptr) {
+            slot.input = direct;
+        } else {
+            std::swap(current_block, slot.block);
+            slot.input = slot.block.get();
+        }
+        slot.blocksize = blocksize;
+        slot.elemsize = elemsize;
+        slot.state.store(QioWriterSlot::COMPRESSING);
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            pending_tasks += 1;
+        }
+        try {
+            arena.enqueue([this, &slot] { compress_slot(slot); });
+        } catch(...) {
+            task_done();
+            throw;
+        }
     }
     // These two run once per block and can be reached from underneath R's
     // serializer, so a C++ exception must not escape them. Each raises after
     // its catch, when the only live owner is current_block, which the Frame
     // owns; an escaping exception would cross R's C frames and a raise from
     // inside the handler would strand the exception object.
-    void submit_current_block(const uint32_t blocksize) {
+    void submit_current_block(const char * const direct, const uint32_t blocksize, const uint32_t elemsize) {
         bool ok = true;
-        try { submit_block(current_block, blocksize, current_blocknumber); } catch(...) { ok = false; }
+        try { submit_block(direct, blocksize, elemsize); } catch(...) { ok = false; }
         if(!ok) cleanup_and_throw("Failed to submit output block");
     }
     // leaves the writer owning an empty current_block
     void acquire_current_block() {
-        if(available_blocks.try_pop(current_block)) return;
+        if(current_block) return;
         bool ok = true;
-        try { current_block = MAKE_SHARED_BLOCK_ASSIGNMENT(MAX_BLOCKSIZE); } catch(...) { ok = false; }
+        try { current_block = qio_pooled_block(block_size); } catch(...) { ok = false; }
         if(!ok) cleanup_and_throw("Failed to allocate output block");
     }
     void flush() {
         if(current_blocksize > 0) {
-            submit_current_block(current_blocksize);
+            submit_current_block(nullptr, current_blocksize, current_elemsizes.elemsize());
             current_blocknumber++;
             current_blocksize = 0;
+            current_elemsizes.clear();
             acquire_current_block();
         }
     }
@@ -188,58 +351,67 @@ struct BlockCompressWriterMT {
     public:
     uint64_t finish() {
         flush();
-        myGraph.wait_for_all();
+        wait_for_tasks();
+        if(error) {
+            std::rethrow_exception(error);
+        }
+        if(failed.load()) {
+            throw_error<error_policy>("Compression error");
+        }
+        if(format.has(QIO_FEATURE_BLOCK_INDEX)) {
+            index.write_footer([this](const auto value) { write_and_update(value); });
+        }
         return hp.digest();
     }
     // best effort teardown; must not throw, callers may be mid-unwind
     void cleanup() noexcept {
-        try {
-            if(! tgc.is_group_execution_cancelled()) {
-                tgc.cancel_group_execution();
-            }
-            myGraph.wait_for_all();
-        } catch(...) {}
+        failed.store(true);
+        notify_producer();
+        wait_for_tasks();
     }
     void cleanup_and_throw(const char * const msg) {
         cleanup();
         throw_error<error_policy>(msg);
     }
 
-    void push_data(const char * const inbuffer, const uint64_t len) {
+    // elemsize: element size of the data, used for shuffling with QIO_FEATURE_SHUFFLE_ELEMSIZE
+    void push_data(const char * const inbuffer, const uint64_t len, const uint32_t elemsize = SHUFFLE_ELEMSIZE) {
         uint64_t current_pointer_consumed = 0;
 
-        if(current_blocksize >= MAX_BLOCKSIZE) { flush(); }
+        if(current_blocksize >= block_size) { flush(); }
         if(current_blocksize > 0) {
-            uint32_t add_length = std::min<uint64_t>(len - current_pointer_consumed, MAX_BLOCKSIZE - current_blocksize);
+            uint32_t add_length = std::min<uint64_t>(len - current_pointer_consumed, block_size - current_blocksize);
             std::memcpy(current_block.get() + current_blocksize, inbuffer + current_pointer_consumed, add_length);
             current_blocksize += add_length;
+            current_elemsizes.add(elemsize, add_length);
             current_pointer_consumed += add_length;
         }
 
-        if(current_blocksize >= MAX_BLOCKSIZE) { flush(); }
-        while(len - current_pointer_consumed >= MAX_BLOCKSIZE) {
+        if(current_blocksize >= block_size) { flush(); }
+        while(len - current_pointer_consumed >= block_size) {
             if constexpr (direct_mem) {
-                submit_direct_block(inbuffer + current_pointer_consumed, current_blocknumber);
+                submit_current_block(inbuffer + current_pointer_consumed, block_size, elemsize);
             } else {
                 // current_blocksize is zero here: the input was either fully
                 // consumed above or the block was filled and flushed
-                std::memcpy(current_block.get(), inbuffer + current_pointer_consumed, MAX_BLOCKSIZE);
-                submit_current_block(MAX_BLOCKSIZE);
+                std::memcpy(current_block.get(), inbuffer + current_pointer_consumed, block_size);
+                submit_current_block(nullptr, block_size, elemsize);
                 acquire_current_block();
             }
             current_blocknumber++;
-            current_pointer_consumed += MAX_BLOCKSIZE;
+            current_pointer_consumed += block_size;
         }
 
         if(len - current_pointer_consumed > 0) {
             uint32_t add_length = len - current_pointer_consumed;
             std::memcpy(current_block.get(), inbuffer + current_pointer_consumed, add_length);
             current_blocksize = add_length;
+            current_elemsizes.add(elemsize, add_length);
         }
     }
 
     template<typename POD> void push_pod(const POD pod) {
-        if(current_blocksize > MIN_BLOCKSIZE) { flush(); }
+        if(current_blocksize > min_block_size) { flush(); }
         const char * ptr = reinterpret_cast<const char*>(&pod);
         std::memcpy(current_block.get() + current_blocksize, ptr, sizeof(POD));
         current_blocksize += sizeof(POD);
@@ -256,159 +428,476 @@ struct BlockCompressWriterMT {
     }
 };
 
+// Streams that can lend their bytes (memory_reader, MmapFileReader) are fully
+// addressable: the constructor finds every block with one pass over the size
+// prefixes, and blocks are then decompressed a window at a time, or straight
+// into the destination of a large get_data, by parallel_for. Other streams
+// are read one block at a time by a task that hands the block to a worker
+// and schedules the next read, through the ring of slots.
 template <class stream_reader, class decompressor, class error_policy, class byte_copier = QioByteCopier>
 struct BlockCompressReaderMT {
+    static constexpr bool scanned = qio_can_borrow<stream_reader>::value;
+
     stream_reader & myFile;
-    tbb::enumerable_thread_specific<decompressor> dp;
+    QioThreadLocal<decompressor> dp;
     xxHashEnv hp;
 
-    tbb::concurrent_queue<std::shared_ptr<char[]>> available_zblocks;
-    tbb::concurrent_queue<std::shared_ptr<char[]>> available_blocks;
-
-    std::shared_ptr<char[]> current_block;
+    const char * current_block; // points into a slot, the stream or a planned destination
     uint32_t current_blocksize;
     uint32_t data_offset;
-    OrderedBlock scratch_block; // kept empty between calls; get_new_block() may longjmp
 
-    std::atomic<bool> end_of_file;
-    std::atomic<uint64_t> blocks_to_process;
     uint64_t blocks_processed;
+    const QioFormat format;
+    const uint32_t block_size;
+    const uint32_t max_zblock_size;
+    const std::shared_ptr<const QioDictionary> dictionary; // kept alive for dp
+    std::atomic<uint64_t> first_corrupt_block;
+
+    // Destinations announced through plan_payloads(). A block that lies wholly
+    // inside one span is decompressed straight into it by a worker and handed
+    // on as a non-owning pointer there, so get_data has nothing left to copy.
+    struct PayloadPlan {
+        std::vector<QioPayloadSpan> spans;
+        std::vector<uint64_t> ends;  // end of each span, counted from the first span's start
+        uint64_t first_block;        // first block the consumer had not taken
+        uint64_t first_block_offset; // where first_block starts, counted the same way
+    };
+    std::unique_ptr<const PayloadPlan> payload_plan_storage;
+    std::atomic<const PayloadPlan *> payload_plan;
+
+    // scanned streams only
+    struct ScannedBlock {
+        const char * zdata; // borrowed from the stream
+        uint32_t zsize;     // size prefix as stored
+        uint64_t blockhash; // QIO_FEATURE_BLOCK_HASH only
+    };
+    std::vector<ScannedBlock> scanned_blocks;
+    const char * scan_error;           // why the scan stopped before the end of the stream, or nullptr
+    std::vector<QioReaderSlot> window; // decompressed blocks not yet taken, from window_pos on
+    size_t window_pos;
+    size_t window_count;
+    std::atomic<bool> window_error;
 
-    tbb::task_group_context tgc;
-    tbb::flow::graph myGraph;
-    tbb::flow::input_node<OrderedBlock> reader_node;
-    tbb::flow::function_node<OrderedBlock, OrderedBlock> decompressor_node;
-    tbb::flow::sequencer_node<OrderedBlock> sequencer_node;
-    BlockCompressReaderMT(stream_reader & f) :
+    // other streams: one slot more than the read-ahead, for the block the
+    // consumer is reading
+    std::vector<QioReaderSlot> slots;
+    std::atomic<uint64_t> blocks_read;
+    std::atomic<bool> reading; // a read task is scheduled or running
+    std::atomic<bool> end_of_file;
+    std::atomic<bool> failed;
+
+    // guards pending_tasks; ready_cv wakes the consumer when a block is
+    // decompressed, the stream ends, a task fails or the last task finishes
+    std::mutex ready_mutex;
+    std::condition_variable ready_cv;
+    uint64_t pending_tasks;
+
+    const int threads;
+    QioTaskArena & arena;
+
+    size_t read_ahead_limit(const QioReadOptions & options) const {
+        if(options.read_ahead_blocks > 0) return options.read_ahead_blocks;
+        return QIO_READ_AHEAD_BLOCKS_PER_THREAD * static_cast<size_t>(threads);
+    }
+    BlockCompressReaderMT(stream_reader & f, const QioFormat format = QioFormat(), const QioReadOptions options = QioReadOptions()) :
     myFile(f),
     dp(),
     hp(),
-    available_zblocks(),
-    available_blocks(),
-    current_block(MAKE_SHARED_BLOCK(MAX_BLOCKSIZE)),
+    current_block(nullptr),
     current_blocksize(0),
     data_offset(0),
-    end_of_file(false),
-    blocks_to_process(0),
     blocks_processed(0),
-    tgc(),
-    myGraph(this->tgc),
-    reader_node(this->myGraph,
-    [this](tbb::flow_control & fc) {
-        OrderedBlock zblock;
-        if(!read_next_zblock(zblock)) {
-            fc.stop(); // the value returned alongside stop() is not forwarded
-        }
-        return zblock;
-    }),
-    decompressor_node(this->myGraph, tbb::flow::unlimited,
-    [this](OrderedBlock zblock) {
-        typename tbb::enumerable_thread_specific<decompressor>::reference dp_local = dp.local();
-
-        OrderedBlock block;
-        if(!available_blocks.try_pop(block.block)) {
-            block.block = MAKE_SHARED_BLOCK_ASSIGNMENT(MAX_BLOCKSIZE);
-        }
-        // carry the sequence number before anything can return: sequencer_node
-        // is a successor on every path, and a duplicate sequence number (the
-        // default-constructed 0) is undefined behaviour in oneTBB
-        block.blocknumber = zblock.blocknumber;
-        block.blocksize = dp_local.decompress(block.block.get(), MAX_BLOCKSIZE, zblock.block.get(), zblock.blocksize);
-        if(decompressor::is_error(block.blocksize)) {
-            tgc.cancel_group_execution();
-            return block;
-        }
-        available_zblocks.push(zblock.block);
-        return block;
-    }),
-    sequencer_node(this->myGraph,
-    [](const OrderedBlock & block) {
-        return block.blocknumber;
-    })
+    format(format),
+    block_size(format.block_size()),
+    max_zblock_size(format.max_zblock_size()),
+    dictionary(options.dictionary),
+    first_corrupt_block(QIO_NO_CORRUPT_BLOCK),
+    payload_plan_storage(),
+    payload_plan(nullptr),
+    scanned_blocks(),
+    scan_error(nullptr),
+    window(),
+    window_pos(0),
+    window_count(0),
+    window_error(false),
+    slots(),
+    blocks_read(0),
+    reading(false),
+    end_of_file(false),
+    failed(false),
+    ready_mutex(),
+    ready_cv(),
+    pending_tasks(0),
+    threads(qio_thread_count(options.nthreads)),
+    arena(qio_task_arena(threads))
     {
-        tbb::flow::make_edge(reader_node, decompressor_node);
-        tbb::flow::make_edge(decompressor_node, sequencer_node);
-        reader_node.activate();
+        const size_t read_ahead = read_ahead_limit(options);
+        if constexpr (scanned) {
+            window = std::vector<QioReaderSlot>(read_ahead);
+            scan_blocks();
+        } else {
+            slots = std::vector<QioReaderSlot>(read_ahead + 1);
+            schedule_read();
+        }
+    }
+    // the tasks point into this reader
+    ~BlockCompressReaderMT() {
+        cleanup();
     }
-    public:
 
     private:
-    bool read_next_zblock(OrderedBlock & zblock) {
+    // this thread's decompressor, with the stream's dictionary
+    decompressor & local_decompressor() {
+        decompressor & local = dp.local();
+        qio_set_dictionary(local, qio_stream_dictionary(format, dictionary));
+        return local;
+    }
+    // notifying under the lock keeps the reader alive until the waiter wakes
+    void notify_consumer() noexcept {
+        std::lock_guard<std::mutex> lock(ready_mutex);
+        ready_cv.notify_all();
+    }
+    void fail() noexcept {
+        failed.store(true);
+        notify_consumer();
+    }
+    void task_done() noexcept {
+        std::lock_guard<std::mutex> lock(ready_mutex);
+        pending_tasks -= 1;
+        ready_cv.notify_all();
+    }
+    void wait_for_tasks() noexcept {
+        std::unique_lock<std::mutex> lock(ready_mutex);
+        ready_cv.wait(lock, [this] { return pending_tasks == 0; });
+    }
+    // blocks are checked out of order, so keep the lowest failing block number
+    void check_block_hash(const char * const zdata, const uint32_t zsize, const uint64_t blockhash, const uint64_t blocknumber) {
+        if(qio_block_hash(zdata, compressed_block_size(zsize)) == blockhash) return;
+        uint64_t current = first_corrupt_block.load();
+        while(blocknumber < current && !first_corrupt_block.compare_exchange_weak(current, blocknumber)) {}
+    }
+    // a full block in the caller's memory, or nullptr if the block is not planned
+    char * payload_destination(const uint64_t blocknumber) const {
+        const PayloadPlan * const plan = payload_plan.load(std::memory_order_acquire);
+        if(plan == nullptr || blocknumber < plan->first_block) return nullptr;
+        const uint64_t start = plan->first_block_offset + (blocknumber - plan->first_block) * block_size;
+        const auto end = std::upper_bound(plan->ends.begin(), plan->ends.end(), start);
+        if(end == plan->ends.end() || *end - start < block_size) return nullptr;
+        const QioPayloadSpan & span = plan->spans[static_cast<size_t>(end - plan->ends.begin())];
+        return span.data + (start - (*end - span.size));
+    }
+    bool slot_free(const uint64_t blocknumber) const {
+        return slots[blocknumber % slots.size()].state.load() == QioReaderSlot::FREE;
+    }
+    // Schedules a read task if the next block's slot is free and none is
+    // scheduled. A read task that finishes while the consumer frees a slot
+    // checks again after letting go, so one of the two schedules the read.
+    void schedule_read() {
+        while(!end_of_file.load() && !failed.load() && slot_free(blocks_read.load())) {
+            if(reading.exchange(true)) return;
+            if(!end_of_file.load() && !failed.load() && slot_free(blocks_read.load())) {
+                {
+                    std::lock_guard<std::mutex> lock(ready_mutex);
+                    pending_tasks += 1;
+                }
+                try {
+                    arena.enqueue([this] { read_and_decompress(); });
+                } catch(...) {
+                    reading.store(false);
+                    task_done();
+                    throw;
+                }
+                return;
+            }
+            reading.store(false);
+        }
+    }
+    // Reads the next block, schedules the read after it, then decompresses
+    // the block, so reading overlaps decompression and a worker never waits
+    // on the stream for a block another task has yet to decompress.
+    void read_and_decompress() noexcept {
+        const uint64_t blocknumber = blocks_read.load();
+        QioReaderSlot & slot = slots[blocknumber % slots.size()];
+        bool have_block = false;
+        try {
+            have_block = read_next_zblock(slot);
+            if(have_block) {
+                slot.state.store(QioReaderSlot::READ);
+                blocks_read.fetch_add(1);
+            }
+        } catch(...) {
+            fail();
+        }
+        reading.store(false);
+        try {
+            schedule_read();
+        } catch(...) {
+            fail();
+        }
+        if(have_block) {
+            decompress_slot(slot, blocknumber);
+        }
+        task_done();
+    }
+    // false at the end of the stream (end_of_file is set) or on a bad size prefix (failed is set)
+    bool read_next_zblock(QioReaderSlot & slot) {
         uint32_t zsize;
         bool ok = this->myFile.readInteger(zsize);
         if(!ok) {
             end_of_file.store(true);
+            notify_consumer();
             return false;
         }
-        const uint32_t zbytes = compressed_block_size(zsize);
-        if(!compressed_block_size_fits_buffer(zsize)) {
-            tgc.cancel_group_execution();
+        if(zsize == BLOCK_STREAM_TERMINATOR && format.has(QIO_FEATURE_BLOCK_INDEX)) {
+            QioBlock buffer(qio_pooled_block(max_zblock_size));
+            hp.update(zsize);
+            qio_hash_remaining(this->myFile, hp, buffer.get(), max_zblock_size);
+            end_of_file.store(true);
+            notify_consumer();
             return false;
         }
-        if(!available_zblocks.try_pop(zblock.block)) {
-            zblock.block = MAKE_SHARED_BLOCK_ASSIGNMENT(MAX_ZBLOCKSIZE);
+        const uint32_t zbytes = compressed_block_size(zsize);
+        if(!compressed_block_size_fits_buffer(zsize, format)) {
+            fail();
+            return false;
         }
-        uint32_t bytes_read = this->myFile.read(zblock.block.get(), zbytes);
+        if(!slot.zblock) slot.zblock = qio_pooled_block(max_zblock_size);
+        const uint32_t bytes_read = this->myFile.read(slot.zblock.get(), zbytes);
         if(bytes_read != zbytes) {
             end_of_file.store(true);
+            notify_consumer();
             return false;
         }
         hp.update(zsize);
-        hp.update(zblock.block.get(), bytes_read);
-        zblock.blocksize = zsize;
-        zblock.blocknumber = blocks_to_process.fetch_add(1);
+        if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+            // the data is hashed by the decompressing worker and checked against this
+            if(!this->myFile.readInteger(slot.blockhash)) {
+                end_of_file.store(true);
+                notify_consumer();
+                return false;
+            }
+            hp.update(slot.blockhash);
+        } else {
+            hp.update(slot.zblock.get(), bytes_read);
+        }
+        slot.zsize = zsize;
         return true;
     }
-    // failing to return a block to the free list only costs its reuse
-    void recycle_block(const std::shared_ptr<char[]> & block) noexcept {
-        try { available_blocks.push(block); } catch(...) {}
+    // Planned blocks must fill the whole block. Anything shorter is corrupt,
+    // which get_data would also reject, so the read fails here instead.
+    void decompress_slot(QioReaderSlot & slot, const uint64_t blocknumber) noexcept {
+        try {
+            if(failed.load()) return;
+            if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+                check_block_hash(slot.zblock.get(), slot.zsize, slot.blockhash, blocknumber);
+            }
+            char * const destination = payload_destination(blocknumber);
+            if(format.has(QIO_FEATURE_STORED_BLOCKS) && is_stored_block(slot.zsize)) {
+                slot.blocksize = compressed_block_size(slot.zsize);
+                if(slot.blocksize > block_size || (destination != nullptr && slot.blocksize != block_size)) {
+                    fail();
+                    return;
+                }
+                if(destination != nullptr) {
+                    std::memcpy(destination, slot.zblock.get(), block_size);
+                    slot.data = destination;
+                } else {
+                    // the compressed buffer becomes the block
+                    slot.data = slot.zblock.get();
+                }
+            } else {
+                char * target = destination;
+                if(target == nullptr) {
+                    if(!slot.block) slot.block = qio_pooled_block(block_size);
+                    target = slot.block.get();
+                }
+                slot.blocksize = local_decompressor().decompress(target, block_size, slot.zblock.get(), slot.zsize);
+                if(decompressor::is_error(slot.blocksize) || (destination != nullptr && slot.blocksize != block_size)) {
+                    fail();
+                    return;
+                }
+                slot.data = target;
+            }
+            std::lock_guard<std::mutex> lock(ready_mutex);
+            slot.state.store(QioReaderSlot::READY);
+            ready_cv.notify_all();
+        } catch(...) {
+            fail();
+        }
     }
-    void get_new_block() {
-        while( true ) {
-            if( sequencer_node.try_get(scratch_block) ) {
-                recycle_block(current_block);
-                current_block = std::move(scratch_block.block);
-                current_blocksize = scratch_block.blocksize;
-                blocks_processed += 1;
+    // Locates every block and hashes the stream the way read_next_zblock()
+    // would. A bad size prefix is only reported once the consumer needs that
+    // block, or by finish().
+    void scan_blocks() {
+        uint32_t zsize;
+        while(this->myFile.readInteger(zsize)) {
+            if(zsize == BLOCK_STREAM_TERMINATOR && format.has(QIO_FEATURE_BLOCK_INDEX)) {
+                QioBlock buffer(qio_pooled_block(max_zblock_size));
+                hp.update(zsize);
+                qio_hash_remaining(this->myFile, hp, buffer.get(), max_zblock_size);
                 return;
             }
-
-            if(end_of_file && blocks_processed >= blocks_to_process) {
-                cleanup_and_throw("Unexpected end of file");
+            if(!compressed_block_size_fits_buffer(zsize, format)) {
+                scan_error = "File read / decompression error";
+                return;
+            }
+            const uint32_t zbytes = compressed_block_size(zsize);
+            ScannedBlock block = {nullptr, zsize, 0};
+            if(this->myFile.borrow(block.zdata, zbytes) != zbytes) return;
+            hp.update(zsize);
+            if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+                if(!this->myFile.readInteger(block.blockhash)) return;
+                hp.update(block.blockhash);
+            } else {
+                hp.update(block.zdata, zbytes);
+            }
+            scanned_blocks.push_back(block);
+        }
+    }
+    // decompresses scanned block blocknumber into destination (block_size
+    // bytes); false on a decompression error
+    bool decompress_scanned(char * const destination, const uint64_t blocknumber, uint32_t & size) {
+        const ScannedBlock & zblock = scanned_blocks[blocknumber];
+        if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+            check_block_hash(zblock.zdata, zblock.zsize, zblock.blockhash, blocknumber);
+        }
+        if(format.has(QIO_FEATURE_STORED_BLOCKS) && is_stored_block(zblock.zsize)) {
+            size = compressed_block_size(zblock.zsize);
+            if(size > block_size) return false;
+            std::memcpy(destination, zblock.zdata, size);
+            return true;
+        }
+        size = local_decompressor().decompress(destination, block_size, zblock.zdata, zblock.zsize);
+        return !decompressor::is_error(size);
+    }
+    // the consumer has taken every scanned block
+    void throw_missing_block() {
+        cleanup_and_throw(scan_error != nullptr ? scan_error : "Unexpected end of file");
+    }
+    void fill_window() {
+        const uint64_t first = blocks_processed;
+        const uint64_t remaining = scanned_blocks.size() - first;
+        if(remaining == 0) throw_missing_block();
+        window_count = static_cast<size_t>(std::min<uint64_t>(remaining, window.size()));
+        window_pos = 0;
+        window_error.store(false);
+        qio_parallel_for(arena, window_count, [&](const uint64_t i) {
+            QioReaderSlot & block = window[i];
+            const ScannedBlock & zblock = scanned_blocks[first + i];
+            if(format.has(QIO_FEATURE_STORED_BLOCKS) && is_stored_block(zblock.zsize)) {
+                if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+                    check_block_hash(zblock.zdata, zblock.zsize, zblock.blockhash, first + i);
+                }
+                // used in place; the stream's bytes outlive the reader
+                block.blocksize = compressed_block_size(zblock.zsize);
+                if(block.blocksize > block_size) window_error.store(true);
+                block.data = const_cast<char *>(zblock.zdata);
+                return;
             }
-            if(tgc.is_group_execution_cancelled()) {
-                cleanup_and_throw("File read / decompression error");
+            if(!block.block) block.block = qio_pooled_block(block_size);
+            block.data = block.block.get();
+            if(!decompress_scanned(block.data, first + i, block.blocksize)) window_error.store(true);
+        });
+        if(window_error.load()) {
+            cleanup_and_throw("File read / decompression error");
+        }
+    }
+    // Decompresses up to count full blocks straight into destination and
+    // returns how many; only called with the window empty.
+    uint64_t decompress_scanned_to(char * const destination, const uint64_t count) {
+        const uint64_t first = blocks_processed;
+        const uint64_t n = std::min<uint64_t>(count, scanned_blocks.size() - first);
+        window_error.store(false);
+        qio_parallel_for(arena, n, [&](const uint64_t i) {
+            uint32_t size;
+            if(!decompress_scanned(destination + i * block_size, first + i, size) || size != block_size) {
+                window_error.store(true);
+            }
+        });
+        if(window_error.load()) {
+            cleanup_and_throw("Corrupted block data");
+        }
+        blocks_processed += n;
+        return n;
+    }
+    // get_new_block() may longjmp, so it leaves nothing behind that needs a destructor
+    void get_new_block() {
+        if constexpr (scanned) {
+            if(window_pos == window_count) fill_window();
+            current_block = window[window_pos].data;
+            current_blocksize = window[window_pos].blocksize;
+            window_pos += 1;
+            blocks_processed += 1;
+            return;
+        }
+        // the block just consumed is done with, so its slot can be refilled
+        bool ok = true;
+        if(blocks_processed > 0) {
+            slots[(blocks_processed - 1) % slots.size()].state.store(QioReaderSlot::FREE);
+            try { schedule_read(); } catch(...) { ok = false; }
+        }
+        if(!ok) cleanup_and_throw("File read / decompression error");
+        QioReaderSlot & slot = slots[blocks_processed % slots.size()];
+        const char * error = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(ready_mutex);
+            while(slot.state.load() != QioReaderSlot::READY) {
+                if(failed.load()) {
+                    error = "File read / decompression error";
+                    break;
+                }
+                if(end_of_file.load() && blocks_processed >= blocks_read.load()) {
+                    error = "Unexpected end of file";
+                    break;
+                }
+                ready_cv.wait(lock);
             }
         }
+        // cleanup waits for the tasks, which need the lock
+        if(error != nullptr) {
+            cleanup_and_throw(error);
+        }
+        current_block = slot.data;
+        current_blocksize = slot.blocksize;
+        blocks_processed += 1;
     }
     public:
     void finish() {
-        myGraph.wait_for_all();
-        if(tgc.is_group_execution_cancelled()) {
+        if constexpr (scanned) {
+            if(scan_error != nullptr) {
+                throw_error<error_policy>(scan_error);
+            }
+            return;
+        }
+        wait_for_tasks();
+        if(failed.load()) {
             throw_error<error_policy>("File read / decompression error");
         }
     }
+    // parallel_for has returned before any error is raised, so a scanned
+    // stream has nothing to wait for
     void cleanup() noexcept {
-        try {
-            if(! tgc.is_group_execution_cancelled()) {
-                tgc.cancel_group_execution();
-            }
-            myGraph.wait_for_all();
-        } catch(...) {}
+        if constexpr (scanned) return;
+        failed.store(true);
+        wait_for_tasks();
     }
     void cleanup_and_throw(const char * const msg) {
         cleanup();
         throw_error<error_policy>(msg);
     }
+    // only complete once finish() has waited for every block to be checked
     uint64_t get_hash_digest() {
-        return hp.digest();
+        return first_corrupt_block.load() == QIO_NO_CORRUPT_BLOCK ? hp.digest() : 0;
+    }
+    uint64_t corrupt_block() const {
+        return first_corrupt_block.load();
     }
     const char * current_data() {
         if(current_blocksize == data_offset) {
             get_new_block();
             data_offset = 0;
         }
-        return current_block.get() + data_offset;
+        return current_block + data_offset;
     }
     uint32_t remaining_data() {
         if(current_blocksize == data_offset) {
@@ -424,28 +913,64 @@ struct BlockCompressReaderMT {
         data_offset += len;
     }
 
+    // Announces the destinations of the get_data calls that follow, so workers
+    // can decompress the blocks that fall wholly inside one of them in place.
+    // Only the first plan is used. Blocks already decompressed when the plan
+    // arrives are copied as usual.
+    void plan_payloads(std::vector<QioPayloadSpan> spans) {
+        // get_data on a scanned stream already decompresses into its destination
+        if constexpr (scanned) return;
+        if(payload_plan_storage) return;
+        std::unique_ptr<PayloadPlan> plan(new PayloadPlan());
+        uint64_t end = 0;
+        for(const QioPayloadSpan & span : spans) {
+            if(span.size == 0) continue;
+            end += span.size;
+            plan->spans.push_back(span);
+            plan->ends.push_back(end);
+        }
+        plan->first_block = blocks_processed;
+        plan->first_block_offset = current_blocksize - data_offset;
+        payload_plan_storage = std::move(plan);
+        payload_plan.store(payload_plan_storage.get(), std::memory_order_release);
+    }
+
     void get_data(char * outbuffer, const uint64_t len) {
         if(current_blocksize - data_offset >= len) {
-            byte_copier::copy(outbuffer, current_block.get()+data_offset, len);
+            byte_copier::copy(outbuffer, current_block+data_offset, len);
             data_offset += len;
         } else {
             uint64_t bytes_accounted = current_blocksize - data_offset;
-            byte_copier::copy(outbuffer, current_block.get()+data_offset, bytes_accounted);
-            while(len - bytes_accounted >= MAX_BLOCKSIZE) {
+            byte_copier::copy(outbuffer, current_block+data_offset, bytes_accounted);
+            while(len - bytes_accounted >= block_size) {
+                if constexpr (scanned) {
+                    if(window_pos == window_count) {
+                        const uint64_t n = decompress_scanned_to(outbuffer + bytes_accounted, (len - bytes_accounted) / block_size);
+                        if(n == 0) throw_missing_block();
+                        bytes_accounted += n * block_size;
+                        // none of those blocks is the current block
+                        current_blocksize = 0;
+                        data_offset = 0;
+                        continue;
+                    }
+                }
                 get_new_block();
-                if(current_blocksize != MAX_BLOCKSIZE) {
+                if(current_blocksize != block_size) {
                     cleanup_and_throw("Corrupted block data");
                 }
-                byte_copier::copy(outbuffer + bytes_accounted, current_block.get(), MAX_BLOCKSIZE);
-                bytes_accounted += MAX_BLOCKSIZE;
-                data_offset = MAX_BLOCKSIZE;
+                // a planned block was decompressed in place
+                if(current_block != outbuffer + bytes_accounted) {
+                    byte_copier::copy(outbuffer + bytes_accounted, current_block, block_size);
+                }
+                bytes_accounted += block_size;
+                data_offset = block_size;
             }
             if(len - bytes_accounted > 0) {
                 get_new_block();
                 if(current_blocksize < len - bytes_accounted) {
                     cleanup_and_throw("Corrupted block data");
                 }
-                byte_copier::copy(outbuffer + bytes_accounted, current_block.get(), len - bytes_accounted);
+                byte_copier::copy(outbuffer + bytes_accounted, current_block, len - bytes_accounted);
                 data_offset = len - bytes_accounted;
             }
         }
@@ -453,7 +978,7 @@ struct BlockCompressReaderMT {
 
     const char * get_ptr(const uint64_t len) {
         if(current_blocksize - data_offset >= len) {
-            const char * ptr = current_block.get() + data_offset;
+            const char * ptr = current_block + data_offset;
             data_offset += len;
             return ptr;
         } else {
@@ -470,7 +995,7 @@ struct BlockCompressReaderMT {
             cleanup_and_throw("Corrupted block data");
         }
         POD pod;
-        memcpy(&pod, current_block.get()+data_offset, sizeof(POD));
+        memcpy(&pod, current_block+data_offset, sizeof(POD));
         data_offset += sizeof(POD);
         return pod;
     }
@@ -480,7 +1005,7 @@ struct BlockCompressReaderMT {
             cleanup_and_throw("Corrupted block data");
         }
         POD pod;
-        memcpy(&pod, current_block.get()+data_offset, sizeof(POD));
+        memcpy(&pod, current_block+data_offset, sizeof(POD));
         data_offset += sizeof(POD);
         return pod;
     }
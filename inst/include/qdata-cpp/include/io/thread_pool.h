@@ -0,0 +1,262 @@
+#ifndef _QIO_THREAD_POOL_H
+#define _QIO_THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// The std::thread backend of the multithreaded block modules, used when
+// QIO_HAS_THREADS is defined without QIO_HAS_TBB. It offers the part of
+// tbb::task_arena and tbb::enumerable_thread_specific the modules use: the
+// ring of slots already keeps blocks in order and bounds those in flight, so
+// the pool only needs a FIFO queue of tasks and a fixed set of workers.
+
+// One index loop shared by the caller and its helpers. It outlives the
+// caller when a helper starts after every index is done.
+struct QioForLoop {
+    const uint64_t n;
+    std::atomic<uint64_t> next;
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    uint64_t done;
+    std::exception_ptr error;
+    explicit QioForLoop(const uint64_t n) : n(n), next(0), mutex(), done_cv(), done(0), error() {}
+
+    // the body is only called for an index claimed below n, and the caller
+    // waits for every such call, so it is never called after the caller returns
+    template <class F>
+    void run_indices(const F * const body) noexcept {
+        for(uint64_t i = next.fetch_add(1); i < n; i = next.fetch_add(1)) {
+            std::exception_ptr body_error;
+            try {
+                (*body)(i);
+            } catch(...) {
+                body_error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if(body_error && !error) error = body_error;
+            done += 1;
+            if(done == n) done_cv.notify_all();
+        }
+    }
+
+    // Calls body(i) for i in [0, n) on the calling thread and on up to
+    // threads - 1 helpers enqueued on executor, and returns once every call
+    // has; rethrows the first exception a call threw. The calling thread never
+    // waits on a helper to start, so a busy executor only makes the loop serial.
+    template <class Executor, class F>
+    static void run(Executor & executor, const int threads, const uint64_t n, const F & body) {
+        if(n == 0) return;
+        std::shared_ptr<QioForLoop> loop = std::make_shared<QioForLoop>(n);
+        const F * const body_ptr = &body;
+        const uint64_t helpers = std::min<uint64_t>(n - 1, static_cast<uint64_t>(threads - 1));
+        for(uint64_t h = 0; h < helpers; ++h) {
+            try {
+                executor.enqueue([loop, body_ptr] { loop->run_indices(body_ptr); });
+            } catch(...) {
+                break; // the calling thread covers what helpers would have
+            }
+        }
+        loop->run_indices(body_ptr);
+        std::unique_lock<std::mutex> lock(loop->mutex);
+        loop->done_cv.wait(lock, [&] { return loop->done == loop->n; });
+        if(loop->error) std::rethrow_exception(loop->error);
+    }
+};
+
+// Like a task arena of the same concurrency: threads - 1 workers, the calling
+// thread being the other one, but always at least one worker so enqueued tasks
+// make progress. Tasks must not throw.
+class QioThreadPool {
+    const int threads;
+    std::mutex mutex;
+    std::condition_variable task_cv;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+    bool stopping;
+
+    void run() {
+        for(;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                task_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if(tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    public:
+    explicit QioThreadPool(const int threads) :
+    threads(std::max(threads, 1)), mutex(), task_cv(), tasks(), workers(), stopping(false) {}
+    QioThreadPool(const QioThreadPool &) = delete;
+    QioThreadPool & operator=(const QioThreadPool &) = delete;
+    // runs the tasks already queued, then joins the workers
+    ~QioThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        task_cv.notify_all();
+        for(std::thread & worker : workers) worker.join();
+    }
+
+    // starts the workers; enqueue() starts them too if this was not called
+    void initialize() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!workers.empty()) return;
+        const int count = std::max(threads - 1, 1);
+        workers.reserve(count);
+        for(int i = 0; i < count; ++i) {
+            workers.emplace_back([this] { run(); });
+        }
+    }
+    int max_concurrency() const {
+        return threads;
+    }
+
+    template <class F>
+    void enqueue(F && task) {
+        initialize();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back(std::forward<F>(task));
+        }
+        task_cv.notify_one();
+    }
+
+    // see QioForLoop::run
+    template <class F>
+    void parallel_for(const uint64_t n, const F & body) {
+        QioForLoop::run(*this, threads, n, body);
+    }
+};
+
+// The pool the arenas of the block modules share, one worker per core but
+// the calling thread's, so the process keeps at most that many idle threads
+// whatever thread counts it asks for. Started on first use and never
+// destroyed, like TBB's global workers.
+inline QioThreadPool & qio_shared_thread_pool() {
+    static QioThreadPool * const pool = new QioThreadPool(static_cast<int>(std::thread::hardware_concurrency()));
+    return *pool;
+}
+
+// A task arena of a given concurrency on a shared pool: at most threads - 1
+// of its tasks (at least one) run at once, each taken in FIFO order by a
+// runner the arena keeps queued on the pool. Arenas add no threads of their
+// own. Tasks must not throw.
+class QioThreadArena {
+    QioThreadPool & pool;
+    const int threads;
+    std::mutex mutex;
+    std::condition_variable idle_cv;
+    std::deque<std::function<void()>> tasks;
+    int runners;
+
+    int max_runners() const {
+        return std::max(threads - 1, 1);
+    }
+    // runs queued tasks until there are none left
+    void drain() noexcept {
+        for(;;) {
+            std::function<void()> task;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(tasks.empty()) {
+                    runners -= 1;
+                    if(runners == 0) idle_cv.notify_all();
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    public:
+    QioThreadArena(QioThreadPool & pool, const int threads) :
+    pool(pool), threads(std::max(threads, 1)), mutex(), idle_cv(), tasks(), runners(0) {}
+    explicit QioThreadArena(const int threads) : QioThreadArena(qio_shared_thread_pool(), threads) {}
+    QioThreadArena(const QioThreadArena &) = delete;
+    QioThreadArena & operator=(const QioThreadArena &) = delete;
+    // a runner may still be leaving drain() after the last task returned
+    ~QioThreadArena() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle_cv.wait(lock, [this] { return runners == 0; });
+    }
+
+    void initialize() {
+        pool.initialize();
+    }
+    int max_concurrency() const {
+        return threads;
+    }
+    QioThreadPool & shared_pool() const {
+        return pool;
+    }
+
+    // Once queued, a task always runs: if the pool cannot take another runner
+    // and none is left to pick the task up, the calling thread drains the queue.
+    template <class F>
+    void enqueue(F && task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back(std::forward<F>(task));
+            if(runners >= max_runners()) return;
+            runners += 1;
+        }
+        try {
+            pool.enqueue([this] { drain(); });
+        } catch(...) {
+            drain();
+        }
+    }
+
+    // see QioForLoop::run
+    template <class F>
+    void parallel_for(const uint64_t n, const F & body) {
+        QioForLoop::run(*this, threads, n, body);
+    }
+};
+
+// One T per thread that asks for it, built on first use like
+// tbb::enumerable_thread_specific. A lookup takes a lock, which is cheap next
+// to the block each one serves.
+template <class T>
+class QioThreadSpecific {
+    std::mutex mutex;
+    std::vector<std::pair<std::thread::id, std::unique_ptr<T>>> values;
+
+    public:
+    QioThreadSpecific() : mutex(), values() {}
+    QioThreadSpecific(const QioThreadSpecific &) = delete;
+    QioThreadSpecific & operator=(const QioThreadSpecific &) = delete;
+
+    using reference = T &;
+    // throws what T's constructor throws; the next call tries again
+    T & local() {
+        const std::thread::id id = std::this_thread::get_id();
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto & value : values) {
+            if(value.first == id) return *value.second;
+        }
+        std::unique_ptr<T> value(new T());
+        values.emplace_back(id, std::move(value));
+        return *values.back().second;
+    }
+};
+
+#endif
@@ -43,6 +43,13 @@ struct xxHashEnv {
     }
 };
 
+// QIO_FEATURE_BLOCK_HASH: a block's compressed bytes are hashed on their own, by
+// whichever thread compresses or decompresses it. The stream hash then covers
+// each block's size prefix and hash rather than its data.
+inline uint64_t qio_block_hash(const char * const zdata, const uint64_t zbytes) {
+    return XXH3_64bits(zdata, zbytes);
+}
+
 // do nothing and return zero
 struct noHashEnv {
     noHashEnv() {}
@@ -0,0 +1,154 @@
+#ifndef _QIO_ZSTD_DICTIONARY_H
+#define _QIO_ZSTD_DICTIONARY_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "zstd.h"
+#include "zdict.h"
+
+// A zstd dictionary shared by every block of a stream (QIO_FEATURE_DICTIONARY).
+// Small objects give zstd little history to match against within their own
+// block; a dictionary trained on similar objects supplies it up front. The
+// dictionary ID recorded in the header lets a reader refuse the wrong one.
+//
+// The prepared forms are made once and shared by all threads: the DDict when
+// the dictionary is loaded, a CDict per compression level on first use.
+static constexpr size_t QIO_DEFAULT_DICTIONARY_SIZE = 112640; // zstd's default, 110 KiB
+
+class QioDictionary {
+    std::vector<char> content;
+    uint32_t dict_id;
+    ZSTD_DDict * ddict_;
+    mutable std::mutex mutex;
+    mutable std::vector<std::pair<int, ZSTD_CDict *>> cdicts;
+
+    public:
+    // Throws std::runtime_error unless data holds a zstd dictionary with an ID,
+    // as trained by qio_train_dictionary(); raw content has no ID to record.
+    QioDictionary(const void * const data, const size_t size) :
+    content(static_cast<const char *>(data), static_cast<const char *>(data) + size),
+    dict_id(ZSTD_getDictID_fromDict(data, size)),
+    ddict_(nullptr),
+    mutex(),
+    cdicts() {
+        if(dict_id == 0) {
+            throw std::runtime_error("Not a zstd dictionary");
+        }
+        ddict_ = ZSTD_createDDict(content.data(), content.size());
+        if(ddict_ == nullptr) {
+            throw std::runtime_error("Failed to load zstd dictionary");
+        }
+    }
+    QioDictionary(const QioDictionary &) = delete;
+    QioDictionary & operator=(const QioDictionary &) = delete;
+    ~QioDictionary() {
+        for(auto & cdict : cdicts) ZSTD_freeCDict(cdict.second);
+        ZSTD_freeDDict(ddict_);
+    }
+
+    uint32_t id() const { return dict_id; }
+    const char * data() const { return content.data(); }
+    size_t size() const { return content.size(); }
+
+    const ZSTD_DDict * ddict() const { return ddict_; }
+    // nullptr if zstd cannot prepare it, which the compressors report as a
+    // compression error
+    const ZSTD_CDict * cdict(const int compress_level) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(const auto & cdict : cdicts) {
+            if(cdict.first == compress_level) return cdict.second;
+        }
+        ZSTD_CDict * const cdict = ZSTD_createCDict(content.data(), content.size(), compress_level);
+        if(cdict == nullptr) return nullptr;
+        try {
+            cdicts.emplace_back(compress_level, cdict);
+        } catch(...) {
+            ZSTD_freeCDict(cdict);
+            return nullptr;
+        }
+        return cdict;
+    }
+};
+
+// samples are concatenated, sample_sizes gives their lengths in order.
+// Throws std::runtime_error if zstd cannot train on them, e.g. when there are
+// too few samples or too little data for the dictionary size.
+inline std::vector<char> qio_train_dictionary(const std::vector<char> & samples,
+                                              const std::vector<size_t> & sample_sizes,
+                                              const size_t dictionary_size = QIO_DEFAULT_DICTIONARY_SIZE) {
+    if(sample_sizes.empty()) {
+        throw std::runtime_error("No samples to train a zstd dictionary on");
+    }
+    if(sample_sizes.size() > static_cast<size_t>(UINT32_MAX)) {
+        throw std::runtime_error("Too many samples to train a zstd dictionary on");
+    }
+    std::vector<char> dictionary(dictionary_size);
+    const size_t result = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), samples.data(),
+                                                sample_sizes.data(), static_cast<unsigned>(sample_sizes.size()));
+    if(ZDICT_isError(result)) {
+        throw std::runtime_error(std::string("Failed to train zstd dictionary: ") + ZDICT_getErrorName(result));
+    }
+    dictionary.resize(result);
+    return dictionary;
+}
+
+// Stands in for a compressor in BlockCompressWriter to collect training
+// samples: each block is kept as one sample, unshuffled, and passed on as is.
+// That is what the compressors see for every block ZstdCompressor writes, and
+// for blocks below ZstdShuffleCompressor's heuristic floor of
+// 8 * SHUFFLE_HEURISTIC_BLOCKSIZE bytes, i.e. the small objects dictionaries
+// are meant for; larger blocks it may compress shuffled.
+struct QioDictionarySampler {
+    std::vector<char> samples;
+    std::vector<size_t> sample_sizes;
+    QioDictionarySampler() : samples(), sample_sizes() {}
+    uint32_t compress(char * const dst, const uint32_t dstCapacity,
+                      const char * const src, const uint32_t srcSize,
+                      const int, const uint32_t = 0, const bool = false, const uint32_t = 0) noexcept {
+        if(srcSize > dstCapacity) return 0;
+        try {
+            samples.insert(samples.end(), src, src + srcSize);
+            sample_sizes.push_back(srcSize);
+        } catch(...) {
+            return 0;
+        }
+        std::memcpy(dst, src, srcSize);
+        return srcSize;
+    }
+    static bool is_error(const uint32_t blocksize) { return blocksize == 0; }
+};
+
+// Output stream for QioDictionarySampler, which only needs the blocks
+struct QioDiscardWriter {
+    uint32_t write(const char * const, const uint32_t count) { return count; }
+    template <typename T> void writeInteger(const T) {}
+};
+
+// Block modules hand the stream's dictionary to codecs that take one (the Zstd
+// compressors and decompressors); others, such as test doubles, go without.
+template <class codec, class = void>
+struct qio_takes_dictionary : std::false_type {};
+
+template <class codec>
+struct qio_takes_dictionary<codec, std::void_t<decltype(
+    std::declval<codec&>().set_dictionary(std::declval<const QioDictionary *>()))>> : std::true_type {};
+
+template <class codec>
+inline void qio_set_dictionary(codec & c, const QioDictionary * const dictionary) {
+    if constexpr (qio_takes_dictionary<codec>::value) {
+        c.set_dictionary(dictionary);
+    } else {
+        (void)c;
+        (void)dictionary;
+    }
+}
+
+#endif
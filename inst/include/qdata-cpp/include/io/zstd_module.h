@@ -7,15 +7,19 @@
 
 static constexpr uint32_t COMPRESSION_ERROR = 0;
 static constexpr uint32_t SHUFFLE_HEURISTIC_BLOCKSIZE = 32768;
-static constexpr uint32_t SHUFFLE_ELEMSIZE = 8;
 
 static constexpr uint32_t SHUFFLE_HEURISTIC_CL = -1;
 static constexpr uint32_t USE_HEURISTIC = 1;
 static constexpr uint32_t DONT_USE_HEURISTIC = 2;
+static constexpr uint32_t USE_BITSHUFFLE_HEURISTIC = 3;
 
 static constexpr int HIGH_COMPRESS_LEVEL_THRESHOLD = 14;
 static constexpr double HIGH_HEURISTIC_THRESHOLD = -0.25;
 static constexpr double LOW_HEURISTIC_THRESHOLD = 0;
+// a reused decision is dropped once a block's compression ratio strays this
+// far (relative, plus absolute) from the ratio of the block that made it
+static constexpr double DECISION_REUSE_RATIO_TOLERANCE = 0.1;
+static constexpr double DECISION_REUSE_RATIO_SLACK = 0.01;
 
 inline ZSTD_CCtx * checked_zstd_compression_context(ZSTD_CCtx * const context) {
     if(context == nullptr) {
@@ -31,16 +35,101 @@ inline ZSTD_DCtx * checked_zstd_decompression_context(ZSTD_DCtx * const context)
     return context;
 }
 
+// One zstd frame, with the stream's dictionary if it has one (set_dictionary).
+// A CDict that could not be prepared is passed on as nullptr, which zstd
+// reports as an error.
+inline size_t qio_zstd_compress(ZSTD_CCtx * const cctx, const QioDictionary * const dictionary,
+                                char * const dst, const size_t dstCapacity,
+                                const char * const src, const size_t srcSize, const int compress_level) {
+    if(dictionary == nullptr) {
+        return ZSTD_compressCCtx(cctx, dst, dstCapacity, src, srcSize, compress_level);
+    }
+    return ZSTD_compress_usingCDict(cctx, dst, dstCapacity, src, srcSize, dictionary->cdict(compress_level));
+}
+
+inline size_t qio_zstd_decompress(ZSTD_DCtx * const dctx, const QioDictionary * const dictionary,
+                                  char * const dst, const size_t dstCapacity,
+                                  const char * const src, const size_t srcSize) {
+    if(dictionary == nullptr) {
+        return ZSTD_decompressDCtx(dctx, dst, dstCapacity, src, srcSize);
+    }
+    return ZSTD_decompress_usingDDict(dctx, dst, dstCapacity, src, srcSize, dictionary->ddict());
+}
+
+// what ZSTD_isError() takes for zstd's generic error, for a block that does
+// not fit the destination
+static constexpr size_t QIO_ZSTD_STREAM_ERROR = static_cast<size_t>(-1);
+
+// QIO_FEATURE_LONG_RANGE: the block continues the frame that started with the
+// codec's first block, flushed so the reader can decompress everything up to
+// its end. The context is set up on that first block and keeps its window, so
+// one codec serves one stream.
+inline size_t qio_zstd_compress_stream(ZSTD_CCtx * const cctx, bool & started, const QioDictionary * const dictionary,
+                                       char * const dst, const size_t dstCapacity,
+                                       const char * const src, const size_t srcSize, const int compress_level) {
+    if(!started) {
+        size_t result = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compress_level);
+        if(!ZSTD_isError(result)) result = ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+        if(!ZSTD_isError(result)) result = ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, QIO_LONG_RANGE_WINDOW_LOG);
+        if(!ZSTD_isError(result) && dictionary != nullptr) {
+            result = ZSTD_CCtx_loadDictionary(cctx, dictionary->data(), dictionary->size());
+        }
+        if(ZSTD_isError(result)) return result;
+        started = true;
+    }
+    ZSTD_inBuffer input = {src, srcSize, 0};
+    ZSTD_outBuffer output = {dst, dstCapacity, 0};
+    size_t remaining;
+    do {
+        remaining = ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_flush);
+        if(ZSTD_isError(remaining)) return remaining;
+    } while(remaining != 0 && output.pos < output.size);
+    if(remaining != 0) return QIO_ZSTD_STREAM_ERROR;
+    return output.pos;
+}
+
+// The block's part of a QIO_FEATURE_LONG_RANGE frame. Blocks must come in the
+// order they were written, each exactly once.
+inline size_t qio_zstd_decompress_stream(ZSTD_DCtx * const dctx, bool & started, const QioDictionary * const dictionary,
+                                         char * const dst, const size_t dstCapacity,
+                                         const char * const src, const size_t srcSize) {
+    if(!started) {
+        size_t result = ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, QIO_LONG_RANGE_WINDOW_LOG);
+        if(!ZSTD_isError(result) && dictionary != nullptr) result = ZSTD_DCtx_refDDict(dctx, dictionary->ddict());
+        if(ZSTD_isError(result)) return result;
+        started = true;
+    }
+    ZSTD_inBuffer input = {src, srcSize, 0};
+    ZSTD_outBuffer output = {dst, dstCapacity, 0};
+    while(input.pos < input.size) {
+        const size_t result = ZSTD_decompressStream(dctx, &output, &input);
+        if(ZSTD_isError(result)) return result;
+        if(output.pos == output.size && input.pos < input.size) return QIO_ZSTD_STREAM_ERROR;
+    }
+    return output.pos;
+}
+
 struct ZstdCompressor {
     ZSTD_CCtx * cctx;
-    ZstdCompressor() : cctx(checked_zstd_compression_context(ZSTD_createCCtx())) {}
+    const QioDictionary * dictionary;
+    bool long_range;
+    bool stream_started;
+    ZstdCompressor() :
+    cctx(checked_zstd_compression_context(qio_buffer_pool().acquire_cctx())),
+    dictionary(nullptr),
+    long_range(false),
+    stream_started(false) {}
     ~ZstdCompressor() {
-        ZSTD_freeCCtx(cctx);
+        qio_buffer_pool().release_cctx(cctx);
     }
+    void set_dictionary(const QioDictionary * const d) { dictionary = d; }
+    void set_long_range(const bool l) { long_range = l; }
     uint32_t compress(char * const dst, const uint32_t dstCapacity,
                       const char * const src, const uint32_t srcSize,
-                      int compress_level) {
-        auto output = ZSTD_compressCCtx(cctx, dst, dstCapacity, src, srcSize, compress_level);
+                      int compress_level, const uint32_t = SHUFFLE_ELEMSIZE, const bool = false, const uint32_t = 0) {
+        auto output = long_range ?
+            qio_zstd_compress_stream(cctx, stream_started, dictionary, dst, dstCapacity, src, srcSize, compress_level) :
+            qio_zstd_compress(cctx, dictionary, dst, dstCapacity, src, srcSize, compress_level);
         if(ZSTD_isError(output)) {
             return COMPRESSION_ERROR;
         } else {
@@ -50,32 +139,87 @@ struct ZstdCompressor {
     static bool is_error(const uint32_t blocksize) { return blocksize == COMPRESSION_ERROR; }
 };
 
+// Scratch for the shuffled copy of a block. Sized for the default block size
+// and grown on first use by streams with larger blocks (QioFormat::block_size()).
+inline bool reserve_shuffleblock(QioBlock & shuffleblock, uint32_t & capacity, const uint32_t size) noexcept {
+    if(size <= capacity) return true;
+    try { shuffleblock = qio_pooled_block(size); } catch(...) { return false; }
+    capacity = size;
+    return true;
+}
+
 struct ZstdShuffleCompressor {
 
-    std::unique_ptr<char[]> shuffleblock;
+    // last heuristic decision and the settings and compression ratio of the
+    // block it was made for; uses_left counts the blocks that may still reuse it
+    struct ShuffleDecision {
+        uint32_t heuristic;
+        uint32_t elemsize;
+        int compress_level;
+        bool try_bitshuffle;
+        uint32_t uses_left;
+        double zratio;
+        ShuffleDecision() : heuristic(COMPRESSION_ERROR), elemsize(0), compress_level(0), try_bitshuffle(false), uses_left(0), zratio(0) {}
+    };
+
+    QioBlock shuffleblock;
+    uint32_t shuffleblock_capacity;
     ZSTD_CCtx * cctx;
+    const QioDictionary * dictionary;
+    bool long_range;
+    bool stream_started;
+    ShuffleDecision decision;
     ZstdShuffleCompressor() :
-    shuffleblock(MAKE_UNIQUE_BLOCK(MAX_BLOCKSIZE)),
-    cctx(checked_zstd_compression_context(ZSTD_createCCtx())) {}
+    shuffleblock(qio_pooled_block(MAX_BLOCKSIZE)),
+    shuffleblock_capacity(MAX_BLOCKSIZE),
+    cctx(checked_zstd_compression_context(qio_buffer_pool().acquire_cctx())),
+    dictionary(nullptr),
+    long_range(false),
+    stream_started(false) {}
     ~ZstdShuffleCompressor() {
-        ZSTD_freeCCtx(cctx);
+        qio_buffer_pool().release_cctx(cctx);
     }
+    // blocks are compressed with it; the heuristic's samples are not, since
+    // it only compares shuffled and unshuffled sizes
+    void set_dictionary(const QioDictionary * const d) { dictionary = d; }
+    // Long range blocks are not shuffled: data repeated far apart rarely lands
+    // at the same offset within its block, so shuffling would hide the repeat,
+    // and the heuristic's samples would reset the stream's context.
+    void set_long_range(const bool l) { long_range = l; }
 
     static bool is_error(const uint32_t blocksize) { return blocksize == COMPRESSION_ERROR; }
 
+    // shuffled copy of src in shuffleblock, which holds at least srcSize bytes
+    void shuffle_into_block(const char * const src, const uint32_t srcSize, const uint32_t elemsize, const bool bitshuffled) {
+        if(bitshuffled) {
+            bitshuffle(reinterpret_cast<const uint8_t*>(src), reinterpret_cast<uint8_t*>(shuffleblock.get()), srcSize, elemsize);
+        } else {
+            uint32_t remainder = srcSize % elemsize;
+            blosc_shuffle(reinterpret_cast<const uint8_t*>(src), reinterpret_cast<uint8_t*>(shuffleblock.get()), srcSize - remainder, elemsize);
+            std::memcpy(shuffleblock.get() + srcSize - remainder, src + srcSize - remainder, remainder);
+        }
+    }
+
+    // With bitshuffle, the samples are also bit shuffled and the smaller of the
+    // two shuffles stands in for "shuffled" in the model's features
     uint32_t use_shuffle_heuristic(char * const dst, const uint32_t dstCapacity, 
                                const char * const src, const uint32_t srcSize,
                                const int compress_level,
-                               const double threshold) {
+                               const double threshold,
+                               const uint32_t elemsize,
+                               const bool try_bitshuffle) {
         if(srcSize < 8*SHUFFLE_HEURISTIC_BLOCKSIZE) {
             return DONT_USE_HEURISTIC;
         } else {
             std::array<double, 9> features;
+            std::array<double, 4> bitshuf_features;
+            double shuf_total = 0;
+            double bitshuf_total = 0;
             features[8] = compress_level;
 
             for(int i = 0; i < 4; ++i) {
                 uint32_t block_offset = (srcSize / 4ULL) * i; // integer division, rounds down
-                blosc_shuffle(reinterpret_cast<const uint8_t*>(src + block_offset), reinterpret_cast<uint8_t*>(shuffleblock.get()), SHUFFLE_HEURISTIC_BLOCKSIZE, SHUFFLE_ELEMSIZE);
+                blosc_shuffle(reinterpret_cast<const uint8_t*>(src + block_offset), reinterpret_cast<uint8_t*>(shuffleblock.get()), SHUFFLE_HEURISTIC_BLOCKSIZE, elemsize);
                 auto shuf = ZSTD_compressCCtx(cctx, dst, dstCapacity, shuffleblock.get(),
                                                 SHUFFLE_HEURISTIC_BLOCKSIZE, 
                                                 SHUFFLE_HEURISTIC_CL);
@@ -86,41 +230,104 @@ struct ZstdShuffleCompressor {
                                                   SHUFFLE_HEURISTIC_CL);
                 if(ZSTD_isError(noshuf)) { return COMPRESSION_ERROR; }
 
+                if(try_bitshuffle) {
+                    shuffle_into_block(src + block_offset, SHUFFLE_HEURISTIC_BLOCKSIZE, elemsize, true);
+                    auto bitshuf = ZSTD_compressCCtx(cctx, dst, dstCapacity, shuffleblock.get(),
+                                                     SHUFFLE_HEURISTIC_BLOCKSIZE,
+                                                     SHUFFLE_HEURISTIC_CL);
+                    if(ZSTD_isError(bitshuf)) { return COMPRESSION_ERROR; }
+                    bitshuf_features[i] = bitshuf;
+                    bitshuf_total += bitshuf;
+                }
+
                 features[i*2] = shuf;
                 features[i*2+1] = noshuf;
+                shuf_total += shuf;
             }
 
+            const bool use_bitshuffle = try_bitshuffle && bitshuf_total < shuf_total;
+            if(use_bitshuffle) {
+                for(int i = 0; i < 4; ++i) features[i*2] = bitshuf_features[i];
+            }
             if( XgboostBlockshuffleModel::predict_xgboost_impl(features) > threshold ) {
-                return USE_HEURISTIC;
+                return use_bitshuffle ? USE_BITSHUFFLE_HEURISTIC : USE_HEURISTIC;
             } else {
                 return DONT_USE_HEURISTIC;
             }
         }
     }
 
+    // elemsize: element size of the data, e.g. 4 for int32, recorded in the
+    // returned size prefix when the block is shuffled. try_bitshuffle: the
+    // heuristic may pick a bit shuffle (QIO_FEATURE_BITSHUFFLE).
+    // decision_reuse: up to this many following blocks with the same settings
+    // skip the heuristic and reuse this block's decision
+    // (QioWriteOptions::shuffle_decision_reuse), until one compresses
+    // noticeably better or worse than this block did.
     uint32_t compress(char * const dst, const uint32_t dstCapacity,
                       const char * const src, const uint32_t srcSize,
-                      const int compress_level) {
+                      const int compress_level, uint32_t elemsize = SHUFFLE_ELEMSIZE,
+                      const bool try_bitshuffle = false, const uint32_t decision_reuse = 0) {
+        if(long_range) {
+            const size_t output = qio_zstd_compress_stream(cctx, stream_started, dictionary, dst, dstCapacity, src, srcSize, compress_level);
+            return ZSTD_isError(output) ? COMPRESSION_ERROR : static_cast<uint32_t>(output);
+        }
+        elemsize = supported_shuffle_elemsize(elemsize);
 
+        // blocks too small for the heuristic neither make nor reuse a decision
+        const bool reusable = decision_reuse > 0 && srcSize >= 8*SHUFFLE_HEURISTIC_BLOCKSIZE;
+        const bool reused = reusable && decision.uses_left > 0 &&
+                            decision.elemsize == elemsize &&
+                            decision.compress_level == compress_level &&
+                            decision.try_bitshuffle == try_bitshuffle;
         uint32_t heuristic;
-        if(compress_level >= HIGH_COMPRESS_LEVEL_THRESHOLD) {
-            heuristic = use_shuffle_heuristic(dst, dstCapacity, src, srcSize, compress_level, HIGH_HEURISTIC_THRESHOLD);
+        if(reused) {
+            heuristic = decision.heuristic;
+            --decision.uses_left;
+        } else if(compress_level >= HIGH_COMPRESS_LEVEL_THRESHOLD) {
+            heuristic = use_shuffle_heuristic(dst, dstCapacity, src, srcSize, compress_level, HIGH_HEURISTIC_THRESHOLD, elemsize, try_bitshuffle);
         } else {
-            heuristic = use_shuffle_heuristic(dst, dstCapacity, src, srcSize, compress_level, LOW_HEURISTIC_THRESHOLD);
+            heuristic = use_shuffle_heuristic(dst, dstCapacity, src, srcSize, compress_level, LOW_HEURISTIC_THRESHOLD, elemsize, try_bitshuffle);
         }
 
+        const uint32_t output = compress_with_heuristic(dst, dstCapacity, src, srcSize, compress_level, elemsize, heuristic);
+        if(reusable && !is_error(output)) {
+            const double zratio = static_cast<double>(compressed_block_size(output)) / srcSize;
+            if(!reused) {
+                decision.heuristic = heuristic;
+                decision.elemsize = elemsize;
+                decision.compress_level = compress_level;
+                decision.try_bitshuffle = try_bitshuffle;
+                decision.uses_left = decision_reuse;
+                decision.zratio = zratio;
+            } else {
+                const double drift = zratio > decision.zratio ? zratio - decision.zratio : decision.zratio - zratio;
+                if(drift > DECISION_REUSE_RATIO_TOLERANCE * decision.zratio + DECISION_REUSE_RATIO_SLACK) {
+                    decision.uses_left = 0; // the data has likely changed; decide again on the next block
+                }
+            }
+        }
+        return output;
+    }
+
+    uint32_t compress_with_heuristic(char * const dst, const uint32_t dstCapacity,
+                                     const char * const src, const uint32_t srcSize,
+                                     const int compress_level, const uint32_t elemsize,
+                                     const uint32_t heuristic) {
         if(heuristic == COMPRESSION_ERROR) {
             return COMPRESSION_ERROR;
-        } else if(heuristic == USE_HEURISTIC) {
+        } else if(heuristic == USE_HEURISTIC || heuristic == USE_BITSHUFFLE_HEURISTIC) {
+            const bool bitshuffled = heuristic == USE_BITSHUFFLE_HEURISTIC;
+            if(!reserve_shuffleblock(shuffleblock, shuffleblock_capacity, srcSize)) {
+                return COMPRESSION_ERROR;
+            }
             if(compress_level >= HIGH_COMPRESS_LEVEL_THRESHOLD) { // test both ways
                 // shuffle compress into new shuffleblock
-                std::unique_ptr<char[]> shuffle_zblock(MAKE_UNIQUE_BLOCK(MAX_ZBLOCKSIZE));
-                uint32_t remainder = srcSize % SHUFFLE_ELEMSIZE;
-                blosc_shuffle(reinterpret_cast<const uint8_t*>(src), reinterpret_cast<uint8_t*>(shuffleblock.get()), srcSize - remainder, SHUFFLE_ELEMSIZE);
-                std::memcpy(shuffleblock.get() + srcSize - remainder, src + srcSize - remainder, remainder);
-                auto output_size_with_shuffle = ZSTD_compressCCtx(cctx, shuffle_zblock.get(), MAX_ZBLOCKSIZE, shuffleblock.get(), srcSize, compress_level);
+                QioBlock shuffle_zblock(qio_pooled_block(dstCapacity));
+                shuffle_into_block(src, srcSize, elemsize, bitshuffled);
+                auto output_size_with_shuffle = qio_zstd_compress(cctx, dictionary, shuffle_zblock.get(), dstCapacity, shuffleblock.get(), srcSize, compress_level);
                 // compress without shuffle into dst
-                auto output_size_no_shuffle = ZSTD_compressCCtx(cctx, dst, dstCapacity, src, srcSize, compress_level);
+                auto output_size_no_shuffle = qio_zstd_compress(cctx, dictionary, dst, dstCapacity, src, srcSize, compress_level);
                 // check for any error and propagate
                 if(ZSTD_isError(output_size_with_shuffle) || ZSTD_isError(output_size_no_shuffle)) {
                     return COMPRESSION_ERROR;
@@ -128,24 +335,22 @@ struct ZstdShuffleCompressor {
                 if(output_size_with_shuffle < output_size_no_shuffle) {
                     // replace output in dst
                     std::memcpy(dst, shuffle_zblock.get(), output_size_with_shuffle);
-                    return output_size_with_shuffle | SHUFFLE_MASK;
+                    return output_size_with_shuffle | shuffled_block_metadata(elemsize, bitshuffled);
                 } else {
                     return output_size_no_shuffle;
                 }
             } else {
-                uint32_t remainder = srcSize % SHUFFLE_ELEMSIZE;
-                blosc_shuffle(reinterpret_cast<const uint8_t*>(src), reinterpret_cast<uint8_t*>(shuffleblock.get()), srcSize - remainder, SHUFFLE_ELEMSIZE);
-                std::memcpy(shuffleblock.get() + srcSize - remainder, src + srcSize - remainder, remainder);
-                auto output_size = ZSTD_compressCCtx(cctx, dst, dstCapacity, shuffleblock.get(), srcSize, compress_level);
+                shuffle_into_block(src, srcSize, elemsize, bitshuffled);
+                auto output_size = qio_zstd_compress(cctx, dictionary, dst, dstCapacity, shuffleblock.get(), srcSize, compress_level);
                 if(ZSTD_isError(output_size)) {
                     return COMPRESSION_ERROR;
                 } else {
-                return output_size | SHUFFLE_MASK;
+                return output_size | shuffled_block_metadata(elemsize, bitshuffled);
                 }
 
             }
         } else { // heuristic == DONT_USE_HEURISTIC
-            auto output_size = ZSTD_compressCCtx(cctx, dst, dstCapacity, src, srcSize, compress_level);
+            auto output_size = qio_zstd_compress(cctx, dictionary, dst, dstCapacity, src, srcSize, compress_level);
             if(ZSTD_isError(output_size)) {
                 return COMPRESSION_ERROR;
             } else {
@@ -157,56 +362,101 @@ struct ZstdShuffleCompressor {
 
 struct ZstdDecompressor {
     ZSTD_DCtx * dctx;
-    ZstdDecompressor() : dctx(checked_zstd_decompression_context(ZSTD_createDCtx())) {}
+    const QioDictionary * dictionary;
+    bool long_range;
+    bool stream_started;
+    ZstdDecompressor() :
+    dctx(checked_zstd_decompression_context(qio_buffer_pool().acquire_dctx())),
+    dictionary(nullptr),
+    long_range(false),
+    stream_started(false) {}
     ~ZstdDecompressor() {
-        ZSTD_freeDCtx(dctx);
+        qio_buffer_pool().release_dctx(dctx);
     }
+    void set_dictionary(const QioDictionary * const d) { dictionary = d; }
+    void set_long_range(const bool l) { long_range = l; }
     static bool is_error(const uint32_t blocksize) { return blocksize == COMPRESSION_ERROR; }
     uint32_t decompress(char * const dst, const uint32_t dstCapacity,
                         const char * const src, const uint32_t srcSize) {
-        if(srcSize > MAX_ZBLOCKSIZE) {
+        if(srcSize > ZSTD_COMPRESSBOUND(dstCapacity)) {
             return COMPRESSION_ERROR;
         }
-        auto output_blocksize = ZSTD_decompressDCtx(dctx, dst, dstCapacity, src, srcSize);
+        auto output_blocksize = long_range ?
+            qio_zstd_decompress_stream(dctx, stream_started, dictionary, dst, dstCapacity, src, srcSize) :
+            qio_zstd_decompress(dctx, dictionary, dst, dstCapacity, src, srcSize);
         if(ZSTD_isError(output_blocksize)) {
             return COMPRESSION_ERROR;
         }
         return output_blocksize;
     }
+    // decompress, but the block's first headSize bytes end up in head instead
+    // of dst, which holds the rest at their offsets within the block
+    uint32_t decompress_split(char * const head, const uint32_t headSize,
+                              char * const dst, const uint32_t dstCapacity,
+                              const char * const src, const uint32_t srcSize) {
+        const uint32_t output_blocksize = decompress(dst, dstCapacity, src, srcSize);
+        if(!is_error(output_blocksize)) {
+            std::memcpy(head, dst, std::min(headSize, output_blocksize));
+        }
+        return output_blocksize;
+    }
 };
 
 struct ZstdShuffleDecompressor {
-    std::unique_ptr<char[]> shuffleblock;
+    QioBlock shuffleblock;
+    uint32_t shuffleblock_capacity;
     ZSTD_DCtx * dctx;
+    const QioDictionary * dictionary;
+    bool long_range;
+    bool stream_started;
     ZstdShuffleDecompressor() :
-    shuffleblock(MAKE_UNIQUE_BLOCK(MAX_BLOCKSIZE)),
-    dctx(checked_zstd_decompression_context(ZSTD_createDCtx())) {}
+    shuffleblock(qio_pooled_block(MAX_BLOCKSIZE)),
+    shuffleblock_capacity(MAX_BLOCKSIZE),
+    dctx(checked_zstd_decompression_context(qio_buffer_pool().acquire_dctx())),
+    dictionary(nullptr),
+    long_range(false),
+    stream_started(false) {}
     ~ZstdShuffleDecompressor() {
-        ZSTD_freeDCtx(dctx);
+        qio_buffer_pool().release_dctx(dctx);
     }
+    void set_dictionary(const QioDictionary * const d) { dictionary = d; }
+    void set_long_range(const bool l) { long_range = l; }
     static bool is_error(const uint32_t blocksize) { return blocksize == COMPRESSION_ERROR; }
+    size_t decompress_zstd(char * const dst, const size_t dstCapacity, const char * const src, const size_t srcSize) {
+        return long_range ? qio_zstd_decompress_stream(dctx, stream_started, dictionary, dst, dstCapacity, src, srcSize) :
+                            qio_zstd_decompress(dctx, dictionary, dst, dstCapacity, src, srcSize);
+    }
     uint32_t decompress(char * const dst, const uint32_t dstCapacity,
                         const char * const src, uint32_t srcSize) { // srcSize modified by shuffle mask, so not const
         bool is_shuffled = srcSize & SHUFFLE_MASK;
         if(is_shuffled) {
-            // set shuffle bit to zero, negate shuffle mask
-            srcSize = srcSize & (~SHUFFLE_MASK);
-            if(srcSize > MAX_ZBLOCKSIZE) {
+            const uint32_t elemsize = shuffled_block_elemsize(srcSize);
+            const bool bitshuffled = srcSize & BITSHUFFLE_MASK;
+            // clear the metadata bits
+            srcSize = compressed_block_size(srcSize);
+            if(srcSize > ZSTD_COMPRESSBOUND(dstCapacity)) {
                 return COMPRESSION_ERROR; // 0 indicates an error
             }
-            auto output_blocksize = ZSTD_decompressDCtx(dctx, shuffleblock.get(), dstCapacity, src, srcSize);
+            if(!reserve_shuffleblock(shuffleblock, shuffleblock_capacity, dstCapacity)) {
+                return COMPRESSION_ERROR;
+            }
+            auto output_blocksize = decompress_zstd(shuffleblock.get(), dstCapacity, src, srcSize);
             if(ZSTD_isError(output_blocksize)) {
                 return COMPRESSION_ERROR; // 0 indicates an error
             }
-            uint32_t remainder = output_blocksize % SHUFFLE_ELEMSIZE;
-            blosc_unshuffle(reinterpret_cast<uint8_t*>(shuffleblock.get()), reinterpret_cast<uint8_t*>(dst), output_blocksize - remainder, SHUFFLE_ELEMSIZE);
+            if(bitshuffled) {
+                bitunshuffle(reinterpret_cast<uint8_t*>(shuffleblock.get()), reinterpret_cast<uint8_t*>(dst), output_blocksize, elemsize);
+                return output_blocksize;
+            }
+            uint32_t remainder = output_blocksize % elemsize;
+            blosc_unshuffle(reinterpret_cast<uint8_t*>(shuffleblock.get()), reinterpret_cast<uint8_t*>(dst), output_blocksize - remainder, elemsize);
             std::memcpy(dst + output_blocksize - remainder, shuffleblock.get() + output_blocksize - remainder, remainder);
             return output_blocksize;
         } else {
-            if(srcSize > MAX_ZBLOCKSIZE) {
+            if(srcSize > ZSTD_COMPRESSBOUND(dstCapacity)) {
                 return COMPRESSION_ERROR; // 0 indicates an error
             }
-            auto output_blocksize = ZSTD_decompressDCtx(dctx, dst, dstCapacity, src, srcSize);
+            auto output_blocksize = decompress_zstd(dst, dstCapacity, src, srcSize);
             if(ZSTD_isError(output_blocksize)) {
 
                 return COMPRESSION_ERROR; // 0 indicates an error
@@ -214,6 +464,45 @@ struct ZstdShuffleDecompressor {
             return output_blocksize;
         }
     }
+    // decompress, but the block's first headSize bytes end up in head instead
+    // of dst, which holds the rest at their offsets within the block. A byte
+    // shuffled block is unshuffled straight into both, so the head is written
+    // once instead of being unshuffled into dst and copied out.
+    uint32_t decompress_split(char * const head, const uint32_t headSize,
+                              char * const dst, const uint32_t dstCapacity,
+                              const char * const src, uint32_t srcSize) {
+        if(!(srcSize & SHUFFLE_MASK) || (srcSize & BITSHUFFLE_MASK)) {
+            const uint32_t output_blocksize = decompress(dst, dstCapacity, src, srcSize);
+            if(!is_error(output_blocksize)) {
+                std::memcpy(head, dst, std::min(headSize, output_blocksize));
+            }
+            return output_blocksize;
+        }
+        const uint32_t elemsize = shuffled_block_elemsize(srcSize);
+        srcSize = compressed_block_size(srcSize);
+        if(srcSize > ZSTD_COMPRESSBOUND(dstCapacity)) {
+            return COMPRESSION_ERROR;
+        }
+        if(!reserve_shuffleblock(shuffleblock, shuffleblock_capacity, dstCapacity)) {
+            return COMPRESSION_ERROR;
+        }
+        auto output_blocksize = decompress_zstd(shuffleblock.get(), dstCapacity, src, srcSize);
+        if(ZSTD_isError(output_blocksize)) {
+            return COMPRESSION_ERROR;
+        }
+        const uint8_t * const shuffled = reinterpret_cast<const uint8_t*>(shuffleblock.get());
+        const uint32_t head_bytes = std::min(headSize, static_cast<uint32_t>(output_blocksize));
+        const uint32_t elements = output_blocksize / elemsize;
+        const uint32_t head_elements = head_bytes / elemsize;
+        const uint32_t whole = elements * elemsize;
+        blosc_unshuffle_elements(shuffled, reinterpret_cast<uint8_t*>(head), elements, 0, head_elements, elemsize);
+        blosc_unshuffle_elements(shuffled, reinterpret_cast<uint8_t*>(dst + head_elements * elemsize), elements,
+                                 head_elements, elements, elemsize);
+        std::memcpy(dst + whole, shuffleblock.get() + whole, output_blocksize - whole);
+        // an element split by the end of the head, or trailing bytes the head reaches into
+        std::memcpy(head + head_elements * elemsize, dst + head_elements * elemsize, head_bytes - head_elements * elemsize);
+        return output_blocksize;
+    }
 };
 
 #endif
@@ -5,13 +5,24 @@
 #include <array>
 #include <cstring>
 #include <string>
+#include <vector>
 
 #include "constants.h"
 #include "../../io/io_common.h"
 #include "../../io/xxhash_module.h"
 
-static constexpr uint8_t QS2_CURRENT_FORMAT_VER = 1_u8;
-static constexpr uint8_t QDATA_CURRENT_FORMAT_VER = 1_u8;
+static constexpr uint8_t QS2_CURRENT_FORMAT_VER = 2_u8;
+static constexpr uint8_t QDATA_CURRENT_FORMAT_VER = 2_u8;
+// Version 2 adds optional block stream features (QioFormat) in the first
+// reserved byte, with QIO_FEATURE_BLOCK_SIZE the log2 block size in the
+// second, and with QIO_FEATURE_DICTIONARY the zstd dictionary ID in bytes
+// 12-15. Byte 10 is a second feature byte, none of whose features exist yet,
+// and byte 11 is reserved. A version 2 reader rejects a file with any of
+// these bytes set that its features do not explain, so later extensions need
+// no version bump. A file that uses no feature is still written as version 1,
+// so it stays readable by releases that predate the features.
+static constexpr uint8_t QX_BASE_FORMAT_VER = 1_u8;
+static constexpr uint8_t QX_FEATURES_FORMAT_VER = 2_u8;
 
 static constexpr uint8_t ZSTD_COMPRESSION_FLAG = 1_u8;
 static constexpr uint8_t BIG_ENDIAN_FLAG = 1_u8;
@@ -19,7 +30,13 @@ static constexpr uint8_t LITTLE_ENDIAN_FLAG = 2_u8;
 static constexpr uint8_t NO_SHUFFLE_FLAG = 0_u8;
 static constexpr uint8_t YES_SHUFFLE_FLAG = 1_u8;
 
+static constexpr uint64_t HEADER_FEATURES_POSITION = 8;
+static constexpr uint64_t HEADER_BLOCK_SHIFT_POSITION = 9;
+static constexpr uint64_t HEADER_EXTENDED_FEATURES_POSITION = 10;
+static constexpr uint64_t HEADER_RESERVED_POSITION = 11;
+static constexpr uint64_t HEADER_DICTIONARY_ID_POSITION = 12;
 static constexpr uint64_t HEADER_HASH_POSITION = 16;
+static constexpr uint64_t QX_HEADER_SIZE = 24;
 
 static const std::array<uint8_t,4> QS2_MAGIC_BITS = {0x0B,0x0E,0x0A,0xC1};
 static const std::array<uint8_t,4> QDATA_MAGIC_BITS = {0x0B,0x0E,0x0A,0xCD};
@@ -44,20 +61,63 @@ inline bool checkMagicNumber(uint8_t const * const bits, uint8_t const * const m
     return true;
 }
 
+inline uint8_t qx_format_version(const QioFormat & format) {
+    return format.features != 0 ? QX_FEATURES_FORMAT_VER : QX_BASE_FORMAT_VER;
+}
+
+// Only version 2 and later give the reserved bytes a meaning. False if a byte
+// holds something the features read here do not account for; format still
+// gets every field that could be read, for qx_dump.
+inline bool read_qx_features(uint8_t const * const bits, QioFormat & format) {
+    format = QioFormat();
+    if(bits[4] < QX_FEATURES_FORMAT_VER) return true;
+    bool known = bits[HEADER_EXTENDED_FEATURES_POSITION] == 0 && bits[HEADER_RESERVED_POSITION] == 0;
+    format.features = bits[HEADER_FEATURES_POSITION];
+    if(format.has(QIO_FEATURE_BLOCK_SIZE)) {
+        if(QioFormat::valid_block_shift(bits[HEADER_BLOCK_SHIFT_POSITION])) {
+            format.block_shift = bits[HEADER_BLOCK_SHIFT_POSITION];
+        } else {
+            known = false;
+        }
+    } else if(bits[HEADER_BLOCK_SHIFT_POSITION] != 0) {
+        known = false;
+    }
+    if(format.has(QIO_FEATURE_DICTIONARY)) {
+        std::memcpy(&format.dictionary_id, bits + HEADER_DICTIONARY_ID_POSITION, 4);
+        if(format.dictionary_id == 0) known = false;
+    } else {
+        for(uint64_t i = HEADER_DICTIONARY_ID_POSITION; i < HEADER_HASH_POSITION; ++i) {
+            if(bits[i] != 0) known = false;
+        }
+    }
+    return known;
+}
+
+inline void write_qx_features(uint8_t * const bits, const QioFormat & format) {
+    bits[HEADER_FEATURES_POSITION] = format.features;
+    if(format.has(QIO_FEATURE_BLOCK_SIZE)) {
+        bits[HEADER_BLOCK_SHIFT_POSITION] = format.block_shift;
+    }
+    if(format.has(QIO_FEATURE_DICTIONARY)) {
+        std::memcpy(bits + HEADER_DICTIONARY_ID_POSITION, &format.dictionary_id, 4);
+    }
+}
+
 template <typename stream_writer>
-inline void write_qs2_header(stream_writer & writer, const bool shuffle) {
+inline void write_qs2_header(stream_writer & writer, const bool shuffle, const QioFormat & format = QioFormat()) {
     std::array<uint8_t, 24> bits = {};
     std::memcpy(bits.data(), QS2_MAGIC_BITS.data(), 4);
-    bits[4] = QS2_CURRENT_FORMAT_VER;
+    bits[4] = qx_format_version(format);
     bits[5] = ZSTD_COMPRESSION_FLAG; // compress algorithm, currently zstd only
     bits[6] = is_big_endian() ? BIG_ENDIAN_FLAG : LITTLE_ENDIAN_FLAG;
     bits[7] = shuffle ? YES_SHUFFLE_FLAG : NO_SHUFFLE_FLAG;
     std::memcpy(bits.data() + 8, RESERVED_BITS.data(), RESERVED_BITS.size());
+    write_qx_features(bits.data(), format);
     writer.write(reinterpret_cast<char*>(bits.data()), bits.size());
 }
 
 template <typename stream_reader>
-inline void read_qs2_header(stream_reader & reader, bool & shuffle, uint64_t & hash) {
+inline void read_qs2_header(stream_reader & reader, bool & shuffle, uint64_t & hash, QioFormat & format) {
     std::array<uint8_t, 24> bits = {};
     reader.read(reinterpret_cast<char*>(bits.data()), bits.size());
     if(! checkMagicNumber(bits.data(), QS2_MAGIC_BITS.data())) {
@@ -84,20 +144,24 @@ inline void read_qs2_header(stream_reader & reader, bool & shuffle, uint64_t & h
     }
     uint8_t shuffle_bit = bits[7];
     shuffle = shuffle_bit != NO_SHUFFLE_FLAG;
+    if(!read_qx_features(bits.data(), format)) {
+        throw std::runtime_error("qs2 file uses format features this version does not support; please update qs2 to latest version");
+    }
 
     // stored hash
     std::memcpy(&hash, bits.data() + HEADER_HASH_POSITION, 8);
 }
 
 template <typename stream_writer>
-inline void write_qdata_header(stream_writer & writer, const bool shuffle) {
+inline void write_qdata_header(stream_writer & writer, const bool shuffle, const QioFormat & format = QioFormat()) {
     std::array<uint8_t, 24> bits = {};
     std::memcpy(bits.data(), QDATA_MAGIC_BITS.data(), 4);
-    bits[4] = QDATA_CURRENT_FORMAT_VER;
+    bits[4] = qx_format_version(format);
     bits[5] = ZSTD_COMPRESSION_FLAG; // compress algorithm, currently zstd only
     bits[6] = is_big_endian() ? BIG_ENDIAN_FLAG : LITTLE_ENDIAN_FLAG;
     bits[7] = shuffle ? YES_SHUFFLE_FLAG : NO_SHUFFLE_FLAG;
     std::memcpy(bits.data() + 8, RESERVED_BITS.data(), RESERVED_BITS.size());
+    write_qx_features(bits.data(), format);
     writer.write(reinterpret_cast<char*>(bits.data()), bits.size());
 }
 
@@ -113,7 +177,7 @@ inline void write_qx_hash(stream_writer & writer, const uint64_t value) {
 
 
 template <typename stream_reader>
-inline void read_qdata_header(stream_reader & reader, bool & shuffle, uint64_t & hash) {
+inline void read_qdata_header(stream_reader & reader, bool & shuffle, uint64_t & hash, QioFormat & format) {
     std::array<uint8_t, 24> bits = {};
     reader.read(reinterpret_cast<char*>(bits.data()), bits.size());
     if(! checkMagicNumber(bits.data(), QDATA_MAGIC_BITS.data())) {
@@ -140,6 +204,9 @@ inline void read_qdata_header(stream_reader & reader, bool & shuffle, uint64_t &
     }
     uint8_t shuffle_bit = bits[7];
     shuffle = shuffle_bit != NO_SHUFFLE_FLAG;
+    if(!read_qx_features(bits.data(), format)) {
+        throw std::runtime_error("qdata file uses format features this version does not support; please update qdata to latest version");
+    }
 
     // stored hash
     std::memcpy(&hash, bits.data() + HEADER_HASH_POSITION, 8);
@@ -154,6 +221,7 @@ struct qxHeaderInfo {
     int shuffle;
     std::string file_endian;
     std::string stored_hash;
+    QioFormat block_format;
 };
 
 template <typename stream_reader>
@@ -189,6 +257,8 @@ inline qxHeaderInfo read_qx_header(stream_reader & reader) {
         output.file_endian = "unknown";
     }
     output.shuffle = bits[7];
+    // unknown feature bits are kept; qx_dump is for inspecting files
+    read_qx_features(bits.data(), output.block_format);
 
     // stored hash
     uint64_t stored_hash;
@@ -200,17 +270,99 @@ inline qxHeaderInfo read_qx_header(stream_reader & reader) {
 
 // get file hash from remaining bytes from the current position
 // reset seek position to current position
+// With QIO_FEATURE_BLOCK_HASH the blocks are walked like the block readers do:
+// each block's size prefix and stored hash are hashed, its data is checked
+// against the stored hash, and the footer (if any) is hashed as is. Returns 0
+// if a block does not match its hash.
 template <class stream_reader>
-uint64_t read_qx_hash(stream_reader & reader) {
+uint64_t read_qx_hash(stream_reader & reader, const QioFormat format = QioFormat()) {
     auto current_position = reader.tellg();
     xxHashEnv env;
-    std::unique_ptr<char[]> zblock(MAKE_UNIQUE_BLOCK(MAX_ZBLOCKSIZE));
-    uint64_t bytes_read = 0;
-    while( (bytes_read = reader.read(zblock.get(), MAX_ZBLOCKSIZE)) ) {
-        env.update(zblock.get(), bytes_read);
+    const uint32_t max_zblock_size = format.max_zblock_size();
+    QioBlock zblock(qio_pooled_block(max_zblock_size));
+    bool corrupt = false;
+    if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+        uint32_t zsize;
+        while(reader.readInteger(zsize)) {
+            env.update(zsize);
+            if(zsize == BLOCK_STREAM_TERMINATOR) break;
+            const uint32_t zbytes = compressed_block_size(zsize);
+            uint64_t stored_block_hash;
+            if(!compressed_block_size_fits_buffer(zsize, format) ||
+               reader.read(zblock.get(), zbytes) != zbytes ||
+               !reader.readInteger(stored_block_hash)) {
+                corrupt = true;
+                break;
+            }
+            env.update(stored_block_hash);
+            if(qio_block_hash(zblock.get(), zbytes) != stored_block_hash) {
+                corrupt = true;
+                break;
+            }
+        }
+    }
+    if(!corrupt) {
+        qio_hash_remaining(reader, env, zblock.get(), max_zblock_size);
     }
     reader.seekg(current_position);
-    return env.digest();
+    return corrupt ? 0 : env.digest();
+}
+
+// Block index footer (QIO_FEATURE_BLOCK_INDEX), located from the end of the
+// stream. Offsets are converted to positions from the start of the file, so an
+// entry can be used with seekg directly. The read position is restored.
+struct qxBlockIndex {
+    std::vector<QioBlockIndexEntry> blocks;
+    uint64_t uncompressed_size;
+};
+
+template <class stream_reader>
+inline qxBlockIndex read_qx_block_index(stream_reader & reader) {
+    const uint64_t current_position = reader.tellg();
+    const uint64_t stream_size = reader.size();
+    std::array<uint8_t, 24> bits = {};
+    reader.seekg(0);
+    if(reader.read(reinterpret_cast<char*>(bits.data()), bits.size()) != bits.size() ||
+       !(checkMagicNumber(bits.data(), QS2_MAGIC_BITS.data()) || checkMagicNumber(bits.data(), QDATA_MAGIC_BITS.data()))) {
+        throw std::runtime_error("Unknown file format detected");
+    }
+    QioFormat format;
+    if(!read_qx_features(bits.data(), format) || !format.has(QIO_FEATURE_BLOCK_INDEX)) {
+        throw std::runtime_error("File does not store a block index");
+    }
+    if(stream_size < QX_HEADER_SIZE + sizeof(uint32_t) + BLOCK_INDEX_TRAILER_BYTES) {
+        throw std::runtime_error("Block index footer is truncated");
+    }
+    const uint64_t stream_end = stream_size - QX_HEADER_SIZE; // relative to the block stream
+    qxBlockIndex output;
+    uint64_t block_count = 0;
+    uint64_t footer_offset = 0;
+    reader.seekg(stream_size - BLOCK_INDEX_TRAILER_BYTES);
+    if(!reader.readInteger(output.uncompressed_size) ||
+       !reader.readInteger(block_count) ||
+       !reader.readInteger(footer_offset) ||
+       block_count > stream_end / BLOCK_INDEX_ENTRY_BYTES ||
+       footer_offset > stream_end ||
+       stream_end - footer_offset != sizeof(uint32_t) + block_count * BLOCK_INDEX_ENTRY_BYTES + BLOCK_INDEX_TRAILER_BYTES) {
+        throw std::runtime_error("Block index footer is corrupted");
+    }
+    reader.seekg(QX_HEADER_SIZE + footer_offset);
+    uint32_t terminator = 1;
+    if(!reader.readInteger(terminator) || terminator != BLOCK_STREAM_TERMINATOR) {
+        throw std::runtime_error("Block index footer is corrupted");
+    }
+    output.blocks.resize(static_cast<std::size_t>(block_count));
+    for(QioBlockIndexEntry & entry : output.blocks) {
+        if(!reader.readInteger(entry.offset) ||
+           !reader.readInteger(entry.zsize) ||
+           !reader.readInteger(entry.uncompressed_start) ||
+           entry.offset >= footer_offset) {
+            throw std::runtime_error("Block index footer is corrupted");
+        }
+        entry.offset += QX_HEADER_SIZE;
+    }
+    reader.seekg(current_position);
+    return output;
 }
 
 #endif
@@ -29,6 +29,15 @@ public:
         return static_cast<std::uint32_t>(bytes_to_actually_read);
     }
 
+    // lends the next bytes instead of copying them, see qio_can_borrow
+    std::uint32_t borrow(const char*& data, const std::uint32_t bytes_to_read) {
+        const auto bytes_available = size_ - position_;
+        const auto bytes_to_actually_read = std::min<std::uint64_t>(bytes_to_read, bytes_available);
+        data = buffer_ + position_;
+        position_ += bytes_to_actually_read;
+        return static_cast<std::uint32_t>(bytes_to_actually_read);
+    }
+
     template <typename T>
     bool readInteger(T& value) {
         return read(reinterpret_cast<char*>(&value), sizeof(T)) == sizeof(T);
@@ -42,6 +51,10 @@ public:
         return position_;
     }
 
+    std::uint64_t size() const {
+        return size_;
+    }
+
 private:
     const char* buffer_;
     std::uint64_t size_;
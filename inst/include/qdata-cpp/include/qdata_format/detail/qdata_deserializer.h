@@ -9,10 +9,10 @@
 
 #include "../../io/block_module.h"
 #include "../../io/filestream_module.h"
+#include "../../io/mmap_module.h"
 #include "../../io/zstd_module.h"
 
-#ifdef QIO_HAS_TBB
-#include <tbb/global_control.h>
+#ifdef QIO_HAS_MULTITHREADING
 #include "../../io/multithreaded_block_module.h"
 #endif
 
@@ -78,6 +78,9 @@ private:
         for(auto* values : string_payloads_) {
             read_string_payloads(*values);
         }
+        if constexpr (qio_can_plan_payloads<BlockReader>::value) {
+            reader_.plan_payloads(payload_spans());
+        }
         for(auto* values : complex_payloads_) {
             reader_.get_data(
                 reinterpret_cast<char*>(values->data()),
@@ -109,6 +112,25 @@ private:
         raw_payloads_.clear();
     }
 
+    // the numeric and raw payloads in the order read_object_data() reads them
+    std::vector<QioPayloadSpan> payload_spans() const {
+        std::vector<QioPayloadSpan> spans;
+        spans.reserve(complex_payloads_.size() + real_payloads_.size() + integer_payloads_.size() + raw_payloads_.size());
+        for(auto* values : complex_payloads_) {
+            spans.push_back({reinterpret_cast<char*>(values->data()), values->size() * sizeof(std::complex<double>)});
+        }
+        for(auto* values : real_payloads_) {
+            spans.push_back({reinterpret_cast<char*>(values->data()), values->size() * sizeof(double)});
+        }
+        for(auto* values : integer_payloads_) {
+            spans.push_back({reinterpret_cast<char*>(values->data()), values->size() * sizeof(std::int32_t)});
+        }
+        for(auto* values : raw_payloads_) {
+            spans.push_back({reinterpret_cast<char*>(values->data()), values->size() * sizeof(std::byte)});
+        }
+        return spans;
+    }
+
     class recursion_depth_guard {
     public:
         explicit recursion_depth_guard(qdata_deserializer& owner) : owner_(owner) {
@@ -271,82 +293,125 @@ private:
 };
 
 template <class StreamReader, class Decompressor>
-inline object read_single_thread(StreamReader& stream, const std::size_t max_depth) {
-    BlockCompressReader<StreamReader, Decompressor, StdErrorPolicy> block_reader(stream);
+inline object read_single_thread(StreamReader& stream, const std::size_t max_depth, const QioFormat format,
+                                 const QioReadOptions& io_options, std::uint64_t& runtime_hash,
+                                 std::uint64_t& corrupt_block) {
+    BlockCompressReader<StreamReader, Decompressor, StdErrorPolicy> block_reader(stream, format, io_options);
     qdata_deserializer<decltype(block_reader)> stream_reader(block_reader, max_depth);
     object output;
     stream_reader.read_object(output);
     block_reader.finish();
+    runtime_hash = block_reader.get_hash_digest();
+    corrupt_block = block_reader.corrupt_block();
     return output;
 }
 
-#ifdef QIO_HAS_TBB
+#ifdef QIO_HAS_MULTITHREADING
 template <class StreamReader, class Decompressor>
-inline object read_multi_thread(StreamReader& stream, const int nthreads, const std::size_t max_depth) {
-    tbb::global_control gc(tbb::global_control::parameter::max_allowed_parallelism, normalized_read_nthreads(nthreads));
-    BlockCompressReaderMT<StreamReader, Decompressor, StdErrorPolicy> block_reader(stream);
-    qdata_deserializer<decltype(block_reader)> stream_reader(block_reader, max_depth);
+inline object read_multi_thread(StreamReader& stream, const int nthreads, const std::size_t max_depth, const QioFormat format,
+                                const QioReadOptions& io_options, std::uint64_t& runtime_hash,
+                                std::uint64_t& corrupt_block) {
+    QioReadOptions threaded_options = io_options;
+    threaded_options.nthreads = static_cast<std::uint32_t>(normalized_read_nthreads(nthreads));
+    // declared first so the reader, whose workers may be writing into it, goes first
     object output;
+    BlockCompressReaderMT<StreamReader, Decompressor, StdErrorPolicy> block_reader(stream, format, threaded_options);
+    qdata_deserializer<decltype(block_reader)> stream_reader(block_reader, max_depth);
     stream_reader.read_object(output);
     block_reader.finish();
+    runtime_hash = block_reader.get_hash_digest();
+    corrupt_block = block_reader.corrupt_block();
     return output;
 }
 #endif
 
+template <class StreamReader, class Decompressor>
+inline object read_blocks(StreamReader& stream, const int nthreads, const std::size_t max_depth, const QioFormat format,
+                          const QioReadOptions& io_options, std::uint64_t& runtime_hash,
+                          std::uint64_t& corrupt_block) {
+#ifdef QIO_HAS_MULTITHREADING
+    if(nthreads > 1 && qio_parallel_blocks(format)) {
+        return read_multi_thread<StreamReader, Decompressor>(stream, nthreads, max_depth, format, io_options, runtime_hash, corrupt_block);
+    }
+#else
+    (void)nthreads;
+#endif
+    return read_single_thread<StreamReader, Decompressor>(stream, max_depth, format, io_options, runtime_hash, corrupt_block);
+}
+
 template <class StreamReader>
 inline object read_qdata_object(StreamReader& stream,
                                 const bool validate_checksum,
                                 const int nthreads,
-                                const std::size_t max_depth) {
+                                const std::size_t max_depth,
+                                const QioReadOptions& io_options = QioReadOptions()) {
     bool shuffle = false;
     std::uint64_t stored_hash = 0;
-    read_qdata_header(stream, shuffle, stored_hash);
+    QioFormat format;
+    read_qdata_header(stream, shuffle, stored_hash, format);
+    if(const char* const dictionary_error = qio_dictionary_error(format, io_options.dictionary.get())) {
+        throw std::runtime_error(dictionary_error);
+    }
 
     if(validate_checksum) {
         if(stored_hash == 0) {
             throw std::runtime_error("qdata input does not contain a stored checksum");
         }
-        const auto computed_hash = read_qx_hash(stream);
-        if(computed_hash != stored_hash) {
-            throw std::runtime_error("qdata checksum mismatch");
+        if(!io_options.single_pass_checksum) {
+            const auto computed_hash = read_qx_hash(stream, format);
+            if(computed_hash != stored_hash) {
+                throw std::runtime_error("qdata checksum mismatch");
+            }
         }
     }
 
-    if(shuffle) {
-#ifdef QIO_HAS_TBB
-        if(nthreads > 1) {
-            return read_multi_thread<StreamReader, ZstdShuffleDecompressor>(stream, nthreads, max_depth);
+    std::uint64_t runtime_hash = 0;
+    std::uint64_t corrupt_block = QIO_NO_CORRUPT_BLOCK;
+    object output = shuffle ?
+        read_blocks<StreamReader, ZstdShuffleDecompressor>(stream, nthreads, max_depth, format, io_options, runtime_hash, corrupt_block) :
+        read_blocks<StreamReader, ZstdDecompressor>(stream, nthreads, max_depth, format, io_options, runtime_hash, corrupt_block);
+    // the block readers hash everything after the header, so this also covers the two-pass case
+    if(validate_checksum && runtime_hash != stored_hash) {
+        if(corrupt_block != QIO_NO_CORRUPT_BLOCK) {
+            throw std::runtime_error("qdata checksum mismatch in block " + std::to_string(corrupt_block));
         }
-#endif
-        return read_single_thread<StreamReader, ZstdShuffleDecompressor>(stream, max_depth);
+        throw std::runtime_error("qdata checksum mismatch");
     }
-
-#ifdef QIO_HAS_TBB
-    if(nthreads > 1) {
-        return read_multi_thread<StreamReader, ZstdDecompressor>(stream, nthreads, max_depth);
-    }
-#endif
-    return read_single_thread<StreamReader, ZstdDecompressor>(stream, max_depth);
+    return output;
 }
 
 inline object read_file_impl(const std::string& file,
                              const bool validate_checksum,
                              const int nthreads,
-                             const std::size_t max_depth) {
+                             const std::size_t max_depth,
+                             const bool use_mmap = false,
+                             const QioReadOptions& io_options = QioReadOptions()) {
+#ifdef QIO_HAS_MMAP
+    if(use_mmap) {
+        MmapFileReader mapped(file.c_str());
+        if(mapped.isValid()) {
+            return read_qdata_object(mapped, validate_checksum, nthreads, max_depth, io_options);
+        }
+        // not mappable (e.g. not a regular file): read it as a stream instead
+    }
+#else
+    (void)use_mmap;
+#endif
     IfStreamReader stream(file.c_str());
     if(!stream.isValid()) {
         throw std::runtime_error("failed to open file for reading: " + file);
     }
-    return read_qdata_object(stream, validate_checksum, nthreads, max_depth);
+    return read_qdata_object(stream, validate_checksum, nthreads, max_depth, io_options);
 }
 
 inline object deserialize_impl(const void* data,
                                const std::size_t size,
                                const bool validate_checksum,
                                const int nthreads,
-                               const std::size_t max_depth) {
+                               const std::size_t max_depth,
+                               const QioReadOptions& io_options = QioReadOptions()) {
     memory_reader stream(data, static_cast<std::uint64_t>(size));
-    return read_qdata_object(stream, validate_checksum, nthreads, max_depth);
+    return read_qdata_object(stream, validate_checksum, nthreads, max_depth, io_options);
 }
 
 } // namespace detail
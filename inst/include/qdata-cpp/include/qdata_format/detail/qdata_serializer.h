@@ -10,8 +10,7 @@
 #include "../../io/filestream_module.h"
 #include "../../io/zstd_module.h"
 
-#ifdef QIO_HAS_TBB
-#include <tbb/global_control.h>
+#ifdef QIO_HAS_MULTITHREADING
 #include "../../io/multithreaded_block_module.h"
 #endif
 
@@ -129,28 +128,28 @@ public:
     void write_logical_data(const std::int32_t* data, std::size_t size) override {
         require_payload_flush("write_logical_data");
         if(size > 0) {
-            writer_.push_data(reinterpret_cast<const char*>(data), size * sizeof(std::int32_t));
+            writer_.push_data(reinterpret_cast<const char*>(data), size * sizeof(std::int32_t), sizeof(std::int32_t));
         }
     }
 
     void write_integer_data(const std::int32_t* data, std::size_t size) override {
         require_payload_flush("write_integer_data");
         if(size > 0) {
-            writer_.push_data(reinterpret_cast<const char*>(data), size * sizeof(std::int32_t));
+            writer_.push_data(reinterpret_cast<const char*>(data), size * sizeof(std::int32_t), sizeof(std::int32_t));
         }
     }
 
     void write_real_data(const double* data, std::size_t size) override {
         require_payload_flush("write_real_data");
         if(size > 0) {
-            writer_.push_data(reinterpret_cast<const char*>(data), size * sizeof(double));
+            writer_.push_data(reinterpret_cast<const char*>(data), size * sizeof(double), sizeof(double));
         }
     }
 
     void write_complex_data(const std::complex<double>* data, std::size_t size) override {
         require_payload_flush("write_complex_data");
         if(size > 0) {
-            writer_.push_data(reinterpret_cast<const char*>(data), size * sizeof(std::complex<double>));
+            writer_.push_data(reinterpret_cast<const char*>(data), size * sizeof(std::complex<double>), sizeof(std::complex<double>));
         }
     }
 
@@ -163,22 +162,22 @@ public:
 
     void write_logical_value(std::int32_t value) override {
         require_payload_flush("write_logical_value");
-        writer_.push_data(reinterpret_cast<const char*>(std::addressof(value)), sizeof(value));
+        writer_.push_data(reinterpret_cast<const char*>(std::addressof(value)), sizeof(value), sizeof(value));
     }
 
     void write_integer_value(std::int32_t value) override {
         require_payload_flush("write_integer_value");
-        writer_.push_data(reinterpret_cast<const char*>(std::addressof(value)), sizeof(value));
+        writer_.push_data(reinterpret_cast<const char*>(std::addressof(value)), sizeof(value), sizeof(value));
     }
 
     void write_real_value(double value) override {
         require_payload_flush("write_real_value");
-        writer_.push_data(reinterpret_cast<const char*>(std::addressof(value)), sizeof(value));
+        writer_.push_data(reinterpret_cast<const char*>(std::addressof(value)), sizeof(value), sizeof(value));
     }
 
     void write_complex_value(const std::complex<double>& value) override {
         require_payload_flush("write_complex_value");
-        writer_.push_data(reinterpret_cast<const char*>(std::addressof(value)), sizeof(value));
+        writer_.push_data(reinterpret_cast<const char*>(std::addressof(value)), sizeof(value), sizeof(value));
     }
 
     void write_string_value(std::string_view value, bool is_na) override {
@@ -419,24 +418,29 @@ inline std::uint64_t write_single_thread(StreamWriter& stream,
                                          const int compress_level,
                                          const void* object_ptr,
                                          const erased_write_fn write_fn,
-                                         const std::size_t max_depth) {
-    BlockCompressWriter<StreamWriter, Compressor, xxHashEnv, StdErrorPolicy, true> block_writer(stream, compress_level);
+                                         const std::size_t max_depth,
+                                         const QioFormat format,
+                                         const QioWriteOptions& io_options) {
+    BlockCompressWriter<StreamWriter, Compressor, xxHashEnv, StdErrorPolicy, true> block_writer(stream, compress_level, format, io_options);
     qdata_stream_writer<decltype(block_writer)> stream_writer(block_writer, max_depth);
     write_fn(stream_writer, object_ptr);
     stream_writer.flush_payloads();
     return block_writer.finish();
 }
 
-#ifdef QIO_HAS_TBB
+#ifdef QIO_HAS_MULTITHREADING
 template <class StreamWriter, class Compressor>
 inline std::uint64_t write_multi_thread(StreamWriter& stream,
                                         const int compress_level,
                                         const int nthreads,
                                         const void* object_ptr,
                                         const erased_write_fn write_fn,
-                                        const std::size_t max_depth) {
-    tbb::global_control gc(tbb::global_control::parameter::max_allowed_parallelism, normalized_write_nthreads(nthreads));
-    BlockCompressWriterMT<StreamWriter, Compressor, xxHashEnv, StdErrorPolicy, true> block_writer(stream, compress_level);
+                                        const std::size_t max_depth,
+                                        const QioFormat format,
+                                        const QioWriteOptions& io_options) {
+    QioWriteOptions threaded_options = io_options;
+    threaded_options.nthreads = static_cast<std::uint32_t>(normalized_write_nthreads(nthreads));
+    BlockCompressWriterMT<StreamWriter, Compressor, xxHashEnv, StdErrorPolicy, true> block_writer(stream, compress_level, format, threaded_options);
     qdata_stream_writer<decltype(block_writer)> stream_writer(block_writer, max_depth);
     write_fn(stream_writer, object_ptr);
     stream_writer.flush_payloads();
@@ -451,18 +455,22 @@ inline std::uint64_t write_qdata_object(StreamWriter& stream,
                                         const int compress_level,
                                         const bool shuffle,
                                         const int nthreads,
-                                        const std::size_t max_depth) {
+                                        const std::size_t max_depth,
+                                        const QioFormat format,
+                                        const QioWriteOptions& io_options) {
     validate_write_arguments(compress_level);
     if(shuffle) {
-#ifdef QIO_HAS_TBB
-        if(nthreads > 1) {
+#ifdef QIO_HAS_MULTITHREADING
+        if(nthreads > 1 && qio_parallel_blocks(format)) {
             return write_multi_thread<StreamWriter, ZstdShuffleCompressor>(
                 stream,
                 compress_level,
                 nthreads,
                 object_ptr,
                 write_fn,
-                max_depth
+                max_depth,
+                format,
+                io_options
             );
         }
 #endif
@@ -471,19 +479,23 @@ inline std::uint64_t write_qdata_object(StreamWriter& stream,
             compress_level,
             object_ptr,
             write_fn,
-            max_depth
+            max_depth,
+            format,
+            io_options
         );
     }
 
-#ifdef QIO_HAS_TBB
-    if(nthreads > 1) {
+#ifdef QIO_HAS_MULTITHREADING
+    if(nthreads > 1 && qio_parallel_blocks(format)) {
         return write_multi_thread<StreamWriter, ZstdCompressor>(
             stream,
             compress_level,
             nthreads,
             object_ptr,
             write_fn,
-            max_depth
+            max_depth,
+            format,
+            io_options
         );
     }
 #endif
@@ -492,25 +504,46 @@ inline std::uint64_t write_qdata_object(StreamWriter& stream,
         compress_level,
         object_ptr,
         write_fn,
-        max_depth
+        max_depth,
+        format,
+        io_options
     );
 }
 
+// Adds the blocks object_ptr is written as to sampler, one training sample each
+inline void sample_erased(QioDictionarySampler& sampler,
+                          const void* object_ptr,
+                          const erased_write_fn write_fn,
+                          const std::size_t max_depth,
+                          const QioFormat format) {
+    checked_max_nesting_depth(max_depth);
+    QioDiscardWriter stream;
+    BlockCompressWriter<QioDiscardWriter, QioDictionarySampler, xxHashEnv, StdErrorPolicy, true> block_writer(stream, 0, format);
+    std::swap(block_writer.cp, sampler);
+    qdata_stream_writer<decltype(block_writer)> stream_writer(block_writer, max_depth);
+    write_fn(stream_writer, object_ptr);
+    stream_writer.flush_payloads();
+    block_writer.finish();
+    std::swap(block_writer.cp, sampler);
+}
+
 inline void save_erased(const std::string& file,
                         const void* object_ptr,
                         const erased_write_fn write_fn,
                         const int compress_level,
                         const bool shuffle,
                         const int nthreads,
-                        const std::size_t max_depth) {
+                        const std::size_t max_depth,
+                        const QioFormat format = QioFormat(),
+                        const QioWriteOptions& io_options = QioWriteOptions()) {
     validate_write_arguments(compress_level);
     checked_max_nesting_depth(max_depth);
     OfStreamWriter stream(file.c_str());
     if(!stream.isValid()) {
         throw std::runtime_error("failed to open file for writing: " + file);
     }
-    write_qdata_header(stream, shuffle);
-    const auto hash = write_qdata_object(stream, object_ptr, write_fn, compress_level, shuffle, nthreads, max_depth);
+    write_qdata_header(stream, shuffle, format);
+    const auto hash = write_qdata_object(stream, object_ptr, write_fn, compress_level, shuffle, nthreads, max_depth, format, io_options);
     write_qx_hash(stream, hash);
 }
 
@@ -521,12 +554,14 @@ inline void serialize_erased_impl(void* const buffer_ctx,
                                   const int compress_level,
                                   const bool shuffle,
                                   const int nthreads,
-                                  const std::size_t max_depth) {
+                                  const std::size_t max_depth,
+                                  const QioFormat format = QioFormat(),
+                                  const QioWriteOptions& io_options = QioWriteOptions()) {
     validate_write_arguments(compress_level);
     checked_max_nesting_depth(max_depth);
     erased_memory_writer stream(buffer_ctx, buffer_ops);
-    write_qdata_header(stream, shuffle);
-    const auto hash = write_qdata_object(stream, object_ptr, write_fn, compress_level, shuffle, nthreads, max_depth);
+    write_qdata_header(stream, shuffle, format);
+    const auto hash = write_qdata_object(stream, object_ptr, write_fn, compress_level, shuffle, nthreads, max_depth, format, io_options);
     const auto end_position = stream.tellp();
     write_qx_hash(stream, hash);
     stream.seekp(end_position);
@@ -539,7 +574,9 @@ inline Buffer serialize_erased(const void* object_ptr,
                                const int compress_level,
                                const bool shuffle,
                                const int nthreads,
-                               const std::size_t max_depth) {
+                               const std::size_t max_depth,
+                               const QioFormat format = QioFormat(),
+                               const QioWriteOptions& io_options = QioWriteOptions()) {
     Buffer output;
     serialize_erased_impl(
         static_cast<void*>(std::addressof(output)),
@@ -549,7 +586,9 @@ inline Buffer serialize_erased(const void* object_ptr,
         compress_level,
         shuffle,
         nthreads,
-        max_depth
+        max_depth,
+        format,
+        io_options
     );
     return output;
 }
@@ -10,12 +10,136 @@
 #include "detail/byte_buffer.h"
 
 #include <cstddef>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <type_traits>
 #include <vector>
 
 namespace qdata {
 
+// Full set of write settings; the positional overloads below cover the common ones.
+struct write_options {
+    int compress_level = 3;
+    bool shuffle = true;
+    int nthreads = 1;
+    std::size_t max_depth = detail::default_qdata_max_nesting_depth;
+    bool block_index = false; // append a block offset index footer (format version 2)
+    bool block_hash = false;  // store a hash with every block so checks run in parallel (format version 2)
+    std::uint32_t block_size = MAX_BLOCKSIZE; // power of two, 64 KiB to 16 MiB; any size but 1 MiB needs format version 2
+    bool stored_blocks = false; // keep blocks that do not compress uncompressed, so reading them is a copy (format version 2)
+    bool typed_shuffle = false; // with shuffle, shuffle int32 and logical payloads as 4 byte and complex as 16 byte elements (format version 2)
+    bool bitshuffle = false; // with shuffle, let the shuffle heuristic pick a bit-level shuffle for a block (format version 2)
+    // with shuffle, blocks after one the shuffle heuristic has judged that reuse its
+    // decision instead of sampling their own data, until the compression ratio
+    // moves; 0 = judge every block. With nthreads > 1 each thread keeps its own
+    // decision, so the output can vary from run to run.
+    std::uint32_t shuffle_decision_reuse = 0;
+    // multithreaded saves: blocks compressed or waiting to be written out before
+    // the writer waits on the file, bounding its memory; 0 = 4 per thread
+    std::uint32_t write_queue_blocks = 0;
+    // compress every block with this zstd dictionary (see train_dictionary), whose
+    // ID is recorded in the header; reading then needs the same dictionary (format version 2)
+    std::shared_ptr<const QioDictionary> dictionary;
+    // compress all blocks as one zstd frame with long distance matching, so data
+    // repeated up to 128 MiB apart is found across blocks; saving and reading are
+    // then single-threaded whatever nthreads is, blocks are not shuffled or stored,
+    // and reading holds a 128 MiB window (format version 2)
+    bool long_range = false;
+};
+
+// Full set of read settings
+struct read_options {
+    bool validate_checksum = false;
+    int nthreads = 1;
+    std::size_t max_depth = detail::default_qdata_max_nesting_depth;
+    bool use_mmap = false; // map the file instead of streaming it; ignored where mmap is unavailable
+    std::uint32_t read_ahead_blocks = 0; // multithreaded reads: blocks decompressed ahead of the reader, 0 = 4 per thread
+    bool single_pass_checksum = false; // validate_checksum: hash blocks while decoding instead of reading the input twice
+    std::shared_ptr<const QioDictionary> dictionary; // needed for data written with write_options::dictionary, ignored otherwise
+};
+
+// Block buffers and zstd contexts are kept between calls, up to this many bytes
+// for the whole process (64 MiB by default), so a run of small saves and reads
+// reuses them instead of allocating and initialising its own. 0 frees them and
+// turns the pool off. Returns the previous limit.
+inline std::uint64_t set_buffer_pool_limit(const std::uint64_t bytes) {
+    return qio_buffer_pool().set_limit(bytes);
+}
+
+inline std::uint64_t buffer_pool_limit() {
+    return qio_buffer_pool().limit();
+}
+
+// Loads a dictionary made by train_dictionary, e.g. after reading it back from
+// a file, for write_options::dictionary and read_options::dictionary. Throws
+// std::runtime_error if data is not a zstd dictionary.
+inline std::shared_ptr<const QioDictionary> load_dictionary(const void* data, const std::size_t size) {
+    return std::make_shared<const QioDictionary>(data, size);
+}
+
+template <class Buffer,
+          std::enable_if_t<detail::is_byte_input_buffer<Buffer>::value, int> = 0>
+inline std::shared_ptr<const QioDictionary> load_dictionary(const Buffer& data) {
+    return load_dictionary(detail::buffer_data(data), detail::buffer_size_bytes(data));
+}
+
+namespace detail {
+inline QioFormat make_block_format(const write_options& options) {
+    QioFormat format;
+    if(options.block_index) format.features |= QIO_FEATURE_BLOCK_INDEX;
+    if(options.block_hash) format.features |= QIO_FEATURE_BLOCK_HASH;
+    if(options.stored_blocks) format.features |= QIO_FEATURE_STORED_BLOCKS;
+    if(options.shuffle && options.typed_shuffle) format.features |= QIO_FEATURE_SHUFFLE_ELEMSIZE;
+    if(options.shuffle && options.bitshuffle) format.features |= QIO_FEATURE_BITSHUFFLE;
+    if(!format.set_block_size(options.block_size)) {
+        throw std::runtime_error("block_size must be a power of two between 65536 and 16777216");
+    }
+    if(options.dictionary) format.set_dictionary(options.dictionary->id());
+    format.set_long_range(options.long_range);
+    return format;
+}
+
+inline QioWriteOptions make_io_options(const write_options& options) {
+    QioWriteOptions io_options;
+    io_options.shuffle_decision_reuse = options.shuffle_decision_reuse;
+    io_options.write_queue_blocks = options.write_queue_blocks;
+    io_options.dictionary = options.dictionary;
+    return io_options;
+}
+
+inline QioReadOptions make_io_options(const read_options& options) {
+    QioReadOptions io_options;
+    io_options.read_ahead_blocks = options.read_ahead_blocks;
+    io_options.single_pass_checksum = options.single_pass_checksum;
+    io_options.dictionary = options.dictionary;
+    return io_options;
+}
+} // namespace detail
+
+// Trains a zstd dictionary of at most dictionary_size bytes on the serialized
+// samples, which should resemble the objects it will compress: many small
+// objects of the same shape. The options' block_size and max_depth apply.
+// The result can be stored and passed to load_dictionary. Throws
+// std::runtime_error if zstd cannot train on the samples, e.g. too few of them.
+template <class Buffer = std::vector<std::byte>, class T>
+inline Buffer train_dictionary(const std::vector<T>& samples,
+                               const std::size_t dictionary_size = QIO_DEFAULT_DICTIONARY_SIZE,
+                               const write_options& options = write_options()) {
+    detail::validate_output_buffer<Buffer>();
+    QioFormat format = detail::make_block_format(options);
+    format.set_dictionary(0);
+    QioDictionarySampler sampler;
+    for(const T& sample : samples) {
+        detail::sample_erased(sampler, std::addressof(sample), &detail::write_erased<std::decay_t<T>>, options.max_depth, format);
+    }
+    const std::vector<char> dictionary = qio_train_dictionary(sampler.samples, sampler.sample_sizes, dictionary_size);
+    Buffer output;
+    output.resize(dictionary.size());
+    std::memcpy(output.data(), dictionary.data(), dictionary.size());
+    return output;
+}
+
 template <class T>
 inline void save(const std::string& file,
                  const T& object,
@@ -34,6 +158,21 @@ inline void save(const std::string& file,
     );
 }
 
+template <class T>
+inline void save(const std::string& file, const T& object, const write_options& options) {
+    detail::save_erased(
+        file,
+        std::addressof(object),
+        &detail::write_erased<std::decay_t<T>>,
+        options.compress_level,
+        options.shuffle,
+        options.nthreads,
+        options.max_depth,
+        detail::make_block_format(options),
+        detail::make_io_options(options)
+    );
+}
+
 template <class Buffer = std::vector<std::byte>, class T>
 inline Buffer serialize(const T& object,
                         const int compress_level = 3,
@@ -51,6 +190,21 @@ inline Buffer serialize(const T& object,
     );
 }
 
+template <class Buffer = std::vector<std::byte>, class T>
+inline Buffer serialize(const T& object, const write_options& options) {
+    detail::validate_output_buffer<Buffer>();
+    return detail::serialize_erased<Buffer>(
+        std::addressof(object),
+        &detail::write_erased<std::decay_t<T>>,
+        options.compress_level,
+        options.shuffle,
+        options.nthreads,
+        options.max_depth,
+        detail::make_block_format(options),
+        detail::make_io_options(options)
+    );
+}
+
 inline object read(const std::string& file,
                    const bool validate_checksum = false,
                    const int nthreads = 1,
@@ -58,6 +212,11 @@ inline object read(const std::string& file,
     return detail::read_file_impl(file, validate_checksum, nthreads, max_depth);
 }
 
+inline object read(const std::string& file, const read_options& options) {
+    return detail::read_file_impl(file, options.validate_checksum, options.nthreads, options.max_depth, options.use_mmap,
+                                  detail::make_io_options(options));
+}
+
 inline object deserialize(const void* data,
                           const std::size_t size,
                           const bool validate_checksum = false,
@@ -66,6 +225,11 @@ inline object deserialize(const void* data,
     return detail::deserialize_impl(data, size, validate_checksum, nthreads, max_depth);
 }
 
+inline object deserialize(const void* data, const std::size_t size, const read_options& options) {
+    return detail::deserialize_impl(data, size, options.validate_checksum, options.nthreads, options.max_depth,
+                                    detail::make_io_options(options));
+}
+
 template <class Buffer,
           std::enable_if_t<detail::is_byte_input_buffer<Buffer>::value, int> = 0>
 inline object deserialize(const Buffer& data,
@@ -81,6 +245,19 @@ inline object deserialize(const Buffer& data,
     );
 }
 
+template <class Buffer,
+          std::enable_if_t<detail::is_byte_input_buffer<Buffer>::value, int> = 0>
+inline object deserialize(const Buffer& data, const read_options& options) {
+    return detail::deserialize_impl(
+        detail::buffer_data(data),
+        detail::buffer_size_bytes(data),
+        options.validate_checksum,
+        options.nthreads,
+        options.max_depth,
+        detail::make_io_options(options)
+    );
+}
+
 } // namespace qdata
 
 #endif
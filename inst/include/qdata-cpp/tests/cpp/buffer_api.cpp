@@ -1,7 +1,9 @@
 #include <complex>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <random>
 #include <optional>
 #include <stdexcept>
 #include <string>
@@ -16,6 +18,7 @@ namespace {
 
 static_assert(!std::is_copy_constructible<qdata::detail::string_storage_builder>::value);
 static_assert(!std::is_move_constructible<qdata::detail::string_storage_builder>::value);
+static_assert(qio_can_borrow<qdata::detail::memory_reader>::value);
 
 void debug_log(const char* message) {
     std::cerr << "[qdata_buffer_api] " << message << '\n';
@@ -153,6 +156,475 @@ void expect_adaptive_independent_string_storage() {
     }
 }
 
+void expect_block_index_footer(const int nthreads) {
+    std::vector<double> input(600000);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<double>(i % 1000) * 0.25;
+    }
+    qdata::write_options options;
+    options.nthreads = nthreads;
+    options.block_index = true;
+    const auto bytes = qdata::serialize(input, options);
+    expect_vector_payload<qdata::real_vector>(qdata::deserialize(bytes, true, nthreads), input);
+
+    qdata::detail::memory_reader reader(bytes.data(), bytes.size());
+    const auto index = read_qx_block_index(reader);
+    if(index.blocks.size() < 2) {
+        throw std::runtime_error("block index should cover every block");
+    }
+    std::uint64_t expected_offset = QX_HEADER_SIZE;
+    std::uint64_t expected_start = 0;
+    ZstdShuffleDecompressor dp;
+    std::vector<char> block(MAX_BLOCKSIZE);
+    for(const auto& entry : index.blocks) {
+        if(entry.offset != expected_offset || entry.uncompressed_start != expected_start) {
+            throw std::runtime_error("block index entry mismatch");
+        }
+        std::uint32_t zsize = 0;
+        std::memcpy(&zsize, bytes.data() + entry.offset, sizeof(zsize));
+        if(zsize != entry.zsize) {
+            throw std::runtime_error("block index size mismatch");
+        }
+        const auto* zblock = reinterpret_cast<const char*>(bytes.data() + entry.offset + sizeof(zsize));
+        const auto blocksize = dp.decompress(block.data(), MAX_BLOCKSIZE, zblock, entry.zsize);
+        if(ZstdShuffleDecompressor::is_error(blocksize)) {
+            throw std::runtime_error("block index points at an invalid block");
+        }
+        expected_offset += sizeof(zsize) + compressed_block_size(entry.zsize);
+        expected_start += blocksize;
+    }
+    if(expected_start != index.uncompressed_size) {
+        throw std::runtime_error("block index uncompressed size mismatch");
+    }
+
+    // files without the feature keep the version 1 header
+    const auto plain = qdata::serialize(input, 3, true, nthreads);
+    if(static_cast<std::uint8_t>(plain[4]) != 1 || static_cast<std::uint8_t>(bytes[4]) != 2) {
+        throw std::runtime_error("unexpected qdata format version");
+    }
+}
+
+void expect_single_pass_checksum(const int nthreads, const bool block_index) {
+    std::vector<double> input(600000);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<double>(i % 1000) * 0.25;
+    }
+    qdata::write_options write;
+    write.nthreads = nthreads;
+    write.block_index = block_index;
+    auto bytes = qdata::serialize(input, write);
+
+    qdata::read_options read;
+    read.validate_checksum = true;
+    read.nthreads = nthreads;
+    read.single_pass_checksum = true;
+    expect_vector_payload<qdata::real_vector>(qdata::deserialize(bytes, read), input);
+
+    bytes[HEADER_HASH_POSITION] ^= std::byte{1};
+    try {
+        qdata::deserialize(bytes, read);
+    } catch(const std::runtime_error& err) {
+        if(std::string(err.what()).find("checksum mismatch") == std::string::npos) throw;
+        return;
+    }
+    throw std::runtime_error("single pass validation accepted a bad checksum");
+}
+
+void expect_block_hash(const int nthreads) {
+    std::vector<double> input(600000);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<double>(i % 1000) * 0.25;
+    }
+    qdata::write_options write;
+    write.nthreads = nthreads;
+    write.block_hash = true;
+    write.block_index = true;
+    auto bytes = qdata::serialize(input, write);
+    expect_vector_payload<qdata::real_vector>(qdata::deserialize(bytes, true, nthreads), input);
+
+    // the index accounts for the hash after each block
+    qdata::detail::memory_reader reader(bytes.data(), bytes.size());
+    const auto index = read_qx_block_index(reader);
+    if(index.blocks.size() < 2 ||
+       index.blocks[1].offset != index.blocks[0].offset + qio_block_stream_size(index.blocks[0].zsize, QioFormat(QIO_FEATURE_BLOCK_HASH))) {
+        throw std::runtime_error("block index offsets do not account for block hashes");
+    }
+
+    qdata::read_options read;
+    read.validate_checksum = true;
+    read.nthreads = nthreads;
+    read.single_pass_checksum = true;
+    expect_vector_payload<qdata::real_vector>(qdata::deserialize(bytes, read), input);
+
+    // a bad stored hash leaves the data decodable, so the mismatch is found by block
+    auto bad_hash = bytes;
+    const auto second_hash = index.blocks[1].offset + sizeof(std::uint32_t) + compressed_block_size(index.blocks[1].zsize);
+    bad_hash[second_hash] ^= std::byte{1};
+    for(const bool single_pass : {true, false}) {
+        read.single_pass_checksum = single_pass;
+        try {
+            qdata::deserialize(bad_hash, read);
+        } catch(const std::runtime_error& err) {
+            const std::string expected = single_pass ? "checksum mismatch in block 1" : "checksum mismatch";
+            if(std::string(err.what()).find(expected) == std::string::npos) throw;
+            continue;
+        }
+        throw std::runtime_error("a block passed a corrupted block hash");
+    }
+
+    // corrupted data usually fails to decompress first
+    bytes[index.blocks[1].offset + sizeof(std::uint32_t) + 10] ^= std::byte{1};
+    for(const bool single_pass : {true, false}) {
+        read.single_pass_checksum = single_pass;
+        try {
+            qdata::deserialize(bytes, read);
+        } catch(const std::runtime_error&) {
+            continue;
+        }
+        throw std::runtime_error("a corrupted block passed its block hash");
+    }
+}
+
+void expect_block_size(const int nthreads) {
+    std::vector<double> input(600000);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<double>(i % 1000) * 0.25;
+    }
+    for(const std::uint8_t shift : {std::uint8_t{16}, std::uint8_t{22}}) {
+        qdata::write_options write;
+        write.nthreads = nthreads;
+        write.block_index = true;
+        write.block_hash = shift == 16;
+        write.block_size = std::uint32_t{1} << shift;
+        const auto bytes = qdata::serialize(input, write);
+        if(static_cast<std::uint8_t>(bytes[4]) != 2 ||
+           (static_cast<std::uint8_t>(bytes[HEADER_FEATURES_POSITION]) & QIO_FEATURE_BLOCK_SIZE) == 0 ||
+           static_cast<std::uint8_t>(bytes[HEADER_BLOCK_SHIFT_POSITION]) != shift) {
+            throw std::runtime_error("block size not recorded in the header");
+        }
+
+        // every block but the last is full
+        qdata::detail::memory_reader reader(bytes.data(), bytes.size());
+        const auto index = read_qx_block_index(reader);
+        for(std::size_t i = 1; i < index.blocks.size(); ++i) {
+            if(index.blocks[i].uncompressed_start != i * write.block_size) {
+                throw std::runtime_error("blocks do not use the requested block size");
+            }
+        }
+        if(index.blocks.empty() || index.uncompressed_size - index.blocks.back().uncompressed_start > write.block_size) {
+            throw std::runtime_error("last block exceeds the requested block size");
+        }
+
+        qdata::read_options read;
+        read.validate_checksum = true;
+        read.nthreads = nthreads;
+        expect_vector_payload<qdata::real_vector>(qdata::deserialize(bytes, read), input);
+        read.single_pass_checksum = true;
+        expect_vector_payload<qdata::real_vector>(qdata::deserialize(bytes, read), input);
+    }
+
+    // the default size keeps the version 1 header
+    qdata::write_options write;
+    write.nthreads = nthreads;
+    write.block_size = MAX_BLOCKSIZE;
+    if(static_cast<std::uint8_t>(qdata::serialize(input, write)[4]) != 1) {
+        throw std::runtime_error("default block size changed the format version");
+    }
+    for(const std::uint32_t block_size : {std::uint32_t{32768}, std::uint32_t{100000}, std::uint32_t{1} << 25}) {
+        write.block_size = block_size;
+        try {
+            qdata::serialize(input, write);
+        } catch(const std::runtime_error& err) {
+            if(std::string(err.what()).find("block_size") == std::string::npos) throw;
+            continue;
+        }
+        throw std::runtime_error("an unsupported block size was accepted");
+    }
+}
+
+void expect_stored_blocks(const int nthreads) {
+    std::vector<std::int32_t> input(700000);
+    std::mt19937 rng(42);
+    for(auto& value : input) {
+        value = static_cast<std::int32_t>(rng());
+    }
+    qdata::write_options write;
+    write.nthreads = nthreads;
+    write.shuffle = false;
+    write.block_index = true;
+    write.stored_blocks = true;
+    const auto bytes = qdata::serialize(input, write);
+
+    qdata::detail::memory_reader reader(bytes.data(), bytes.size());
+    const auto index = read_qx_block_index(reader);
+    if(index.blocks.size() < 2 || !is_stored_block(index.blocks[1].zsize) ||
+       compressed_block_size(index.blocks[1].zsize) != MAX_BLOCKSIZE) {
+        throw std::runtime_error("random data was not stored uncompressed");
+    }
+
+    qdata::read_options read;
+    read.validate_checksum = true;
+    read.nthreads = nthreads;
+    expect_vector_payload<qdata::integer_vector>(qdata::deserialize(bytes, read), input);
+    read.single_pass_checksum = true;
+    expect_vector_payload<qdata::integer_vector>(qdata::deserialize(bytes, read), input);
+}
+
+// every shuffled block but the first (which holds the headers) carries the
+// payload's element size; the rest of the round trip is unchanged
+template <class Vector, class Values>
+void expect_typed_shuffle(const Values& input, const std::uint32_t elemsize, const int nthreads) {
+    qdata::write_options write;
+    write.nthreads = nthreads;
+    write.block_index = true;
+    write.typed_shuffle = true;
+    const auto bytes = qdata::serialize(input, write);
+
+    qdata::detail::memory_reader reader(bytes.data(), bytes.size());
+    const auto index = read_qx_block_index(reader);
+    bool shuffled = false;
+    for(std::size_t i = 1; i < index.blocks.size(); ++i) {
+        if((index.blocks[i].zsize & SHUFFLE_MASK) == 0) continue;
+        shuffled = true;
+        if(shuffled_block_elemsize(index.blocks[i].zsize) != elemsize) {
+            throw std::runtime_error("block was not shuffled with the payload element size");
+        }
+    }
+    if(!shuffled) {
+        throw std::runtime_error("sequence data was not shuffled");
+    }
+
+    qdata::read_options read;
+    read.validate_checksum = true;
+    read.nthreads = nthreads;
+    expect_vector_payload<Vector>(qdata::deserialize(bytes, read), input);
+}
+
+void expect_typed_shuffle(const int nthreads) {
+    std::vector<std::int32_t> integers(700000);
+    std::vector<std::complex<double>> complexes(200000);
+    for(std::size_t i = 0; i < integers.size(); ++i) {
+        integers[i] = static_cast<std::int32_t>(i * 3);
+    }
+    for(std::size_t i = 0; i < complexes.size(); ++i) {
+        complexes[i] = std::complex<double>(static_cast<double>(i), static_cast<double>(i) * 0.5);
+    }
+    expect_typed_shuffle<qdata::integer_vector>(integers, 4, nthreads);
+    expect_typed_shuffle<qdata::complex_vector>(complexes, 16, nthreads);
+}
+
+// 10 random bits per integer leave most bit planes empty, so the heuristic
+// should keep the bit shuffle for the payload blocks
+void expect_bitshuffle(const int nthreads) {
+    std::vector<std::int32_t> integers(700000);
+    for(std::size_t i = 0; i < integers.size(); ++i) {
+        integers[i] = static_cast<std::int32_t>((static_cast<std::uint32_t>(i) * 2654435761u) >> 22);
+    }
+    qdata::write_options write;
+    write.nthreads = nthreads;
+    write.block_index = true;
+    write.typed_shuffle = true;
+    write.bitshuffle = true;
+    const auto bytes = qdata::serialize(integers, write);
+
+    qdata::detail::memory_reader reader(bytes.data(), bytes.size());
+    const auto index = read_qx_block_index(reader);
+    bool bitshuffled = false;
+    for(std::size_t i = 1; i < index.blocks.size(); ++i) {
+        bitshuffled = bitshuffled || (index.blocks[i].zsize & BITSHUFFLE_MASK) != 0;
+    }
+    if(!bitshuffled) {
+        throw std::runtime_error("integer data was not bit shuffled");
+    }
+
+    qdata::read_options read;
+    read.validate_checksum = true;
+    read.nthreads = nthreads;
+    expect_vector_payload<qdata::integer_vector>(qdata::deserialize(bytes, read), integers);
+}
+
+// payload blocks reuse the decision of the block before them; the output
+// still decodes, and a shuffled sequence stays shuffled
+void expect_shuffle_decision_reuse(const int nthreads) {
+    std::vector<std::int32_t> integers(1500000);
+    for(std::size_t i = 0; i < integers.size(); ++i) {
+        integers[i] = static_cast<std::int32_t>(i * 3);
+    }
+    qdata::write_options write;
+    write.nthreads = nthreads;
+    write.block_index = true;
+    write.typed_shuffle = true;
+    write.shuffle_decision_reuse = 4;
+    const auto bytes = qdata::serialize(integers, write);
+
+    qdata::detail::memory_reader reader(bytes.data(), bytes.size());
+    const auto index = read_qx_block_index(reader);
+    for(std::size_t i = 1; i + 1 < index.blocks.size(); ++i) {
+        if((index.blocks[i].zsize & SHUFFLE_MASK) == 0) {
+            throw std::runtime_error("reused shuffle decision dropped the shuffle");
+        }
+    }
+
+    qdata::read_options read;
+    read.validate_checksum = true;
+    read.nthreads = nthreads;
+    expect_vector_payload<qdata::integer_vector>(qdata::deserialize(bytes, read), integers);
+}
+
+// small records of the same shape, like the messages a dictionary is meant for
+std::vector<std::optional<std::string>> dictionary_record(std::mt19937& rng) {
+    static const char* const regions[] = {"eu-west-1", "us-east-2", "ap-south-1"};
+    static const char* const states[] = {"active", "suspended", "pending_review"};
+    std::vector<std::optional<std::string>> record;
+    for(int i = 0; i < 40; ++i) {
+        record.push_back("customer_id=" + std::to_string(rng() % 100000) + ";region=" + regions[rng() % 3] +
+                         ";account_state=" + states[rng() % 3] + ";last_login_epoch=" + std::to_string(1700000000 + rng() % 1000000));
+    }
+    return record;
+}
+
+// blocks compress with the dictionary, whose ID is recorded in the header;
+// reading needs that same dictionary
+void expect_dictionary(const int nthreads) {
+    std::mt19937 rng(7);
+    std::vector<std::vector<std::optional<std::string>>> samples;
+    for(int i = 0; i < 300; ++i) {
+        samples.push_back(dictionary_record(rng));
+    }
+    const auto trained = qdata::train_dictionary(samples, 16384);
+    const auto dictionary = qdata::load_dictionary(trained);
+    if(trained.empty() || trained.size() > 16384 || dictionary->id() == 0) {
+        throw std::runtime_error("unexpected trained dictionary");
+    }
+
+    const auto record = dictionary_record(rng);
+    for(const bool shuffle : {false, true}) {
+        qdata::write_options write;
+        write.nthreads = nthreads;
+        write.shuffle = shuffle;
+        const auto plain = qdata::serialize(record, write);
+        write.dictionary = dictionary;
+        const auto bytes = qdata::serialize(record, write);
+        std::uint32_t stored_id = 0;
+        std::memcpy(&stored_id, bytes.data() + HEADER_DICTIONARY_ID_POSITION, 4);
+        if(static_cast<std::uint8_t>(bytes[4]) != 2 ||
+           (static_cast<std::uint8_t>(bytes[HEADER_FEATURES_POSITION]) & QIO_FEATURE_DICTIONARY) == 0 ||
+           stored_id != dictionary->id()) {
+            throw std::runtime_error("dictionary not recorded in the header");
+        }
+        if(bytes.size() >= plain.size()) {
+            throw std::runtime_error("dictionary did not improve compression of a small record");
+        }
+
+        qdata::read_options read;
+        read.validate_checksum = true;
+        read.nthreads = nthreads;
+        read.dictionary = dictionary;
+        expect_string_payload(qdata::deserialize(bytes, read), record);
+        // a dictionary given for data written without one is ignored
+        expect_string_payload(qdata::deserialize(plain, read), record);
+
+        read.dictionary = nullptr;
+        try {
+            qdata::deserialize(bytes, read);
+            throw std::runtime_error("data compressed with a dictionary was read without it");
+        } catch(const std::runtime_error& err) {
+            if(std::string(err.what()).find("must be supplied") == std::string::npos) throw;
+        }
+        std::vector<std::vector<std::int32_t>> other_samples(300);
+        for(auto& sample : other_samples) {
+            for(int i = 0; i < 200; ++i) sample.push_back(static_cast<std::int32_t>(rng() % 50));
+        }
+        read.dictionary = qdata::load_dictionary(qdata::train_dictionary(other_samples, 4096));
+        try {
+            qdata::deserialize(bytes, read);
+            throw std::runtime_error("data compressed with a dictionary was read with another one");
+        } catch(const std::runtime_error& err) {
+            if(std::string(err.what()).find("does not match") == std::string::npos) throw;
+        }
+    }
+
+    const std::vector<char> not_a_dictionary(1024, 'x');
+    try {
+        qdata::load_dictionary(not_a_dictionary);
+    } catch(const std::runtime_error&) {
+        return;
+    }
+    throw std::runtime_error("raw bytes were loaded as a dictionary");
+}
+
+// a payload repeated more than a block apart is only found in long range mode,
+// which is read and written on one thread whatever nthreads is
+void expect_long_range(const int nthreads) {
+    std::mt19937 rng(11);
+    std::vector<std::int32_t> integers(400000);
+    for(auto& value : integers) value = static_cast<std::int32_t>(rng());
+    for(std::size_t i = 0; i < 800000; ++i) integers.push_back(integers[i]);
+    for(const bool shuffle : {false, true}) {
+        qdata::write_options write;
+        write.nthreads = nthreads;
+        write.shuffle = shuffle;
+        write.stored_blocks = true;
+        const auto plain = qdata::serialize(integers, write);
+        write.long_range = true;
+        const auto bytes = qdata::serialize(integers, write);
+        const std::uint8_t features = static_cast<std::uint8_t>(bytes[HEADER_FEATURES_POSITION]);
+        if(static_cast<std::uint8_t>(bytes[4]) != 2 || (features & QIO_FEATURE_LONG_RANGE) == 0 ||
+           (features & QIO_FEATURE_STORED_BLOCKS) != 0) {
+            throw std::runtime_error("long range mode not recorded in the header");
+        }
+        if(bytes.size() * 2 > plain.size()) {
+            throw std::runtime_error("long range mode did not find the repeated payload");
+        }
+        qdata::read_options read;
+        read.validate_checksum = true;
+        read.nthreads = nthreads;
+        expect_vector_payload<qdata::integer_vector>(qdata::deserialize(bytes, read), integers);
+        read.single_pass_checksum = true;
+        expect_vector_payload<qdata::integer_vector>(qdata::deserialize(bytes, read), integers);
+    }
+
+    // with a dictionary, which the stream's context loads once
+    std::vector<std::vector<std::optional<std::string>>> samples;
+    for(int i = 0; i < 300; ++i) {
+        samples.push_back(dictionary_record(rng));
+    }
+    qdata::write_options write;
+    write.nthreads = nthreads;
+    write.long_range = true;
+    write.dictionary = qdata::load_dictionary(qdata::train_dictionary(samples, 16384));
+    const auto record = dictionary_record(rng);
+    qdata::read_options read;
+    read.nthreads = nthreads;
+    read.dictionary = write.dictionary;
+    expect_string_payload(qdata::deserialize(qdata::serialize(record, write), read), record);
+}
+
+// a version 2 header byte that no feature of the file uses must be zero, so a
+// file from a later release that extends them is rejected rather than misread
+void expect_reserved_header_bytes() {
+    const std::vector<std::int32_t> input{1, 2, 3, 4};
+    qdata::write_options write;
+    write.block_index = true;
+    const auto bytes = qdata::serialize(input, write);
+    if(static_cast<std::uint8_t>(bytes[4]) != 2) {
+        throw std::runtime_error("block index did not write a version 2 header");
+    }
+    expect_integer_payload(qdata::deserialize(bytes), input);
+    for(const std::uint64_t position : {HEADER_BLOCK_SHIFT_POSITION, HEADER_EXTENDED_FEATURES_POSITION,
+                                        HEADER_RESERVED_POSITION, HEADER_DICTIONARY_ID_POSITION,
+                                        HEADER_HASH_POSITION - 1}) {
+        auto extended = bytes;
+        extended[position] = std::byte{0x10};
+        try {
+            qdata::deserialize(extended);
+            throw std::runtime_error("unused header byte was ignored");
+        } catch(const std::runtime_error& err) {
+            if(std::string(err.what()).find("does not support") == std::string::npos) throw;
+        }
+    }
+}
+
 template <class Buffer>
 Buffer serialize_via_erased_api(const std::vector<std::int32_t>& input) {
     Buffer output;
@@ -221,6 +693,49 @@ int main() {
     debug_log("adaptive independent string storage");
     expect_adaptive_independent_string_storage();
 
+    debug_log("block index footer");
+    expect_block_index_footer(1);
+    expect_block_index_footer(2);
+
+    debug_log("single pass checksum validation");
+    expect_single_pass_checksum(1, false);
+    expect_single_pass_checksum(2, false);
+    expect_single_pass_checksum(1, true);
+    expect_single_pass_checksum(2, true);
+
+    debug_log("block hashes");
+    expect_block_hash(1);
+    expect_block_hash(2);
+
+    debug_log("block sizes");
+    expect_block_size(1);
+    expect_block_size(2);
+
+    debug_log("stored blocks");
+    expect_stored_blocks(1);
+    expect_stored_blocks(2);
+
+    debug_log("typed shuffle and bitshuffle");
+    expect_typed_shuffle(1);
+    expect_typed_shuffle(2);
+    expect_bitshuffle(1);
+    expect_bitshuffle(2);
+
+    debug_log("shuffle decision reuse");
+    expect_shuffle_decision_reuse(1);
+    expect_shuffle_decision_reuse(2);
+
+    debug_log("zstd dictionaries");
+    expect_dictionary(1);
+    expect_dictionary(2);
+
+    debug_log("long range mode");
+    expect_long_range(1);
+    expect_long_range(2);
+
+    debug_log("reserved header bytes");
+    expect_reserved_header_bytes();
+
     debug_log("done");
     return 0;
 }
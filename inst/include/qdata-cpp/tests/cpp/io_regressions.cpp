@@ -1,6 +1,12 @@
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
 #include <limits>
 #include <stdexcept>
 #include <string>
@@ -25,11 +31,16 @@
 #endif
 
 #include "io/block_module.h"
+#include "io/filestream_module.h"
+#include "io/mmap_module.h"
 #include "io/zstd_module.h"
 
 #ifdef QIO_HAS_TBB
 #include <tbb/global_control.h>
+#endif
+#ifdef QIO_HAS_MULTITHREADING
 #include "io/multithreaded_block_module.h"
+#include "io/thread_pool.h"
 #endif
 
 namespace {
@@ -47,6 +58,16 @@ void expect_runtime_error(Fn&& fn, const std::string& needle) {
     throw std::runtime_error("expected std::runtime_error");
 }
 
+// xorshift64 bytes: incompressible test data, the same on every platform
+struct TestNoise {
+    std::uint64_t state = 88172645463325252ULL;
+
+    char next() {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        return static_cast<char>(state);
+    }
+};
+
 struct CountingWriter {
     std::uint64_t bytes_written = 0;
 
@@ -65,7 +86,7 @@ struct ErrorCompressor {
         return size == COMPRESSION_ERROR;
     }
 
-    std::uint32_t compress(char*, std::uint32_t, const char*, std::uint32_t, int) {
+    std::uint32_t compress(char*, std::uint32_t, const char*, std::uint32_t, int, std::uint32_t, bool, std::uint32_t) {
         return COMPRESSION_ERROR;
     }
 };
@@ -79,7 +100,7 @@ struct ConstructorErrorCompressor {
         return size == COMPRESSION_ERROR;
     }
 
-    std::uint32_t compress(char*, std::uint32_t, const char*, std::uint32_t, int) {
+    std::uint32_t compress(char*, std::uint32_t, const char*, std::uint32_t, int, std::uint32_t, bool, std::uint32_t) {
         return 1;
     }
 };
@@ -112,6 +133,10 @@ struct FakeDecompressor {
     std::uint32_t decompress(char*, std::uint32_t, const char*, std::uint32_t) {
         return MAX_BLOCKSIZE;
     }
+
+    std::uint32_t decompress_split(char*, std::uint32_t, char*, std::uint32_t, const char*, std::uint32_t) {
+        return MAX_BLOCKSIZE;
+    }
 };
 
 struct NoopCopier {
@@ -186,6 +211,264 @@ void test_context_checks() {
     );
 }
 
+// 2 and 16 byte elements have no SIMD kernel and take the generic path for the
+// whole block; the block's size prefix tells the decompressor which one was used.
+// 2 byte elements have no code and are shuffled as SHUFFLE_ELEMSIZE
+void test_shuffle_elemsizes() {
+    std::vector<char> input(MAX_BLOCKSIZE - 3);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<char>((i / 16) ^ (i % 7));
+    }
+    std::vector<char> zblock(MAX_ZBLOCKSIZE);
+    std::vector<char> output(MAX_BLOCKSIZE);
+    ZstdShuffleCompressor cp;
+    ZstdShuffleDecompressor dp;
+    for(const std::uint32_t elemsize : {2u, 4u, 8u, 16u}) {
+        const std::uint64_t bytes = input.size() - input.size() % elemsize;
+        std::vector<std::uint8_t> shuffled(bytes);
+        blosc_shuffle(reinterpret_cast<const std::uint8_t*>(input.data()), shuffled.data(), bytes, elemsize);
+        blosc_unshuffle(shuffled.data(), reinterpret_cast<std::uint8_t*>(output.data()), bytes, elemsize);
+        if(std::memcmp(output.data(), input.data(), bytes) != 0) {
+            throw std::runtime_error("shuffle round trip failed");
+        }
+
+        const std::uint32_t zsize = cp.compress(zblock.data(), MAX_ZBLOCKSIZE, input.data(), input.size(), 3, elemsize);
+        if(ZstdShuffleCompressor::is_error(zsize) ||
+           ((zsize & SHUFFLE_MASK) != 0 && shuffled_block_elemsize(zsize) != supported_shuffle_elemsize(elemsize)) ||
+           !compressed_block_size_fits_buffer(zsize, QioFormat(QIO_FEATURE_SHUFFLE_ELEMSIZE))) {
+            throw std::runtime_error("unexpected shuffled block size prefix");
+        }
+        if(dp.decompress(output.data(), MAX_BLOCKSIZE, zblock.data(), zsize) != input.size() ||
+           std::memcmp(output.data(), input.data(), input.size()) != 0) {
+            throw std::runtime_error("shuffled block round trip failed");
+        }
+    }
+    if(compressed_block_size_fits_buffer(shuffled_block_metadata(4) | 100)) {
+        throw std::runtime_error("element size bits accepted without QIO_FEATURE_SHUFFLE_ELEMSIZE");
+    }
+    if(compressed_block_size_fits_buffer(SHUFFLE_MASK | SHUFFLE_ELEMSIZE_RESERVED | 100, QioFormat(QIO_FEATURE_SHUFFLE_ELEMSIZE))) {
+        throw std::runtime_error("reserved element size code accepted");
+    }
+}
+
+// every kernel set the machine supports must match the generic routines
+void test_simd_levels() {
+    std::vector<std::uint8_t> input(MAX_BLOCKSIZE - 3);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<std::uint8_t>((i * 2654435761u) >> 11);
+    }
+    const int supported = qio_simd_level();
+    for(const std::uint64_t elemsize : {1u, 2u, 4u, 8u, 16u}) {
+        for(const std::uint64_t bytes : {std::uint64_t(elemsize * 37), std::uint64_t(input.size())}) {
+            // blosc_shuffle leaves bytes past the last whole element to the caller
+            const std::uint64_t whole = bytes - bytes % elemsize;
+            std::vector<std::uint8_t> expected(bytes), expected_bits(bytes), actual(bytes), output(bytes);
+            qio_limit_simd_level(QIO_SIMD_NONE);
+            blosc_shuffle(input.data(), expected.data(), whole, elemsize);
+            bitshuffle(input.data(), expected_bits.data(), bytes, elemsize);
+            for(int level = QIO_SIMD_NONE; level <= supported; ++level) {
+                if(qio_limit_simd_level(level) != level) {
+                    throw std::runtime_error("supported SIMD level was not selectable");
+                }
+                blosc_shuffle(input.data(), actual.data(), whole, elemsize);
+                blosc_unshuffle(actual.data(), output.data(), whole, elemsize);
+                if(std::memcmp(actual.data(), expected.data(), whole) != 0 ||
+                   std::memcmp(output.data(), input.data(), whole) != 0) {
+                    throw std::runtime_error(std::string("shuffle mismatch with ") + qio_simd_name(level) + " kernels");
+                }
+                // any split into element ranges reassembles the block
+                const std::uint64_t elements = whole / elemsize;
+                const std::uint64_t split = std::min(elements, std::uint64_t(elements / 3 + 5));
+                std::vector<std::uint8_t> ranges(whole);
+                blosc_unshuffle_elements(actual.data(), ranges.data(), elements, 0, split, elemsize);
+                blosc_unshuffle_elements(actual.data(), ranges.data() + split * elemsize, elements, split, elements, elemsize);
+                if(std::memcmp(ranges.data(), input.data(), whole) != 0) {
+                    throw std::runtime_error(std::string("ranged unshuffle mismatch with ") + qio_simd_name(level) + " kernels");
+                }
+                bitshuffle(input.data(), actual.data(), bytes, elemsize);
+                bitunshuffle(actual.data(), output.data(), bytes, elemsize);
+                if(actual != expected_bits || std::memcmp(output.data(), input.data(), bytes) != 0) {
+                    throw std::runtime_error(std::string("bitshuffle mismatch with ") + qio_simd_name(level) + " kernels");
+                }
+            }
+        }
+    }
+    if(qio_limit_simd_level(supported + 1) != supported) {
+        throw std::runtime_error("SIMD level above the detected one was selectable");
+    }
+}
+
+// layout against a bit-by-bit reference, over the SIMD, 8 element and
+// leftover paths, then a bit shuffled block through the decompressor
+void test_bitshuffle() {
+    for(const std::uint64_t blocksize : {std::uint64_t(40), std::uint64_t(16384 * 3 + 45), std::uint64_t(MAX_BLOCKSIZE - 3)}) {
+        std::vector<std::uint8_t> input(blocksize);
+        for(std::size_t i = 0; i < input.size(); ++i) {
+            input[i] = static_cast<std::uint8_t>((i * 2654435761u) >> 13);
+        }
+        for(const std::uint64_t elemsize : {1u, 2u, 4u, 8u, 16u}) {
+            std::vector<std::uint8_t> shuffled(blocksize);
+            std::vector<std::uint8_t> output(blocksize);
+            bitshuffle(input.data(), shuffled.data(), blocksize, elemsize);
+            const std::uint64_t elements = (blocksize / elemsize) & ~std::uint64_t(7);
+            const std::uint64_t chunk = (BITSHUFFLE_CHUNK_BYTES / elemsize) & ~std::uint64_t(31);
+            for(std::uint64_t i = 0; i < elements; ++i) {
+                const std::uint64_t start = i / chunk * chunk;
+                const std::uint64_t n = std::min(chunk, elements - start);
+                const std::uint64_t k = i - start;
+                for(std::uint64_t bit = 0; bit < 8 * elemsize; ++bit) {
+                    const int expected = (input[i * elemsize + bit / 8] >> (bit % 8)) & 1;
+                    const int actual = (shuffled[start * elemsize + bit * (n / 8) + k / 8] >> (k % 8)) & 1;
+                    if(expected != actual) {
+                        throw std::runtime_error("unexpected bitshuffle layout");
+                    }
+                }
+            }
+            bitunshuffle(shuffled.data(), output.data(), blocksize, elemsize);
+            if(output != input) {
+                throw std::runtime_error("bitshuffle round trip failed");
+            }
+        }
+    }
+
+    std::vector<char> input(MAX_BLOCKSIZE);
+    for(std::size_t i = 0; i < input.size() / 4; ++i) {
+        const std::int32_t value = static_cast<std::int32_t>(i % 3 == 0 ? i / 1024 : 5);
+        std::memcpy(input.data() + i * 4, &value, sizeof(value));
+    }
+    std::vector<std::uint8_t> shuffled(input.size());
+    bitshuffle(reinterpret_cast<const std::uint8_t*>(input.data()), shuffled.data(), input.size(), 4);
+    std::vector<char> zblock(MAX_ZBLOCKSIZE);
+    const std::size_t zbytes = ZSTD_compress(zblock.data(), zblock.size(), shuffled.data(), shuffled.size(), 3);
+    const std::uint32_t zsize = static_cast<std::uint32_t>(zbytes) | shuffled_block_metadata(4, true);
+    if(compressed_block_size_fits_buffer(zsize, QioFormat(QIO_FEATURE_SHUFFLE_ELEMSIZE)) ||
+       !compressed_block_size_fits_buffer(zsize, QioFormat(QIO_FEATURE_SHUFFLE_ELEMSIZE | QIO_FEATURE_BITSHUFFLE))) {
+        throw std::runtime_error("bitshuffle bit accepted without QIO_FEATURE_BITSHUFFLE");
+    }
+    std::vector<char> output(MAX_BLOCKSIZE);
+    ZstdShuffleDecompressor dp;
+    if(dp.decompress(output.data(), MAX_BLOCKSIZE, zblock.data(), zsize) != input.size() || output != input) {
+        throw std::runtime_error("bit shuffled block round trip failed");
+    }
+
+    // the heuristic may or may not pick the bit shuffle; either way the block decodes
+    ZstdShuffleCompressor cp;
+    const std::uint32_t heuristic_zsize = cp.compress(zblock.data(), MAX_ZBLOCKSIZE, input.data(), input.size(), 3, 4, true);
+    if(ZstdShuffleCompressor::is_error(heuristic_zsize) ||
+       dp.decompress(output.data(), MAX_BLOCKSIZE, zblock.data(), heuristic_zsize) != input.size() || output != input) {
+        throw std::runtime_error("bitshuffle candidate round trip failed");
+    }
+}
+
+// the head of a split block lands in its own buffer and the rest at its block
+// offsets, for plain, byte shuffled and bit shuffled blocks
+void test_decompress_split() {
+    std::vector<char> input(MAX_BLOCKSIZE - 3);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<char>((i / 16) ^ (i % 7));
+    }
+    std::vector<char> zblock(MAX_ZBLOCKSIZE);
+    ZstdShuffleCompressor cp;
+    ZstdDecompressor plain_dp;
+    ZstdShuffleDecompressor dp;
+    std::vector<std::uint32_t> zsizes;
+    zsizes.push_back(static_cast<std::uint32_t>(ZSTD_compress(zblock.data(), zblock.size(), input.data(), input.size(), 3)));
+    std::vector<std::vector<char>> zblocks(1, std::vector<char>(zblock.begin(), zblock.begin() + zsizes[0]));
+    for(const std::uint32_t elemsize : {4u, 8u, 16u}) {
+        std::vector<std::uint8_t> shuffled(input.size());
+        const std::uint64_t whole = input.size() - input.size() % elemsize;
+        blosc_shuffle(reinterpret_cast<const std::uint8_t*>(input.data()), shuffled.data(), whole, elemsize);
+        std::memcpy(shuffled.data() + whole, input.data() + whole, input.size() - whole);
+        const std::size_t zbytes = ZSTD_compress(zblock.data(), zblock.size(), shuffled.data(), shuffled.size(), 3);
+        zsizes.push_back(static_cast<std::uint32_t>(zbytes) | shuffled_block_metadata(elemsize));
+        zblocks.emplace_back(zblock.begin(), zblock.begin() + zbytes);
+    }
+    const std::uint32_t bitshuffled_zsize = cp.compress(zblock.data(), MAX_ZBLOCKSIZE, input.data(), input.size(), 22, 4, true);
+    zsizes.push_back(bitshuffled_zsize);
+    zblocks.emplace_back(zblock.begin(), zblock.begin() + compressed_block_size(bitshuffled_zsize));
+
+    const std::uint32_t size = static_cast<std::uint32_t>(input.size());
+    for(std::size_t b = 0; b < zsizes.size(); ++b) {
+        for(const std::uint32_t head_len : {0u, 1u, 4095u, 4096u, 70001u, size - 1, size}) {
+            std::vector<char> head(head_len);
+            std::vector<char> rest(MAX_BLOCKSIZE);
+            const std::uint32_t out = b == 0 ?
+                plain_dp.decompress_split(head.data(), head_len, rest.data(), MAX_BLOCKSIZE, zblocks[b].data(), zsizes[b]) :
+                dp.decompress_split(head.data(), head_len, rest.data(), MAX_BLOCKSIZE, zblocks[b].data(), zsizes[b]);
+            if(out != size || std::memcmp(head.data(), input.data(), head_len) != 0 ||
+               std::memcmp(rest.data() + head_len, input.data() + head_len, size - head_len) != 0) {
+                throw std::runtime_error("split decompression did not reassemble the block");
+            }
+        }
+    }
+}
+
+// predictions pinned from the pointer-based tree walk the flat forest replaced
+void test_shuffle_model_predictions() {
+    const std::array<std::array<double, 9>, 4> features = {{
+        {{2000, 9000, 2100, 9100, 1900, 8800, 2050, 9050, 1}},
+        {{30000, 31000, 29500, 30800, 30100, 31200, 29900, 30900, 3}},
+        {{12000, 8000, 12500, 7900, 11800, 8100, 12100, 8050, 9}},
+        {{500, 600, 450, 650, 520, 610, 480, 590, 19}}
+    }};
+    const std::array<double, 4> expected = {
+        0x1.2e3afe294838fp+0, -0x1.c99d363f8d925p-4, -0x1.5afd64387b0c9p-1, 0x1.d1db3a7573277p-2
+    };
+    for(std::size_t i = 0; i < features.size(); ++i) {
+        if(XgboostBlockshuffleModel::predict_xgboost_impl(features[i]) != expected[i]) {
+            throw std::runtime_error("shuffle model prediction changed");
+        }
+    }
+}
+
+// a reused decision is spent block by block, dropped when the compression
+// ratio moves, and never made for blocks too small for the heuristic
+void test_shuffle_decision_reuse() {
+    std::vector<char> ints(MAX_BLOCKSIZE);
+    for(std::size_t i = 0; i < ints.size() / 4; ++i) {
+        const std::int32_t value = static_cast<std::int32_t>(i * 7);
+        std::memcpy(ints.data() + i * 4, &value, sizeof(value));
+    }
+    std::vector<char> noise(MAX_BLOCKSIZE);
+    for(std::size_t i = 0; i < noise.size(); ++i) {
+        noise[i] = static_cast<char>((i * 2654435761u) >> 13);
+    }
+    std::vector<char> zblock(MAX_ZBLOCKSIZE);
+    std::vector<char> output(MAX_BLOCKSIZE);
+    ZstdShuffleCompressor cp;
+    ZstdShuffleDecompressor dp;
+    const auto round_trip = [&](const std::vector<char> & input, const std::uint32_t blocksize, const std::uint32_t reuse) {
+        const std::uint32_t zsize = cp.compress(zblock.data(), MAX_ZBLOCKSIZE, input.data(), blocksize, 3, 4, false, reuse);
+        if(ZstdShuffleCompressor::is_error(zsize) ||
+           dp.decompress(output.data(), MAX_BLOCKSIZE, zblock.data(), zsize) != blocksize ||
+           std::memcmp(output.data(), input.data(), blocksize) != 0) {
+            throw std::runtime_error("shuffle decision reuse round trip failed");
+        }
+        return zsize;
+    };
+
+    const std::uint32_t decided = round_trip(ints, MAX_BLOCKSIZE, 2);
+    if(cp.decision.uses_left != 2) {
+        throw std::runtime_error("shuffle decision was not kept for reuse");
+    }
+    if(round_trip(ints, MAX_BLOCKSIZE, 2) != decided || cp.decision.uses_left != 1) {
+        throw std::runtime_error("shuffle decision was not reused");
+    }
+    round_trip(noise, MAX_BLOCKSIZE, 2);
+    if(cp.decision.uses_left != 0) {
+        throw std::runtime_error("shuffle decision survived a change in compression ratio");
+    }
+    round_trip(ints, MAX_BLOCKSIZE, 2);
+    round_trip(ints, 8 * SHUFFLE_HEURISTIC_BLOCKSIZE - 1, 2);
+    if(cp.decision.uses_left != 2) {
+        throw std::runtime_error("small block used a shuffle decision");
+    }
+    round_trip(ints, MAX_BLOCKSIZE, 0);
+    if(cp.decision.uses_left != 2) {
+        throw std::runtime_error("shuffle decision changed with reuse disabled");
+    }
+}
+
 void test_single_thread_large_read() {
     if(sizeof(std::size_t) < sizeof(std::uint64_t)) return;
     const std::uint64_t block_count = (std::uint64_t{1} << 32) / MAX_BLOCKSIZE + 1;
@@ -199,7 +482,381 @@ void test_single_thread_large_read() {
     }
 }
 
-#ifdef QIO_HAS_TBB
+#ifdef QIO_HAS_MMAP
+static_assert(qio_can_borrow<MmapFileReader>::value, "MmapFileReader should lend its mapping");
+static_assert(!qio_can_borrow<IfStreamReader>::value, "IfStreamReader cannot lend a buffer");
+
+void test_mmap_reader() {
+    const char* const path = "qdata_io_regressions_mmap.bin";
+    std::vector<char> input(3 * MAX_BLOCKSIZE + 1234);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<char>((i * 7) % 251);
+    }
+    {
+        OfStreamWriter file(path);
+        BlockCompressWriter<OfStreamWriter, ZstdCompressor, xxHashEnv, StdErrorPolicy, true> writer(file, 3);
+        writer.push_data(input.data(), input.size());
+        writer.finish();
+    }
+
+    std::vector<char> output(input.size());
+    {
+        MmapFileReader file(path);
+        if(!file.isValid() || file.size() == 0) {
+            throw std::runtime_error("failed to map test file");
+        }
+        BlockCompressReader<MmapFileReader, ZstdDecompressor, StdErrorPolicy> reader(file);
+        reader.get_data(output.data(), 100);
+        reader.get_data(output.data() + 100, output.size() - 100);
+        if(file.tellg() != file.size()) {
+            throw std::runtime_error("mapped read did not consume the stream");
+        }
+    }
+    std::remove(path);
+    if(output != input) {
+        throw std::runtime_error("mapped read mismatch");
+    }
+
+    MmapFileReader missing("qdata_io_regressions_missing.bin");
+    if(missing.isValid()) {
+        throw std::runtime_error("mapping a missing file should fail");
+    }
+}
+#endif
+
+// incompressible first and last blocks are stored, the compressible middle one is not
+template <class Writer, class Reader, class StreamReader>
+void roundtrip_stored_blocks(const char* const path) {
+    const QioFormat format(QIO_FEATURE_STORED_BLOCKS);
+    std::vector<char> input(3 * MAX_BLOCKSIZE - 1234);
+    TestNoise noise;
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        const char byte = noise.next();
+        input[i] = i / MAX_BLOCKSIZE == 1 ? static_cast<char>(i % 7) : byte;
+    }
+    {
+        OfStreamWriter file(path);
+        Writer writer(file, 3, format);
+        writer.push_data(input.data(), 100);
+        writer.push_data(input.data() + 100, input.size() - 100);
+        writer.finish();
+    }
+    std::vector<std::uint32_t> zsizes;
+    {
+        IfStreamReader file(path);
+        std::uint32_t zsize;
+        while(file.readInteger(zsize)) {
+            zsizes.push_back(zsize);
+            file.seekg(file.tellg() + compressed_block_size(zsize));
+        }
+    }
+    if(zsizes.size() != 3 || !is_stored_block(zsizes[0]) || is_stored_block(zsizes[1]) || !is_stored_block(zsizes[2]) ||
+       compressed_block_size(zsizes[0]) != MAX_BLOCKSIZE) {
+        throw std::runtime_error("incompressible blocks were not stored");
+    }
+
+    std::vector<char> output(input.size());
+    {
+        StreamReader file(path);
+        Reader reader(file, format);
+        reader.get_data(output.data(), 100);
+        reader.get_data(output.data() + 100, output.size() - 100);
+        reader.finish();
+    }
+    std::remove(path);
+    if(output != input) {
+        throw std::runtime_error("stored block roundtrip mismatch");
+    }
+}
+
+void test_stored_blocks() {
+    const char* const path = "qdata_io_regressions_stored.bin";
+    using Writer = BlockCompressWriter<OfStreamWriter, ZstdShuffleCompressor, xxHashEnv, StdErrorPolicy, true>;
+    // without the feature the stored bit is part of the size, not metadata
+    if(compressed_block_size_fits_buffer(STORED_MASK | 100) ||
+       !compressed_block_size_fits_buffer(STORED_MASK | 100, QioFormat(QIO_FEATURE_STORED_BLOCKS))) {
+        throw std::runtime_error("stored bit accepted without QIO_FEATURE_STORED_BLOCKS");
+    }
+    {
+        std::vector<char> input(1000);
+        TestNoise noise;
+        for(char& byte : input) byte = noise.next();
+        {
+            OfStreamWriter file(path);
+            Writer writer(file, 3, QioFormat(QIO_FEATURE_STORED_BLOCKS));
+            writer.push_data(input.data(), input.size());
+            writer.finish();
+        }
+        IfStreamReader file(path);
+        BlockCompressReader<IfStreamReader, ZstdShuffleDecompressor, StdErrorPolicy> reader(file, QioFormat());
+        expect_runtime_error([&] { reader.get_data(input.data(), input.size()); }, "exceeds internal maximum");
+    }
+    roundtrip_stored_blocks<Writer, BlockCompressReader<IfStreamReader, ZstdShuffleDecompressor, StdErrorPolicy>, IfStreamReader>(path);
+#ifdef QIO_HAS_MMAP
+    roundtrip_stored_blocks<Writer, BlockCompressReader<MmapFileReader, ZstdShuffleDecompressor, StdErrorPolicy>, MmapFileReader>(path);
+#endif
+#ifdef QIO_HAS_MULTITHREADING
+    using WriterMT = BlockCompressWriterMT<OfStreamWriter, ZstdShuffleCompressor, xxHashEnv, StdErrorPolicy, true>;
+    roundtrip_stored_blocks<WriterMT, BlockCompressReaderMT<IfStreamReader, ZstdShuffleDecompressor, StdErrorPolicy>, IfStreamReader>(path);
+#ifdef QIO_HAS_MMAP
+    roundtrip_stored_blocks<WriterMT, BlockCompressReaderMT<MmapFileReader, ZstdShuffleDecompressor, StdErrorPolicy>, MmapFileReader>(path);
+#endif
+#endif
+}
+
+// The sampler sees every block as the compressors would, and each block of a
+// dictionary stream is a zstd frame that names the dictionary
+template <class Writer, class Reader, class ReaderFile = IfStreamReader>
+void roundtrip_dictionary(const char* const path, const std::shared_ptr<const QioDictionary>& dictionary,
+                          const std::vector<char>& input) {
+    QioFormat format;
+    format.set_block_size(std::uint32_t(1) << QIO_MIN_BLOCK_SHIFT);
+    format.set_dictionary(dictionary->id());
+    QioWriteOptions write_options;
+    write_options.dictionary = dictionary;
+    {
+        OfStreamWriter file(path);
+        Writer writer(file, 3, format, write_options);
+        writer.push_data(input.data(), input.size());
+        writer.finish();
+    }
+    {
+        IfStreamReader file(path);
+        std::uint32_t zsize;
+        std::vector<char> zblock;
+        while(file.readInteger(zsize)) {
+            zblock.resize(compressed_block_size(zsize));
+            file.read(zblock.data(), static_cast<std::uint32_t>(zblock.size()));
+            if(ZSTD_getDictID_fromFrame(zblock.data(), zblock.size()) != dictionary->id()) {
+                throw std::runtime_error("block was not compressed with the dictionary");
+            }
+        }
+    }
+    std::vector<char> output(input.size());
+    {
+        ReaderFile file(path);
+        QioReadOptions read_options;
+        read_options.dictionary = dictionary;
+        Reader reader(file, format, read_options);
+        reader.get_data(output.data(), output.size());
+        reader.finish();
+    }
+    std::remove(path);
+    if(output != input) {
+        throw std::runtime_error("dictionary roundtrip mismatch");
+    }
+}
+
+void test_dictionary() {
+    std::vector<char> input;
+    for(int i = 0; input.size() < 3 * (std::size_t(1) << QIO_MIN_BLOCK_SHIFT); ++i) {
+        const std::string line = "{\"id\":" + std::to_string(i * 7919 % 10007) + ",\"kind\":\"event\",\"ok\":" +
+                                 (i % 3 == 0 ? "false" : "true") + "}\n";
+        input.insert(input.end(), line.begin(), line.end());
+    }
+    QioFormat format;
+    format.set_block_size(std::uint32_t(1) << QIO_MIN_BLOCK_SHIFT);
+    QioDiscardWriter discard;
+    BlockCompressWriter<QioDiscardWriter, QioDictionarySampler, xxHashEnv, StdErrorPolicy, true> sampling(discard, 0, format);
+    for(std::size_t offset = 0; offset < input.size(); offset += 1000) {
+        sampling.push_data(input.data() + offset, std::min<std::size_t>(1000, input.size() - offset));
+    }
+    sampling.finish();
+    if(sampling.cp.sample_sizes.size() != 4 || sampling.cp.sample_sizes[0] != format.block_size() ||
+       sampling.cp.samples != input) {
+        throw std::runtime_error("sampler did not collect the blocks");
+    }
+    // more samples than blocks so zstd has enough to train on
+    std::vector<std::size_t> sample_sizes(input.size() / 4096, 4096);
+    const std::vector<char> trained = qio_train_dictionary(input, sample_sizes, 8192);
+    const auto dictionary = std::make_shared<const QioDictionary>(trained.data(), trained.size());
+    expect_runtime_error([&] { qio_train_dictionary(input, std::vector<std::size_t>(), 8192); }, "No samples");
+
+    const char* const path = "qdata_io_regressions_dictionary.bin";
+    roundtrip_dictionary<BlockCompressWriter<OfStreamWriter, ZstdCompressor, xxHashEnv, StdErrorPolicy, true>,
+                         BlockCompressReader<IfStreamReader, ZstdDecompressor, StdErrorPolicy>>(path, dictionary, input);
+    roundtrip_dictionary<BlockCompressWriter<OfStreamWriter, ZstdShuffleCompressor, xxHashEnv, StdErrorPolicy, true>,
+                         BlockCompressReader<IfStreamReader, ZstdShuffleDecompressor, StdErrorPolicy>>(path, dictionary, input);
+#ifdef QIO_HAS_MULTITHREADING
+    roundtrip_dictionary<BlockCompressWriterMT<OfStreamWriter, ZstdCompressor, xxHashEnv, StdErrorPolicy, true>,
+                         BlockCompressReaderMT<IfStreamReader, ZstdDecompressor, StdErrorPolicy>>(path, dictionary, input);
+#ifdef QIO_HAS_MMAP
+    roundtrip_dictionary<BlockCompressWriterMT<OfStreamWriter, ZstdShuffleCompressor, xxHashEnv, StdErrorPolicy, true>,
+                         BlockCompressReaderMT<MmapFileReader, ZstdShuffleDecompressor, StdErrorPolicy>, MmapFileReader>(
+        path, dictionary, input);
+#endif
+#endif
+
+    if(qio_dictionary_error(QioFormat(), nullptr) != nullptr || qio_dictionary_error(format, nullptr) != nullptr) {
+        throw std::runtime_error("a stream without a dictionary needs one");
+    }
+    format.set_dictionary(dictionary->id() + 1);
+    if(qio_dictionary_error(format, nullptr) == nullptr || qio_dictionary_error(format, dictionary.get()) == nullptr) {
+        throw std::runtime_error("a missing or different dictionary was accepted");
+    }
+}
+
+// Returns the compressed bytes of the blocks, which must read back to input
+template <class Writer, class Reader, class ReaderFile = IfStreamReader>
+std::size_t roundtrip_long_range(const char* const path, const QioFormat format, const std::vector<char>& input) {
+    {
+        OfStreamWriter file(path);
+        Writer writer(file, 3, format);
+        writer.push_data(input.data(), 1000);
+        writer.push_data(input.data() + 1000, input.size() - 1000);
+        writer.finish();
+    }
+    std::size_t zbytes = 0;
+    {
+        IfStreamReader file(path);
+        std::uint32_t zsize;
+        while(file.readInteger(zsize)) {
+            if(is_stored_block(zsize)) throw std::runtime_error("long range stream stored a block");
+            zbytes += compressed_block_size(zsize);
+            file.seekg(file.tellg() + compressed_block_size(zsize) + (format.has(QIO_FEATURE_BLOCK_HASH) ? 8 : 0));
+        }
+    }
+    std::vector<char> output(input.size());
+    {
+        ReaderFile file(path);
+        Reader reader(file, format);
+        reader.get_data(output.data(), 100);
+        reader.get_data(output.data() + 100, output.size() - 100);
+        reader.finish();
+        if(reader.corrupt_block() != QIO_NO_CORRUPT_BLOCK) throw std::runtime_error("long range block hash mismatch");
+    }
+    std::remove(path);
+    if(output != input) {
+        throw std::runtime_error("long range roundtrip mismatch");
+    }
+    return zbytes;
+}
+
+// Data repeated several blocks apart is only found when the blocks share one frame
+void test_long_range() {
+    const std::uint32_t block_size = std::uint32_t(1) << QIO_MIN_BLOCK_SHIFT;
+    std::vector<char> input(9 * block_size - 321);
+    TestNoise noise;
+    const std::size_t repeat = 2 * block_size;
+    const std::size_t repeat_at = 6 * block_size + 777;
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        const char byte = noise.next();
+        input[i] = i >= repeat_at && i < repeat_at + repeat ? input[i - repeat_at] : byte;
+    }
+    QioFormat plain(QIO_FEATURE_BLOCK_HASH);
+    plain.set_block_size(block_size);
+    QioFormat format = plain;
+    format.features |= QIO_FEATURE_STORED_BLOCKS;
+    format.set_long_range(true);
+    if(!format.has(QIO_FEATURE_LONG_RANGE) || format.has(QIO_FEATURE_STORED_BLOCKS) || qio_parallel_blocks(format)) {
+        throw std::runtime_error("set_long_range did not set up the format");
+    }
+
+    const char* const path = "qdata_io_regressions_long_range.bin";
+    using Writer = BlockCompressWriter<OfStreamWriter, ZstdCompressor, xxHashEnv, StdErrorPolicy, true>;
+    using Reader = BlockCompressReader<IfStreamReader, ZstdDecompressor, StdErrorPolicy>;
+    const std::size_t independent = roundtrip_long_range<Writer, Reader>(path, plain, input);
+    const std::size_t long_range = roundtrip_long_range<Writer, Reader>(path, format, input);
+    if(long_range + repeat * 9 / 10 > independent) {
+        throw std::runtime_error("long range matching did not find the repeat");
+    }
+    using ShuffleWriter = BlockCompressWriter<OfStreamWriter, ZstdShuffleCompressor, xxHashEnv, StdErrorPolicy, true>;
+    const std::size_t shuffled = roundtrip_long_range<ShuffleWriter, BlockCompressReader<IfStreamReader, ZstdShuffleDecompressor, StdErrorPolicy>>(
+        path, format, input);
+    if(shuffled != long_range) {
+        throw std::runtime_error("long range blocks were shuffled");
+    }
+#ifdef QIO_HAS_MMAP
+    roundtrip_long_range<Writer, BlockCompressReader<MmapFileReader, ZstdDecompressor, StdErrorPolicy>, MmapFileReader>(path, format, input);
+#endif
+
+    // a block out of order cannot be decompressed
+    ZstdCompressor cp;
+    cp.set_long_range(true);
+    std::vector<char> zblock(ZSTD_compressBound(block_size));
+    const std::uint32_t zfirst = cp.compress(zblock.data(), static_cast<std::uint32_t>(zblock.size()), input.data() + repeat_at, block_size, 3);
+    std::vector<char> first(zblock.begin(), zblock.begin() + zfirst);
+    const std::uint32_t zsecond = cp.compress(zblock.data(), static_cast<std::uint32_t>(zblock.size()), input.data(), block_size, 3);
+    if(ZstdCompressor::is_error(zfirst) || ZstdCompressor::is_error(zsecond) || zsecond > block_size / 8) {
+        throw std::runtime_error("long range block was not matched against the one before it");
+    }
+    ZstdDecompressor dp;
+    dp.set_long_range(true);
+    std::vector<char> block(block_size);
+    if(!ZstdDecompressor::is_error(dp.decompress(block.data(), block_size, zblock.data(), zsecond))) {
+        throw std::runtime_error("long range block decompressed without the blocks before it");
+    }
+}
+
+// buffers and contexts go back to the pool and are handed out again, up to its limit
+void test_buffer_pool() {
+    QioBufferPool& pool = qio_buffer_pool();
+    const std::uint64_t limit = pool.set_limit(0);
+    if(pool.held() != 0) {
+        throw std::runtime_error("a zero pool limit should free everything pooled");
+    }
+    char* const unpooled = pool.acquire_buffer(MAX_BLOCKSIZE);
+    pool.release_buffer(unpooled, MAX_BLOCKSIZE);
+    if(pool.held() != 0) {
+        throw std::runtime_error("a zero pool limit should not keep buffers");
+    }
+
+    pool.set_limit(QIO_DEFAULT_BUFFER_POOL_LIMIT);
+    char* const buffer = pool.acquire_buffer(MAX_BLOCKSIZE);
+    pool.release_buffer(buffer, MAX_BLOCKSIZE);
+    char* const smaller = pool.acquire_buffer(MAX_BLOCKSIZE / 2);
+    char* const reused = pool.acquire_buffer(MAX_BLOCKSIZE);
+    if(reused != buffer || smaller == buffer) {
+        throw std::runtime_error("pooled buffer was not reused by size");
+    }
+    pool.release_buffer(smaller, MAX_BLOCKSIZE / 2);
+    pool.release_buffer(reused, MAX_BLOCKSIZE);
+    ZSTD_CCtx* const cctx = pool.acquire_cctx();
+    pool.release_cctx(cctx);
+    if(pool.acquire_cctx() != cctx) {
+        throw std::runtime_error("pooled compression context was not reused");
+    }
+    pool.release_cctx(cctx);
+
+    // a second round trip finds everything the first one used in the pool
+    const char* const path = "qdata_io_regressions_pool.bin";
+    std::vector<char> input(2 * MAX_BLOCKSIZE + 4321);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<char>((i * 13) % 241);
+    }
+    std::uint64_t held = 0;
+    for(int round = 0; round < 2; ++round) {
+        {
+            OfStreamWriter file(path);
+            BlockCompressWriter<OfStreamWriter, ZstdShuffleCompressor, xxHashEnv, StdErrorPolicy, true> writer(file, 3);
+            writer.push_data(input.data(), input.size());
+            writer.finish();
+        }
+        std::vector<char> output(input.size());
+        {
+            IfStreamReader file(path);
+            BlockCompressReader<IfStreamReader, ZstdShuffleDecompressor, StdErrorPolicy> reader(file);
+            reader.get_data(output.data(), output.size());
+            reader.finish();
+        }
+        if(output != input) {
+            throw std::runtime_error("pooled round trip mismatch");
+        }
+        if(round == 1 && pool.held() != held) {
+            throw std::runtime_error("second round trip did not reuse the pooled buffers");
+        }
+        held = pool.held();
+    }
+    std::remove(path);
+
+    pool.set_limit(MAX_BLOCKSIZE);
+    if(pool.held() > MAX_BLOCKSIZE) {
+        throw std::runtime_error("lowering the pool limit should free what no longer fits");
+    }
+    pool.set_limit(limit);
+}
+
+#ifdef QIO_HAS_MULTITHREADING
 
 struct TrapErrorPolicy {
     static std::atomic<bool> called;
@@ -253,6 +910,171 @@ struct GatedBlockReader {
     }
 };
 
+struct CountingBlockReader {
+    const std::uint64_t block_count;
+    std::atomic<std::uint64_t> blocks_produced{0};
+
+    explicit CountingBlockReader(const std::uint64_t count) : block_count(count) {}
+
+    template <class T>
+    bool readInteger(T& value) {
+        if(blocks_produced.load() >= block_count) return false;
+        value = static_cast<T>(1);
+        blocks_produced.fetch_add(1);
+        return true;
+    }
+
+    std::uint32_t read(char* const destination, const std::uint32_t size) {
+        if(size != 1) return 0;
+        destination[0] = 0;
+        return 1;
+    }
+};
+
+// the std::thread backend: parallel_for runs every index once and rethrows a
+// body's exception, even while the workers are busy, and each thread gets
+// its own value
+void test_thread_pool() {
+    QioThreadPool pool(3);
+    pool.initialize();
+    if(pool.max_concurrency() != 3) {
+        throw std::runtime_error("thread pool has the wrong concurrency");
+    }
+    std::vector<std::atomic<int>> hits(1000);
+    pool.parallel_for(hits.size(), [&](const std::uint64_t i) { hits[i].fetch_add(1); });
+    for(const std::atomic<int>& hit : hits) {
+        if(hit.load() != 1) throw std::runtime_error("thread pool parallel_for missed or repeated an index");
+    }
+    expect_runtime_error(
+        [&] {
+            pool.parallel_for(64, [](const std::uint64_t i) {
+                if(i == 17) throw std::runtime_error("body failure");
+            });
+        },
+        "body failure"
+    );
+
+    std::atomic<bool> release{false};
+    std::atomic<int> blocked{0};
+    for(int i = 0; i < 2; ++i) {
+        pool.enqueue([&] {
+            blocked.fetch_add(1);
+            while(!release.load()) std::this_thread::yield();
+            blocked.fetch_sub(1);
+        });
+    }
+    while(blocked.load() != 2) std::this_thread::yield();
+    std::uint64_t sum = 0;
+    pool.parallel_for(100, [&](const std::uint64_t i) { sum += i; });
+    release.store(true);
+    if(sum != 4950) {
+        throw std::runtime_error("thread pool parallel_for did not finish on the calling thread");
+    }
+    while(blocked.load() != 0) std::this_thread::yield();
+
+    // an arena runs no more of its tasks at once than its concurrency allows,
+    // however many workers the pool under it has
+    QioThreadArena arena(pool, 2);
+    if(arena.max_concurrency() != 2 || &arena.shared_pool() != &pool) {
+        throw std::runtime_error("thread arena has the wrong concurrency");
+    }
+    std::atomic<int> running{0};
+    std::atomic<int> most{0};
+    std::atomic<int> finished{0};
+    for(int i = 0; i < 6; ++i) {
+        arena.enqueue([&] {
+            const int now = running.fetch_add(1) + 1;
+            int seen = most.load();
+            while(now > seen && !most.compare_exchange_weak(seen, now)) {}
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            running.fetch_sub(1);
+            finished.fetch_add(1);
+        });
+    }
+    while(finished.load() != 6) std::this_thread::yield();
+    if(most.load() != 1) {
+        throw std::runtime_error("thread arena ran more tasks at once than its concurrency");
+    }
+    std::vector<std::atomic<int>> arena_hits(100);
+    arena.parallel_for(arena_hits.size(), [&](const std::uint64_t i) { arena_hits[i].fetch_add(1); });
+    for(const std::atomic<int>& hit : arena_hits) {
+        if(hit.load() != 1) throw std::runtime_error("thread arena parallel_for missed or repeated an index");
+    }
+
+    QioThreadSpecific<int> values;
+    int* const main_value = &values.local();
+    int* other_value = nullptr;
+    std::thread other([&] { other_value = &values.local(); });
+    other.join();
+    if(main_value != &values.local() || other_value == nullptr || other_value == main_value) {
+        throw std::runtime_error("thread specific values are not per thread");
+    }
+}
+
+void test_multi_thread_read_ahead() {
+    const std::uint64_t block_count = 64;
+    QioReadOptions options;
+    options.read_ahead_blocks = 3;
+    CountingBlockReader stream(block_count);
+    BlockCompressReaderMT<CountingBlockReader, FakeDecompressor, StdErrorPolicy, NoopCopier>
+        reader(stream, QioFormat(), options);
+    std::vector<char> output(MAX_BLOCKSIZE);
+    for(std::uint64_t consumed = 1; consumed <= block_count; ++consumed) {
+        reader.get_data(output.data(), MAX_BLOCKSIZE);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        // the ring has read_ahead_blocks + 1 slots and the consumer holds the
+        // one of the block it last read from
+        if(stream.blocks_produced.load() > consumed + options.read_ahead_blocks) {
+            throw std::runtime_error("multithreaded reader read too far ahead of the consumer");
+        }
+    }
+    reader.finish();
+}
+
+struct SlowBlockReader {
+    std::uint64_t blocks_remaining;
+
+    explicit SlowBlockReader(const std::uint64_t count) : blocks_remaining(count) {}
+
+    template <class T>
+    bool readInteger(T& value) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        if(blocks_remaining == 0) return false;
+        value = static_cast<T>(1);
+        --blocks_remaining;
+        return true;
+    }
+
+    std::uint32_t read(char* const destination, const std::uint32_t size) {
+        if(size != 1) return 0;
+        destination[0] = 0;
+        return 1;
+    }
+};
+
+// std::clock is wall time on Windows, so the check only means something elsewhere
+void test_multi_thread_consumer_sleeps() {
+#if !defined(_WIN32)
+    const std::uint64_t block_count = 16;
+    SlowBlockReader stream(block_count);
+    BlockCompressReaderMT<SlowBlockReader, FakeDecompressor, StdErrorPolicy, NoopCopier> reader(stream);
+    std::vector<char> output(MAX_BLOCKSIZE);
+    const auto wall_start = std::chrono::steady_clock::now();
+    const std::clock_t cpu_start = std::clock();
+    for(std::uint64_t i = 0; i < block_count; ++i) {
+        reader.get_data(output.data(), MAX_BLOCKSIZE);
+    }
+    reader.finish();
+    const double cpu_seconds = static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+    const double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    // a consumer spinning on its next ring slot instead of sleeping on ready_cv
+    // would use about one core for the whole read
+    if(cpu_seconds > wall_seconds / 2) {
+        throw std::runtime_error("multithreaded reader consumer busy-waited for blocks");
+    }
+#endif
+}
+
 void test_multi_thread_writer_error(const bool direct) {
     TrapErrorPolicy::called.store(false);
     CountingWriter output;
@@ -269,6 +1091,65 @@ void test_multi_thread_writer_error(const bool direct) {
     }
 }
 
+struct TinyCompressor {
+    static bool is_error(const std::uint32_t size) {
+        return size == COMPRESSION_ERROR;
+    }
+
+    std::uint32_t compress(char* const destination, std::uint32_t, const char*, std::uint32_t, int, std::uint32_t, bool, std::uint32_t) {
+        destination[0] = 0;
+        return 1;
+    }
+};
+
+// each size prefix starts a block, so they count the blocks written out
+struct SlowCountingWriter {
+    std::atomic<std::uint64_t> blocks_written{0};
+
+    void write(const char*, std::uint64_t) {}
+
+    template <class T>
+    void writeInteger(const T) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        blocks_written.fetch_add(1);
+    }
+};
+
+// a slow stream makes the producer wait instead of queueing more blocks
+void test_multi_thread_write_queue() {
+    const std::uint64_t block_count = 48;
+    for(const bool direct : {false, true}) {
+        QioWriteOptions options;
+        options.write_queue_blocks = 3;
+        SlowCountingWriter output;
+        std::vector<char> input(MAX_BLOCKSIZE);
+        const auto push = [&](auto& writer) {
+            for(std::uint64_t submitted = 1; submitted <= block_count; ++submitted) {
+                writer.push_data(input.data(), input.size());
+                if(submitted - output.blocks_written.load() > options.write_queue_blocks) {
+                    throw std::runtime_error("multithreaded writer queued too many blocks ahead of the stream");
+                }
+            }
+            writer.finish();
+        };
+        if(direct) {
+            BlockCompressWriterMT<SlowCountingWriter, TinyCompressor, xxHashEnv, StdErrorPolicy, true>
+                writer(output, 1, QioFormat(), options);
+            if(writer.slots.size() != options.write_queue_blocks) {
+                throw std::runtime_error("multithreaded writer ignored write_queue_blocks");
+            }
+            push(writer);
+        } else {
+            BlockCompressWriterMT<SlowCountingWriter, TinyCompressor, xxHashEnv, StdErrorPolicy, false>
+                writer(output, 1, QioFormat(), options);
+            push(writer);
+        }
+        if(output.blocks_written.load() != block_count) {
+            throw std::runtime_error("multithreaded writer did not write every block");
+        }
+    }
+}
+
 void test_multi_thread_context_error() {
     TrapErrorPolicy::called.store(false);
     CountingWriter output;
@@ -287,6 +1168,180 @@ void test_multi_thread_context_error() {
     }
 }
 
+// modules with the same thread count share one arena, and a count above the
+// tbb::global_control limit (2 in main) or the machine's cores is capped to it
+void test_multi_thread_shared_arena() {
+#ifdef QIO_HAS_TBB
+    if(qio_thread_count(0) != 2 || qio_thread_count(1) != 1 || qio_thread_count(8) != 2) {
+        throw std::runtime_error("thread count does not follow the global_control limit");
+    }
+#else
+    const int cores = static_cast<int>(std::max<unsigned>(std::thread::hardware_concurrency(), 1));
+    if(qio_thread_count(0) != cores || qio_thread_count(1) != 1 || qio_thread_count(cores + 1) != cores) {
+        throw std::runtime_error("thread count does not follow the machine's cores");
+    }
+    if(&qio_task_arena(1).shared_pool() != &qio_shared_thread_pool() ||
+       &qio_task_arena(2).shared_pool() != &qio_shared_thread_pool()) {
+        throw std::runtime_error("arenas do not share one thread pool");
+    }
+#endif
+    if(&qio_task_arena(2) != &qio_task_arena(2) || &qio_task_arena(1) == &qio_task_arena(2)) {
+        throw std::runtime_error("arenas are not kept per thread count");
+    }
+    if(qio_task_arena(2).max_concurrency() != 2) {
+        throw std::runtime_error("arena has the wrong concurrency");
+    }
+
+    const char* const path = "qdata_io_regressions_arena.bin";
+    std::vector<char> input(3 * MAX_BLOCKSIZE + 99);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<char>((i * 11) % 239);
+    }
+    QioWriteOptions write_options;
+    write_options.nthreads = 2;
+    QioReadOptions read_options;
+    read_options.nthreads = 2;
+    QioTaskArena& shared = qio_task_arena(qio_thread_count(2));
+    for(int round = 0; round < 2; ++round) {
+        {
+            OfStreamWriter file(path);
+            BlockCompressWriterMT<OfStreamWriter, ZstdCompressor, xxHashEnv, StdErrorPolicy, true>
+                writer(file, 1, QioFormat(), write_options);
+            if(&writer.arena != &shared) {
+                throw std::runtime_error("writer did not run in the shared arena");
+            }
+            writer.push_data(input.data(), input.size());
+            writer.finish();
+        }
+        std::vector<char> output(input.size());
+        {
+            IfStreamReader file(path);
+            BlockCompressReaderMT<IfStreamReader, ZstdDecompressor, StdErrorPolicy> reader(file, QioFormat(), read_options);
+            if(&reader.arena != &shared) {
+                throw std::runtime_error("reader did not run in the shared arena");
+            }
+            reader.get_data(output.data(), output.size());
+            reader.finish();
+        }
+        if(output != input) {
+            throw std::runtime_error("shared arena round trip mismatch");
+        }
+    }
+    std::remove(path);
+}
+
+struct CountingCopier {
+    static std::atomic<std::uint64_t> block_copies;
+
+    static void copy(void* const destination, const void* const source, const std::size_t size) {
+        if(size == MAX_BLOCKSIZE) {
+            block_copies.fetch_add(1);
+        }
+        std::memcpy(destination, source, size);
+    }
+};
+
+std::atomic<std::uint64_t> CountingCopier::block_copies{0};
+
+// blocks wholly inside a planned payload are decompressed into it, the rest
+// (and those decompressed before the plan) are copied as usual
+void test_multi_thread_planned_payloads() {
+    const char* const path = "qdata_io_regressions_planned.bin";
+    const QioFormat format(QIO_FEATURE_STORED_BLOCKS | QIO_FEATURE_BLOCK_HASH);
+    const std::uint64_t header = 100;
+    const std::vector<std::uint64_t> sizes = {6 * MAX_BLOCKSIZE + 100, 0, 7, 5 * MAX_BLOCKSIZE};
+    std::uint64_t total = header;
+    for(const std::uint64_t size : sizes) total += size;
+    std::vector<char> input(total);
+    TestNoise noise;
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        const char byte = noise.next();
+        input[i] = (i / MAX_BLOCKSIZE) % 3 == 0 ? byte : static_cast<char>(i % 13);
+    }
+    {
+        OfStreamWriter file(path);
+        BlockCompressWriter<OfStreamWriter, ZstdShuffleCompressor, xxHashEnv, StdErrorPolicy, true> writer(file, 1, format);
+        writer.push_data(input.data(), input.size());
+        writer.finish();
+    }
+
+    QioReadOptions options;
+    options.read_ahead_blocks = 2;
+    std::vector<char> output(input.size());
+    CountingCopier::block_copies.store(0);
+    {
+        IfStreamReader file(path);
+        BlockCompressReaderMT<IfStreamReader, ZstdShuffleDecompressor, StdErrorPolicy, CountingCopier>
+            reader(file, format, options);
+        reader.get_data(output.data(), header);
+        std::vector<QioPayloadSpan> spans;
+        std::uint64_t offset = header;
+        for(const std::uint64_t size : sizes) {
+            spans.push_back({output.data() + offset, size});
+            offset += size;
+        }
+        reader.plan_payloads(spans);
+        for(const QioPayloadSpan& span : spans) {
+            reader.get_data(span.data, span.size);
+        }
+        reader.finish();
+        if(reader.get_hash_digest() == 0) {
+            throw std::runtime_error("planned payload read reported a corrupt block");
+        }
+    }
+    std::remove(path);
+    if(output != input) {
+        throw std::runtime_error("planned payload read mismatch");
+    }
+    // 9 blocks lie wholly inside a payload; read-ahead can only have
+    // decompressed the first few of them before the plan
+    if(CountingCopier::block_copies.load() > options.read_ahead_blocks + 1) {
+        throw std::runtime_error("planned payload blocks were copied instead of decompressed in place");
+    }
+}
+
+#ifdef QIO_HAS_MMAP
+// a mapped stream is scanned up front and read without the ring of slots: small
+// reads go through a window of blocks, large ones decompress in place
+void test_multi_thread_scanned_read() {
+    const char* const path = "qdata_io_regressions_scanned.bin";
+    const QioFormat format(QIO_FEATURE_BLOCK_HASH);
+    std::vector<char> input(11 * MAX_BLOCKSIZE + 777);
+    for(std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<char>((i * 7) % 251 + i / 4096);
+    }
+    {
+        OfStreamWriter file(path);
+        BlockCompressWriter<OfStreamWriter, ZstdShuffleCompressor, xxHashEnv, StdErrorPolicy, true> writer(file, 1, format);
+        writer.push_data(input.data(), input.size());
+        writer.finish();
+    }
+    QioReadOptions options;
+    options.read_ahead_blocks = 3;
+    std::vector<char> output(input.size());
+    std::uint64_t offset = 0;
+    {
+        MmapFileReader file(path);
+        BlockCompressReaderMT<MmapFileReader, ZstdShuffleDecompressor, StdErrorPolicy> reader(file, format, options);
+        for(const std::uint64_t size : {std::uint64_t{100}, std::uint64_t{MAX_BLOCKSIZE}, std::uint64_t{5},
+                                        std::uint64_t{7 * MAX_BLOCKSIZE}, std::uint64_t{1}}) {
+            reader.get_data(output.data() + offset, size);
+            offset += size;
+        }
+        reader.get_data(output.data() + offset, output.size() - offset);
+        reader.finish();
+        if(reader.get_hash_digest() == 0) {
+            throw std::runtime_error("scanned read reported a corrupt block");
+        }
+        expect_runtime_error([&] { reader.get_data(output.data(), 1); }, "Unexpected end of file");
+    }
+    std::remove(path);
+    if(output != input) {
+        throw std::runtime_error("scanned read mismatch");
+    }
+}
+#endif
+
 void test_multi_thread_large_read() {
     if(sizeof(std::size_t) < sizeof(std::uint64_t)) return;
     const std::uint64_t block_count = (std::uint64_t{1} << 32) / MAX_BLOCKSIZE + 1;
@@ -309,13 +1364,37 @@ void test_multi_thread_large_read() {
 int main() {
     test_single_thread_writer_errors();
     test_context_checks();
+    test_simd_levels();
+    test_shuffle_elemsizes();
+    test_bitshuffle();
+    test_decompress_split();
+    test_shuffle_model_predictions();
+    test_shuffle_decision_reuse();
     test_single_thread_large_read();
+#ifdef QIO_HAS_MMAP
+    test_mmap_reader();
+#endif
 #ifdef QIO_HAS_TBB
     tbb::global_control control(tbb::global_control::parameter::max_allowed_parallelism, 2);
+#endif
+    test_stored_blocks();
+    test_dictionary();
+    test_long_range();
+    test_buffer_pool();
+#ifdef QIO_HAS_MULTITHREADING
+    test_thread_pool();
     test_multi_thread_writer_error(false);
     test_multi_thread_writer_error(true);
     test_multi_thread_context_error();
+    test_multi_thread_write_queue();
     test_multi_thread_large_read();
+    test_multi_thread_read_ahead();
+    test_multi_thread_consumer_sleeps();
+    test_multi_thread_shared_arena();
+    test_multi_thread_planned_payloads();
+#ifdef QIO_HAS_MMAP
+    test_multi_thread_scanned_read();
+#endif
 #endif
     return 0;
 }
@@ -136,6 +136,258 @@ BEGIN_RCPP
     return R_NilValue;
 END_RCPP
 }
+// qs2_get_block_index
+bool qs2_get_block_index();
+RcppExport SEXP _qs2_qs2_get_block_index() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_block_index());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_block_index
+void qs2_set_block_index(bool value);
+RcppExport SEXP _qs2_qs2_set_block_index(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< bool >::type value(valueSEXP);
+    qs2_set_block_index(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_block_hash
+bool qs2_get_block_hash();
+RcppExport SEXP _qs2_qs2_get_block_hash() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_block_hash());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_block_hash
+void qs2_set_block_hash(bool value);
+RcppExport SEXP _qs2_qs2_set_block_hash(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< bool >::type value(valueSEXP);
+    qs2_set_block_hash(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_block_size
+int qs2_get_block_size();
+RcppExport SEXP _qs2_qs2_get_block_size() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_block_size());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_block_size
+void qs2_set_block_size(int value);
+RcppExport SEXP _qs2_qs2_set_block_size(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< int >::type value(valueSEXP);
+    qs2_set_block_size(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_stored_blocks
+bool qs2_get_stored_blocks();
+RcppExport SEXP _qs2_qs2_get_stored_blocks() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_stored_blocks());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_stored_blocks
+void qs2_set_stored_blocks(bool value);
+RcppExport SEXP _qs2_qs2_set_stored_blocks(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< bool >::type value(valueSEXP);
+    qs2_set_stored_blocks(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_typed_shuffle
+bool qs2_get_typed_shuffle();
+RcppExport SEXP _qs2_qs2_get_typed_shuffle() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_typed_shuffle());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_typed_shuffle
+void qs2_set_typed_shuffle(bool value);
+RcppExport SEXP _qs2_qs2_set_typed_shuffle(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< bool >::type value(valueSEXP);
+    qs2_set_typed_shuffle(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_bitshuffle
+bool qs2_get_bitshuffle();
+RcppExport SEXP _qs2_qs2_get_bitshuffle() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_bitshuffle());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_bitshuffle
+void qs2_set_bitshuffle(bool value);
+RcppExport SEXP _qs2_qs2_set_bitshuffle(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< bool >::type value(valueSEXP);
+    qs2_set_bitshuffle(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_shuffle_decision_reuse
+int qs2_get_shuffle_decision_reuse();
+RcppExport SEXP _qs2_qs2_get_shuffle_decision_reuse() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_shuffle_decision_reuse());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_shuffle_decision_reuse
+void qs2_set_shuffle_decision_reuse(int value);
+RcppExport SEXP _qs2_qs2_set_shuffle_decision_reuse(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< int >::type value(valueSEXP);
+    qs2_set_shuffle_decision_reuse(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_use_mmap
+bool qs2_get_use_mmap();
+RcppExport SEXP _qs2_qs2_get_use_mmap() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_use_mmap());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_use_mmap
+void qs2_set_use_mmap(bool value);
+RcppExport SEXP _qs2_qs2_set_use_mmap(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< bool >::type value(valueSEXP);
+    qs2_set_use_mmap(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_read_ahead_blocks
+int qs2_get_read_ahead_blocks();
+RcppExport SEXP _qs2_qs2_get_read_ahead_blocks() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_read_ahead_blocks());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_read_ahead_blocks
+void qs2_set_read_ahead_blocks(int value);
+RcppExport SEXP _qs2_qs2_set_read_ahead_blocks(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< int >::type value(valueSEXP);
+    qs2_set_read_ahead_blocks(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_single_pass_checksum
+bool qs2_get_single_pass_checksum();
+RcppExport SEXP _qs2_qs2_get_single_pass_checksum() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_single_pass_checksum());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_single_pass_checksum
+void qs2_set_single_pass_checksum(bool value);
+RcppExport SEXP _qs2_qs2_set_single_pass_checksum(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< bool >::type value(valueSEXP);
+    qs2_set_single_pass_checksum(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_buffer_pool_mib
+int qs2_get_buffer_pool_mib();
+RcppExport SEXP _qs2_qs2_get_buffer_pool_mib() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_buffer_pool_mib());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_buffer_pool_mib
+void qs2_set_buffer_pool_mib(int value);
+RcppExport SEXP _qs2_qs2_set_buffer_pool_mib(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< int >::type value(valueSEXP);
+    qs2_set_buffer_pool_mib(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_write_queue_blocks
+int qs2_get_write_queue_blocks();
+RcppExport SEXP _qs2_qs2_get_write_queue_blocks() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_write_queue_blocks());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_write_queue_blocks
+void qs2_set_write_queue_blocks(int value);
+RcppExport SEXP _qs2_qs2_set_write_queue_blocks(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< int >::type value(valueSEXP);
+    qs2_set_write_queue_blocks(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_long_range
+bool qs2_get_long_range();
+RcppExport SEXP _qs2_qs2_get_long_range() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_long_range());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_long_range
+void qs2_set_long_range(bool value);
+RcppExport SEXP _qs2_qs2_set_long_range(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< bool >::type value(valueSEXP);
+    qs2_set_long_range(value);
+    return R_NilValue;
+END_RCPP
+}
+// qs2_get_dictionary
+RawVector qs2_get_dictionary();
+RcppExport SEXP _qs2_qs2_get_dictionary() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(qs2_get_dictionary());
+    return rcpp_result_gen;
+END_RCPP
+}
+// qs2_set_dictionary
+void qs2_set_dictionary(RawVector value);
+RcppExport SEXP _qs2_qs2_set_dictionary(SEXP valueSEXP) {
+BEGIN_RCPP
+    Rcpp::traits::input_parameter< RawVector >::type value(valueSEXP);
+    qs2_set_dictionary(value);
+    return R_NilValue;
+END_RCPP
+}
 // qs_save
 SEXP qs_save(SEXP object, SEXP file, const int compress_level, const bool shuffle, int nthreads);
 RcppExport SEXP _qs2_qs_save(SEXP objectSEXP, SEXP fileSEXP, SEXP compress_levelSEXP, SEXP shuffleSEXP, SEXP nthreadsSEXP) {
@@ -252,6 +504,18 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// qx_train_dictionary
+SEXP qx_train_dictionary(SEXP objects, SEXP format, int dictionary_size);
+RcppExport SEXP _qs2_qx_train_dictionary(SEXP objectsSEXP, SEXP formatSEXP, SEXP dictionary_sizeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< SEXP >::type objects(objectsSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type format(formatSEXP);
+    Rcpp::traits::input_parameter< int >::type dictionary_size(dictionary_sizeSEXP);
+    rcpp_result_gen = Rcpp::wrap(qx_train_dictionary(objects, format, dictionary_size));
+    return rcpp_result_gen;
+END_RCPP
+}
 // check_SIMD
 SEXP check_SIMD();
 RcppExport SEXP _qs2_check_SIMD() {
@@ -434,6 +698,34 @@ static const R_CallMethodDef CallEntries[] = {
     {"_qs2_qs2_set_warn_unsupported_types", (DL_FUNC) &_qs2_qs2_set_warn_unsupported_types, 1},
     {"_qs2_qs2_get_use_alt_rep", (DL_FUNC) &_qs2_qs2_get_use_alt_rep, 0},
     {"_qs2_qs2_set_use_alt_rep", (DL_FUNC) &_qs2_qs2_set_use_alt_rep, 1},
+    {"_qs2_qs2_get_block_index", (DL_FUNC) &_qs2_qs2_get_block_index, 0},
+    {"_qs2_qs2_set_block_index", (DL_FUNC) &_qs2_qs2_set_block_index, 1},
+    {"_qs2_qs2_get_block_hash", (DL_FUNC) &_qs2_qs2_get_block_hash, 0},
+    {"_qs2_qs2_set_block_hash", (DL_FUNC) &_qs2_qs2_set_block_hash, 1},
+    {"_qs2_qs2_get_block_size", (DL_FUNC) &_qs2_qs2_get_block_size, 0},
+    {"_qs2_qs2_set_block_size", (DL_FUNC) &_qs2_qs2_set_block_size, 1},
+    {"_qs2_qs2_get_stored_blocks", (DL_FUNC) &_qs2_qs2_get_stored_blocks, 0},
+    {"_qs2_qs2_set_stored_blocks", (DL_FUNC) &_qs2_qs2_set_stored_blocks, 1},
+    {"_qs2_qs2_get_typed_shuffle", (DL_FUNC) &_qs2_qs2_get_typed_shuffle, 0},
+    {"_qs2_qs2_set_typed_shuffle", (DL_FUNC) &_qs2_qs2_set_typed_shuffle, 1},
+    {"_qs2_qs2_get_bitshuffle", (DL_FUNC) &_qs2_qs2_get_bitshuffle, 0},
+    {"_qs2_qs2_set_bitshuffle", (DL_FUNC) &_qs2_qs2_set_bitshuffle, 1},
+    {"_qs2_qs2_get_shuffle_decision_reuse", (DL_FUNC) &_qs2_qs2_get_shuffle_decision_reuse, 0},
+    {"_qs2_qs2_set_shuffle_decision_reuse", (DL_FUNC) &_qs2_qs2_set_shuffle_decision_reuse, 1},
+    {"_qs2_qs2_get_use_mmap", (DL_FUNC) &_qs2_qs2_get_use_mmap, 0},
+    {"_qs2_qs2_set_use_mmap", (DL_FUNC) &_qs2_qs2_set_use_mmap, 1},
+    {"_qs2_qs2_get_read_ahead_blocks", (DL_FUNC) &_qs2_qs2_get_read_ahead_blocks, 0},
+    {"_qs2_qs2_set_read_ahead_blocks", (DL_FUNC) &_qs2_qs2_set_read_ahead_blocks, 1},
+    {"_qs2_qs2_get_single_pass_checksum", (DL_FUNC) &_qs2_qs2_get_single_pass_checksum, 0},
+    {"_qs2_qs2_set_single_pass_checksum", (DL_FUNC) &_qs2_qs2_set_single_pass_checksum, 1},
+    {"_qs2_qs2_get_buffer_pool_mib", (DL_FUNC) &_qs2_qs2_get_buffer_pool_mib, 0},
+    {"_qs2_qs2_set_buffer_pool_mib", (DL_FUNC) &_qs2_qs2_set_buffer_pool_mib, 1},
+    {"_qs2_qs2_get_write_queue_blocks", (DL_FUNC) &_qs2_qs2_get_write_queue_blocks, 0},
+    {"_qs2_qs2_set_write_queue_blocks", (DL_FUNC) &_qs2_qs2_set_write_queue_blocks, 1},
+    {"_qs2_qs2_get_long_range", (DL_FUNC) &_qs2_qs2_get_long_range, 0},
+    {"_qs2_qs2_set_long_range", (DL_FUNC) &_qs2_qs2_set_long_range, 1},
+    {"_qs2_qs2_get_dictionary", (DL_FUNC) &_qs2_qs2_get_dictionary, 0},
+    {"_qs2_qs2_set_dictionary", (DL_FUNC) &_qs2_qs2_set_dictionary, 1},
     {"_qs2_qs_save", (DL_FUNC) &_qs2_qs_save, 5},
     {"_qs2_qs_serialize", (DL_FUNC) &_qs2_qs_serialize, 4},
     {"_qs2_qs_read", (DL_FUNC) &_qs2_qs_read, 3},
@@ -443,6 +735,7 @@ static const R_CallMethodDef CallEntries[] = {
     {"_qs2_qd_read", (DL_FUNC) &_qs2_qd_read, 4},
     {"_qs2_qd_deserialize", (DL_FUNC) &_qs2_qd_deserialize, 4},
     {"_qs2_qx_dump", (DL_FUNC) &_qs2_qx_dump, 1},
+    {"_qs2_qx_train_dictionary", (DL_FUNC) &_qs2_qx_train_dictionary, 3},
     {"_qs2_check_SIMD", (DL_FUNC) &_qs2_check_SIMD, 0},
     {"_qs2_check_TBB", (DL_FUNC) &_qs2_check_TBB, 0},
     {"_qs2_zstd_compress_raw", (DL_FUNC) &_qs2_zstd_compress_raw, 2},
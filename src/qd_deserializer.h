@@ -496,6 +496,18 @@ struct QdataDeserializer {
         }
     }
 
+    // the vector data in the order read_object_data() reads it; taken on this
+    // thread, the workers only see the raw pointers
+    std::vector<QioPayloadSpan> payload_spans() {
+        std::vector<QioPayloadSpan> spans;
+        spans.reserve(complex_sexp.size() + real_sexp.size() + integer_sexp.size() + raw_sexp.size());
+        for(auto & x : complex_sexp) spans.push_back({reinterpret_cast<char*>(COMPLEX(x.first)), x.second * 16});
+        for(auto & x : real_sexp) spans.push_back({reinterpret_cast<char*>(REAL(x.first)), x.second * 8});
+        for(auto & x : integer_sexp) spans.push_back({reinterpret_cast<char*>(INTEGER(x.first)), x.second * 4});
+        for(auto & x : raw_sexp) spans.push_back({reinterpret_cast<char*>(RAW(x.first)), x.second});
+        return spans;
+    }
+
     void read_object_data() {
         for(auto & x : character_sexp) {
             SEXP object = x.first;
@@ -519,6 +531,9 @@ struct QdataDeserializer {
                 }
             }
         }
+        if constexpr (qio_can_plan_payloads<block_compress_reader>::value) {
+            reader.plan_payloads(payload_spans());
+        }
         for(auto & x : complex_sexp) {
             SEXP object = x.first;
             uint64_t object_length = x.second;
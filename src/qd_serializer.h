@@ -432,17 +432,17 @@ struct QdataSerializer {
         for(auto & x : complex_sexp) {
             SEXP object = x.first;
             uint64_t object_length = x.second;
-            writer.push_data(reinterpret_cast<char*>(COMPLEX(object)), object_length * 16);
+            writer.push_data(reinterpret_cast<char*>(COMPLEX(object)), object_length * 16, 16);
         }
         for(auto & x : real_sexp) {
             SEXP object = x.first;
             uint64_t object_length = x.second;
-            writer.push_data(reinterpret_cast<char*>(REAL(object)), object_length * 8);
+            writer.push_data(reinterpret_cast<char*>(REAL(object)), object_length * 8, 8);
         }
         for(auto & x : integer_sexp) {
             SEXP object = x.first;
             uint64_t object_length = x.second;
-            writer.push_data(reinterpret_cast<char*>(INTEGER(object)), object_length * 4);
+            writer.push_data(reinterpret_cast<char*>(INTEGER(object)), object_length * 4, 4);
         }
         for(auto & x : raw_sexp) {
             SEXP object = x.first;
@@ -2,6 +2,10 @@
 #define _QS2_QOPT_H_
 
 #include <Rcpp.h>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include "io/io_common.h"
 using namespace Rcpp;
 
 // Whether the session's native encoding is UTF-8, used to decide whether
@@ -38,6 +42,19 @@ static int qs2_nthreads = 1;
 static bool qs2_validate_checksum = false;
 static bool qs2_warn_unsupported_types = true;
 static bool qs2_use_alt_rep = false;
+static bool qs2_block_index = false;
+static bool qs2_block_hash = false;
+static int qs2_block_size = MAX_BLOCKSIZE;
+static bool qs2_stored_blocks = false;
+static bool qs2_typed_shuffle = false;
+static bool qs2_bitshuffle = false;
+static int qs2_shuffle_decision_reuse = 0;
+static bool qs2_use_mmap = false;
+static int qs2_read_ahead_blocks = 0;
+static bool qs2_single_pass_checksum = false;
+static int qs2_write_queue_blocks = 0;
+static std::shared_ptr<const QioDictionary> qs2_dictionary;
+static bool qs2_long_range = false;
 
 // Get and set functions for compress_level
 // [[Rcpp::export(rng = false)]]
@@ -105,4 +122,172 @@ void qs2_set_use_alt_rep(bool value) {
   qs2_use_alt_rep = value;
 }
 
+// Get and set functions for block_index
+// [[Rcpp::export(rng = false)]]
+bool qs2_get_block_index() {
+  return qs2_block_index;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_block_index(bool value) {
+  qs2_block_index = value;
+}
+
+// Get and set functions for block_hash
+// [[Rcpp::export(rng = false)]]
+bool qs2_get_block_hash() {
+  return qs2_block_hash;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_block_hash(bool value) {
+  qs2_block_hash = value;
+}
+
+// Get and set functions for block_size
+// [[Rcpp::export(rng = false)]]
+int qs2_get_block_size() {
+  return qs2_block_size;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_block_size(int value) {
+  QioFormat format;
+  if (value <= 0 || !format.set_block_size(static_cast<uint32_t>(value))) {
+    throw std::runtime_error("block_size must be a power of two between 65536 and 16777216");
+  }
+  qs2_block_size = value;
+}
+
+// Get and set functions for stored_blocks
+// [[Rcpp::export(rng = false)]]
+bool qs2_get_stored_blocks() {
+  return qs2_stored_blocks;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_stored_blocks(bool value) {
+  qs2_stored_blocks = value;
+}
+
+// Get and set functions for typed_shuffle
+// [[Rcpp::export(rng = false)]]
+bool qs2_get_typed_shuffle() {
+  return qs2_typed_shuffle;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_typed_shuffle(bool value) {
+  qs2_typed_shuffle = value;
+}
+
+// Get and set functions for bitshuffle
+// [[Rcpp::export(rng = false)]]
+bool qs2_get_bitshuffle() {
+  return qs2_bitshuffle;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_bitshuffle(bool value) {
+  qs2_bitshuffle = value;
+}
+
+// Get and set functions for shuffle_decision_reuse
+// [[Rcpp::export(rng = false)]]
+int qs2_get_shuffle_decision_reuse() {
+  return qs2_shuffle_decision_reuse;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_shuffle_decision_reuse(int value) {
+  qs2_shuffle_decision_reuse = value;
+}
+
+// Get and set functions for use_mmap
+// [[Rcpp::export(rng = false)]]
+bool qs2_get_use_mmap() {
+  return qs2_use_mmap;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_use_mmap(bool value) {
+  qs2_use_mmap = value;
+}
+
+// Get and set functions for read_ahead_blocks
+// [[Rcpp::export(rng = false)]]
+int qs2_get_read_ahead_blocks() {
+  return qs2_read_ahead_blocks;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_read_ahead_blocks(int value) {
+  qs2_read_ahead_blocks = value;
+}
+
+// Get and set functions for single_pass_checksum
+// [[Rcpp::export(rng = false)]]
+bool qs2_get_single_pass_checksum() {
+  return qs2_single_pass_checksum;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_single_pass_checksum(bool value) {
+  qs2_single_pass_checksum = value;
+}
+
+// Get and set functions for buffer_pool_mib. The limit lives in the buffer
+// pool itself, in bytes; a negative value is treated as 0.
+// [[Rcpp::export(rng = false)]]
+int qs2_get_buffer_pool_mib() {
+  return static_cast<int>(qio_buffer_pool().limit() >> 20);
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_buffer_pool_mib(int value) {
+  qio_buffer_pool().set_limit(value > 0 ? static_cast<uint64_t>(value) << 20 : 0);
+}
+
+// Get and set functions for write_queue_blocks
+// [[Rcpp::export(rng = false)]]
+int qs2_get_write_queue_blocks() {
+  return qs2_write_queue_blocks;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_write_queue_blocks(int value) {
+  qs2_write_queue_blocks = value;
+}
+
+// Get and set functions for long_range
+// [[Rcpp::export(rng = false)]]
+bool qs2_get_long_range() {
+  return qs2_long_range;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_long_range(bool value) {
+  qs2_long_range = value;
+}
+
+// Get and set functions for dictionary. The dictionary is kept prepared for
+// use, and handed back as the raw vector it was loaded from; an empty raw
+// vector means none.
+// [[Rcpp::export(rng = false)]]
+RawVector qs2_get_dictionary() {
+  if (!qs2_dictionary) return RawVector(0);
+  RawVector value(static_cast<R_xlen_t>(qs2_dictionary->size()));
+  std::memcpy(RAW(value), qs2_dictionary->data(), qs2_dictionary->size());
+  return value;
+}
+
+// [[Rcpp::export(rng = false)]]
+void qs2_set_dictionary(RawVector value) {
+  if (Rf_xlength(value) == 0) {
+    qs2_dictionary.reset();
+    return;
+  }
+  qs2_dictionary = std::make_shared<const QioDictionary>(RAW(value), static_cast<size_t>(Rf_xlength(value)));
+}
+
 #endif
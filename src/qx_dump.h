@@ -7,14 +7,18 @@
 using namespace Rcpp;
 
 template <typename stream_reader, typename decompressor>
-std::tuple<std::vector<std::vector<unsigned char>>, std::vector<std::vector<unsigned char>>, std::vector<int>, std::string> 
-qx_dump_impl(stream_reader & myFile) {
+std::tuple<std::vector<std::vector<unsigned char>>, std::vector<std::vector<unsigned char>>, std::vector<int>, std::string, std::vector<int>> 
+qx_dump_impl(stream_reader & myFile, const QioFormat format, const QioDictionary * const dictionary) {
     decompressor dp;
+    qio_set_dictionary(dp, format.has(QIO_FEATURE_DICTIONARY) ? dictionary : nullptr);
+    qio_set_long_range(dp, format);
     xxHashEnv env;
-    std::tuple<std::vector<std::vector<unsigned char>>, std::vector<std::vector<unsigned char>>, std::vector<int>, std::string> output;
+    std::tuple<std::vector<std::vector<unsigned char>>, std::vector<std::vector<unsigned char>>, std::vector<int>, std::string, std::vector<int>> output;
+    const uint32_t block_size = format.block_size();
+    const uint32_t max_zblock_size = format.max_zblock_size();
     while(true) {
-        std::vector<unsigned char> zblock(MAX_ZBLOCKSIZE); // use unsigned char to auto-convert to Rcpp::RawVector
-        std::vector<unsigned char> block(MAX_BLOCKSIZE);
+        std::vector<unsigned char> zblock(max_zblock_size); // use unsigned char to auto-convert to Rcpp::RawVector
+        std::vector<unsigned char> block(block_size);
 
         uint32_t zsize;
         uint32_t size_bytes_read = myFile.read(reinterpret_cast<char*>(&zsize), sizeof(zsize));
@@ -24,9 +28,15 @@ qx_dump_impl(stream_reader & myFile) {
         if(size_bytes_read != sizeof(zsize)) {
             throw std::runtime_error("Unexpected end of file while reading next block size");
         }
+        if(zsize == BLOCK_STREAM_TERMINATOR && format.has(QIO_FEATURE_BLOCK_INDEX)) {
+            // the index footer is not a block, but it is covered by the file hash
+            env.update(zsize);
+            qio_hash_remaining(myFile, env, reinterpret_cast<char*>(zblock.data()), max_zblock_size);
+            break;
+        }
 
         const uint32_t zbytes = compressed_block_size(zsize);
-        if(!compressed_block_size_fits_buffer(zsize)) {
+        if(!compressed_block_size_fits_buffer(zsize, format)) {
             throw std::runtime_error("Compressed block size exceeds internal maximum");
         }
 
@@ -36,14 +46,35 @@ qx_dump_impl(stream_reader & myFile) {
         }
 
         env.update(zsize);
-        env.update(reinterpret_cast<char*>(zblock.data()), bytes_read);
+        bool corrupt = false;
+        if(format.has(QIO_FEATURE_BLOCK_HASH)) {
+            uint64_t stored_block_hash;
+            if(myFile.read(reinterpret_cast<char*>(&stored_block_hash), sizeof(stored_block_hash)) != sizeof(stored_block_hash)) {
+                throw std::runtime_error("Unexpected end of file while reading block hash");
+            }
+            env.update(stored_block_hash);
+            corrupt = qio_block_hash(reinterpret_cast<char*>(zblock.data()), bytes_read) != stored_block_hash;
+            if(corrupt) {
+                std::get<4>(output).push_back(static_cast<int>(std::get<0>(output).size()) + 1); // 1-based, as in R
+            }
+        } else {
+            env.update(reinterpret_cast<char*>(zblock.data()), bytes_read);
+        }
 
         int shuffled = (zsize & SHUFFLE_MASK) > 0 ? 1 : 0;
 
-        uint32_t blocksize = dp.decompress(reinterpret_cast<char*>(block.data()), MAX_BLOCKSIZE,
-                                           reinterpret_cast<char*>(zblock.data()), zsize);
+        uint32_t blocksize;
+        if(format.has(QIO_FEATURE_STORED_BLOCKS) && is_stored_block(zsize) && bytes_read <= block_size) {
+            std::memcpy(block.data(), zblock.data(), bytes_read);
+            blocksize = bytes_read;
+        } else {
+            blocksize = dp.decompress(reinterpret_cast<char*>(block.data()), block_size,
+                                      reinterpret_cast<char*>(zblock.data()), zsize);
+        }
         if(decompressor::is_error(blocksize)) {
-            throw std::runtime_error("Decompression error");
+            // a block already reported as corrupt is dumped empty rather than ending the dump
+            if(!corrupt) throw std::runtime_error("Decompression error");
+            blocksize = 0;
         }
         
         zblock.resize(bytes_read);
@@ -53,7 +84,8 @@ qx_dump_impl(stream_reader & myFile) {
         std::get<1>(output).push_back(std::move(block));
         std::get<2>(output).push_back(shuffled);
     }
-    std::get<3>(output) = std::to_string(env.digest());
+    // a stream with a corrupted block hashes to 0, as in the block readers
+    std::get<3>(output) = std::to_string(std::get<4>(output).empty() ? env.digest() : 0);
     return output;
 }
 
@@ -11,13 +11,14 @@
 
 #include "io/block_module.h"
 #include "io/filestream_module.h"
+#include "io/mmap_module.h"
 #include "io/xxhash_module.h"
 #include "io/zstd_module.h"
 #ifndef RCPP_PARALLEL_USE_TBB
 #define RCPP_PARALLEL_USE_TBB 0
 #endif
 #if RCPP_PARALLEL_USE_TBB
-#include <tbb/global_control.h>
+#define QIO_HAS_TBB 1 // RcppParallel's TBB backs the multithreaded block modules
 #include "io/multithreaded_block_module.h"
 #endif
 
@@ -68,6 +69,8 @@ SEXP qd_deserialize(SEXP input, const bool use_alt_rep, const bool validate_chec
 // qx utility functions
 // [[Rcpp::export(rng = false)]]
 SEXP qx_dump(SEXP file);
+// [[Rcpp::export(rng = false, signature = {objects, format = "qs2", dictionary_size = 112640L})]]
+SEXP qx_train_dictionary(SEXP objects, SEXP format, int dictionary_size);
 // [[Rcpp::export(rng = false)]]
 SEXP check_SIMD();
 // [[Rcpp::export(rng = false)]]
@@ -184,13 +187,58 @@ SEXP blocks_to_list_unprotected(std::vector<std::vector<unsigned char>>& blocks)
     return out;
 }
 
+// Optional block stream features requested through qopt(). None are set by
+// default, so files stay readable by releases that predate them.
+QioFormat qx_write_format(const bool shuffle) {
+    QioFormat format;
+    if (qs2_block_index) format.features |= QIO_FEATURE_BLOCK_INDEX;
+    if (qs2_block_hash) format.features |= QIO_FEATURE_BLOCK_HASH;
+    if (qs2_stored_blocks) format.features |= QIO_FEATURE_STORED_BLOCKS;
+    if (shuffle && qs2_bitshuffle) format.features |= QIO_FEATURE_BITSHUFFLE;
+    format.set_block_size(static_cast<uint32_t>(qs2_block_size)); // validated by qs2_set_block_size
+    if (qs2_dictionary) format.set_dictionary(qs2_dictionary->id());
+    format.set_long_range(qs2_long_range);
+    return format;
+}
+
+// qdata pushes its numeric payloads with their element size; qs2 blocks hold
+// R's serialization stream, which has none, so only qdata writes record it
+QioFormat qd_write_format(const bool shuffle) {
+    QioFormat format = qx_write_format(shuffle);
+    if (shuffle && qs2_typed_shuffle) format.features |= QIO_FEATURE_SHUFFLE_ELEMSIZE;
+    return format;
+}
+
+// Reader settings from qopt(); a negative read_ahead_blocks is treated as automatic.
+// nthreads sizes the multithreaded reader's arena, so tbb::global_control is left alone.
+QioReadOptions qx_read_options(const int nthreads) {
+    QioReadOptions io_options;
+    io_options.nthreads = nthreads > 1 ? static_cast<uint32_t>(nthreads) : 1;
+    io_options.read_ahead_blocks = qs2_read_ahead_blocks > 0 ? static_cast<uint32_t>(qs2_read_ahead_blocks) : 0;
+    io_options.single_pass_checksum = qs2_single_pass_checksum;
+    io_options.dictionary = qs2_dictionary;
+    return io_options;
+}
+
+// Writer settings from qopt(); a negative shuffle_decision_reuse is treated as 0
+// and a negative write_queue_blocks as automatic.
+QioWriteOptions qx_write_options(const int nthreads) {
+    QioWriteOptions io_options;
+    io_options.nthreads = nthreads > 1 ? static_cast<uint32_t>(nthreads) : 1;
+    io_options.shuffle_decision_reuse = qs2_shuffle_decision_reuse > 0 ? static_cast<uint32_t>(qs2_shuffle_decision_reuse) : 0;
+    io_options.write_queue_blocks = qs2_write_queue_blocks > 0 ? static_cast<uint32_t>(qs2_write_queue_blocks) : 0;
+    io_options.dictionary = qs2_dictionary;
+    return io_options;
+}
+
 }  // namespace
 
 ///////////////////////////////////////////////////////////////////////////////
 /* qs2 format functions */
 
 #define DO_QS_SAVE(_STREAM_WRITER_, _BASE_CLASS_, _COMPRESSOR_, _HASHER_)                                                  \
-    _BASE_CLASS_<_STREAM_WRITER_, _COMPRESSOR_, _HASHER_, RErrorPolicy, false> block_io(myFile, compress_level);           \
+    _BASE_CLASS_<_STREAM_WRITER_, _COMPRESSOR_, _HASHER_, RErrorPolicy, false> block_io(                                   \
+        myFile, compress_level, format, qx_write_options(nthreads));                                                       \
     qx_with_unwind_cleanup(                                                                                                \
         block_io,                                                                                                          \
         [&]() -> SEXP {                                                                                                    \
@@ -213,12 +261,12 @@ SEXP qs_save(SEXP object, SEXP file, const int compress_level, const bool shuffl
     if (!myFile.isValid()) {
         throw_error<StdErrorPolicy>(FILE_SAVE_ERR_MSG);
     }
-    write_qs2_header(myFile, shuffle);
+    const QioFormat format = qx_write_format(shuffle);
+    write_qs2_header(myFile, shuffle, format);
 
     uint64_t hash = 0;
-    if (nthreads > 1) {
+    if (nthreads > 1 && qio_parallel_blocks(format)) {
 #if RCPP_PARALLEL_USE_TBB
-        tbb::global_control gc(tbb::global_control::parameter::max_allowed_parallelism, nthreads);
         if (shuffle) {
             DO_QS_SAVE(OfStreamWriter, BlockCompressWriterMT, ZstdShuffleCompressor, xxHashEnv);
         } else {
@@ -244,12 +292,12 @@ MemoryBuffer qs_serialize_impl(SEXP object, const int compress_level, const bool
     }
 
     MemoryWriter myFile;
-    write_qs2_header(myFile, shuffle);
+    const QioFormat format = qx_write_format(shuffle);
+    write_qs2_header(myFile, shuffle, format);
 
     uint64_t hash = 0;
-    if (nthreads > 1) {
+    if (nthreads > 1 && qio_parallel_blocks(format)) {
 #if RCPP_PARALLEL_USE_TBB
-        tbb::global_control gc(tbb::global_control::parameter::max_allowed_parallelism, nthreads);
         if (shuffle) {
             DO_QS_SAVE(MemoryWriter, BlockCompressWriterMT, ZstdShuffleCompressor, xxHashEnv);
         } else {
@@ -275,7 +323,7 @@ SEXP qs_serialize(SEXP object, const int compress_level, const bool shuffle, int
 }
 
 #define DO_QS_READ(_STREAM_READER_, _BASE_CLASS_, _DECOMPRESSOR_, _RUNTIME_HASH_)                                             \
-    _BASE_CLASS_<_STREAM_READER_, _DECOMPRESSOR_, RErrorPolicy> block_io(myFile);                                             \
+    _BASE_CLASS_<_STREAM_READER_, _DECOMPRESSOR_, RErrorPolicy> block_io(myFile, format, io_options);                         \
     PROTECT(output = qx_with_unwind_cleanup(block_io, [&]() -> SEXP {                                                        \
         struct R_inpstream_st in;                                                                                             \
         R_UnserializeInit<_BASE_CLASS_<_STREAM_READER_, _DECOMPRESSOR_, RErrorPolicy>>(&in, (R_pstream_data_t)(&block_io)); \
@@ -285,6 +333,48 @@ SEXP qs_serialize(SEXP object, const int compress_level, const bool shuffle, int
         return protected_output;                                                                                              \
     }));
 
+// Reads a qs2 file from an opened stream. Returns with the result PROTECTed; the caller releases it.
+template <class StreamReader>
+SEXP qs_read_file(StreamReader& myFile, const char* const file_path, const bool validate_checksum, const int nthreads,
+                  uint64_t& runtime_hash, uint64_t& stored_hash) {
+    SEXP output = R_NilValue;
+    bool shuffle;
+    QioFormat format;
+    const QioReadOptions io_options = qx_read_options(nthreads);
+    read_qs2_header(myFile, shuffle, stored_hash, format);
+    if (const char* const dictionary_error = qio_dictionary_error(format, io_options.dictionary.get())) {
+        throw_error<StdErrorPolicy>(std::string("For file ") + file_path + ": " + dictionary_error);
+    }
+    if (validate_checksum) {
+        if (stored_hash == 0) {
+            throw_error<StdErrorPolicy>(NO_HASH_ERR_MSG);
+        }
+        if (!io_options.single_pass_checksum) {
+            uint64_t computed_hash = read_qx_hash(myFile, format);
+            if (computed_hash != stored_hash) {
+                throw_error<StdErrorPolicy>(HASH_MISMATCH_ERR_MSG);
+            }
+        }
+    }
+
+    if (nthreads > 1 && qio_parallel_blocks(format)) {
+#if RCPP_PARALLEL_USE_TBB != 0
+        if (shuffle) {
+            DO_QS_READ(StreamReader, BlockCompressReaderMT, ZstdShuffleDecompressor, runtime_hash);
+        } else {
+            DO_QS_READ(StreamReader, BlockCompressReaderMT, ZstdDecompressor, runtime_hash);
+        }
+#endif
+    } else {
+        if (shuffle) {
+            DO_QS_READ(StreamReader, BlockCompressReader, ZstdShuffleDecompressor, runtime_hash);
+        } else {
+            DO_QS_READ(StreamReader, BlockCompressReader, ZstdDecompressor, runtime_hash);
+        }
+    }
+    return output;
+}
+
 SEXP qs_read(SEXP file, const bool validate_checksum, int nthreads) {
     const char* const file_path = qs2_as_single_string(file, "file");
     nthreads = normalize_nthreads(nthreads);
@@ -293,38 +383,22 @@ SEXP qs_read(SEXP file, const bool validate_checksum, int nthreads) {
     uint64_t runtime_hash = 0;
     uint64_t stored_hash = 0;
     {
-        IfStreamReader myFile(R_ExpandFileName(file_path));
-        if (!myFile.isValid()) {
-            throw_error<StdErrorPolicy>(FILE_READ_ERR_MSG);
-        }
-
-        bool shuffle;
-        read_qs2_header(myFile, shuffle, stored_hash);
-        if (validate_checksum) {
-            if (stored_hash == 0) {
-                throw_error<StdErrorPolicy>(NO_HASH_ERR_MSG);
-            }
-            uint64_t computed_hash = read_qx_hash(myFile);
-            if (computed_hash != stored_hash) {
-                throw_error<StdErrorPolicy>(HASH_MISMATCH_ERR_MSG);
+        bool mapped = false;
+#ifdef QIO_HAS_MMAP
+        if (qs2_use_mmap) {
+            MmapFileReader myFile(R_ExpandFileName(file_path));
+            if (myFile.isValid()) {
+                output = qs_read_file(myFile, file_path, validate_checksum, nthreads, runtime_hash, stored_hash);
+                mapped = true;
             }
         }
-
-        if (nthreads > 1) {
-#if RCPP_PARALLEL_USE_TBB != 0
-            tbb::global_control gc(tbb::global_control::parameter::max_allowed_parallelism, nthreads);
-            if (shuffle) {
-                DO_QS_READ(IfStreamReader, BlockCompressReaderMT, ZstdShuffleDecompressor, runtime_hash);
-            } else {
-                DO_QS_READ(IfStreamReader, BlockCompressReaderMT, ZstdDecompressor, runtime_hash);
-            }
 #endif
-        } else {
-            if (shuffle) {
-                DO_QS_READ(IfStreamReader, BlockCompressReader, ZstdShuffleDecompressor, runtime_hash);
-            } else {
-                DO_QS_READ(IfStreamReader, BlockCompressReader, ZstdDecompressor, runtime_hash);
+        if (!mapped) {
+            IfStreamReader myFile(R_ExpandFileName(file_path));
+            if (!myFile.isValid()) {
+                throw_error<StdErrorPolicy>(FILE_READ_ERR_MSG);
             }
+            output = qs_read_file(myFile, file_path, validate_checksum, nthreads, runtime_hash, stored_hash);
         }
     }
     if (!validate_checksum) {
@@ -335,6 +409,10 @@ SEXP qs_read(SEXP file, const bool validate_checksum, int nthreads) {
         }
     }
     UNPROTECT(1);
+    // single pass validation: the object is built before the hash is known, so drop it here
+    if (validate_checksum && runtime_hash != stored_hash) {
+        throw_error<StdErrorPolicy>(HASH_MISMATCH_ERR_MSG);
+    }
     return output;
 }
 
@@ -343,22 +421,28 @@ SEXP qs_deserialize_impl(MemoryReader& myFile, const bool validate_checksum, int
 
     bool shuffle;
     uint64_t stored_hash;
-    read_qs2_header(myFile, shuffle, stored_hash);
+    QioFormat format;
+    const QioReadOptions io_options = qx_read_options(nthreads);
+    read_qs2_header(myFile, shuffle, stored_hash, format);
+    if (const char* const dictionary_error = qio_dictionary_error(format, io_options.dictionary.get())) {
+        throw_error<StdErrorPolicy>(dictionary_error);
+    }
     if (validate_checksum) {
         if (stored_hash == 0) {
             throw_error<StdErrorPolicy>(IN_MEMORY_NO_HASH_ERR_MSG);
         }
-        uint64_t computed_hash = read_qx_hash(myFile);
-        if (computed_hash != stored_hash) {
-            throw_error<StdErrorPolicy>(IN_MEMORY_HASH_MISMATCH_ERR_MSG);
+        if (!io_options.single_pass_checksum) {
+            uint64_t computed_hash = read_qx_hash(myFile, format);
+            if (computed_hash != stored_hash) {
+                throw_error<StdErrorPolicy>(IN_MEMORY_HASH_MISMATCH_ERR_MSG);
+            }
         }
     }
 
     SEXP output = R_NilValue;
     uint64_t runtime_hash = 0;
-    if (nthreads > 1) {
+    if (nthreads > 1 && qio_parallel_blocks(format)) {
 #if RCPP_PARALLEL_USE_TBB != 0
-        tbb::global_control gc(tbb::global_control::parameter::max_allowed_parallelism, nthreads);
         if (shuffle) {
             DO_QS_READ(MemoryReader, BlockCompressReaderMT, ZstdShuffleDecompressor, runtime_hash);
         } else {
@@ -380,6 +464,10 @@ SEXP qs_deserialize_impl(MemoryReader& myFile, const bool validate_checksum, int
         }
     }
     UNPROTECT(1);
+    // single pass validation: the object is built before the hash is known, so drop it here
+    if (validate_checksum && runtime_hash != stored_hash) {
+        throw_error<StdErrorPolicy>(IN_MEMORY_HASH_MISMATCH_ERR_MSG);
+    }
     return output;
 }
 
@@ -398,7 +486,7 @@ inline void warn_if_qdata_altrep_requested(const bool use_alt_rep) {
 }
 
 #define DO_QD_SAVE(_STREAM_WRITER_, _BASE_CLASS_, _COMPRESSOR_, _HASHER_)                                                                          \
-    _BASE_CLASS_<_STREAM_WRITER_, _COMPRESSOR_, _HASHER_, StdErrorPolicy, true> writer(myFile, compress_level);                                   \
+    _BASE_CLASS_<_STREAM_WRITER_, _COMPRESSOR_, _HASHER_, StdErrorPolicy, true> writer(myFile, compress_level, format, qx_write_options(nthreads)); \
     QdataSerializer<_BASE_CLASS_<_STREAM_WRITER_, _COMPRESSOR_, _HASHER_, StdErrorPolicy, true>> serializer(writer, warn_unsupported_types);      \
     qx_with_unwind_cleanup(                                                                                                                        \
         writer,                                                                                                                                     \
@@ -425,11 +513,11 @@ SEXP qd_save(SEXP object, SEXP file, const int compress_level, const bool shuffl
     if (!myFile.isValid()) {
         throw std::runtime_error(FILE_SAVE_ERR_MSG);
     }
-    write_qdata_header(myFile, shuffle);
+    const QioFormat format = qd_write_format(shuffle);
+    write_qdata_header(myFile, shuffle, format);
     uint64_t hash = 0;
-    if (nthreads > 1) {
+    if (nthreads > 1 && qio_parallel_blocks(format)) {
 #if RCPP_PARALLEL_USE_TBB
-        tbb::global_control gc(tbb::global_control::parameter::max_allowed_parallelism, nthreads);
         if (shuffle) {
             DO_QD_SAVE(OfStreamWriter, BlockCompressWriterMT, ZstdShuffleCompressor, xxHashEnv);
         } else {
@@ -455,11 +543,11 @@ MemoryBuffer qd_serialize_impl(SEXP object, const int compress_level, const bool
     }
 
     MemoryWriter myFile;
-    write_qdata_header(myFile, shuffle);
+    const QioFormat format = qd_write_format(shuffle);
+    write_qdata_header(myFile, shuffle, format);
     uint64_t hash = 0;
-    if (nthreads > 1) {
+    if (nthreads > 1 && qio_parallel_blocks(format)) {
 #if RCPP_PARALLEL_USE_TBB
-        tbb::global_control gc(tbb::global_control::parameter::max_allowed_parallelism, nthreads);
         if (shuffle) {
             DO_QD_SAVE(MemoryWriter, BlockCompressWriterMT, ZstdShuffleCompressor, xxHashEnv);
         } else {
@@ -486,12 +574,54 @@ SEXP qd_serialize(SEXP object, const int compress_level, const bool shuffle, con
 
 // DO_QD_READ macro assigns SEXP output
 #define DO_QD_READ(_STREAM_READER_, _BASE_CLASS_, _DECOMPRESSOR_, _RUNTIME_HASH_)                                             \
-    _BASE_CLASS_<_STREAM_READER_, _DECOMPRESSOR_, StdErrorPolicy> reader(myFile);                                             \
+    _BASE_CLASS_<_STREAM_READER_, _DECOMPRESSOR_, StdErrorPolicy> reader(myFile, format, io_options);                         \
     QdataDeserializer<_BASE_CLASS_<_STREAM_READER_, _DECOMPRESSOR_, StdErrorPolicy>> deserializer(reader);                    \
     PROTECT(output = qx_with_unwind_cleanup(reader, [&]() -> SEXP {                                                          \
         return deserializer.read_root_object(_RUNTIME_HASH_);                                                                \
     }));
 
+// Reads a qdata file from an opened stream. Returns with the result PROTECTed; the caller releases it.
+template <class StreamReader>
+SEXP qd_read_file(StreamReader& myFile, const char* const file_path, const bool validate_checksum, const int nthreads,
+                  uint64_t& runtime_hash, uint64_t& stored_hash) {
+    SEXP output = R_NilValue;
+    bool shuffle;
+    QioFormat format;
+    const QioReadOptions io_options = qx_read_options(nthreads);
+    read_qdata_header(myFile, shuffle, stored_hash, format);
+    if (const char* const dictionary_error = qio_dictionary_error(format, io_options.dictionary.get())) {
+        throw std::runtime_error(std::string("For file ") + file_path + ": " + dictionary_error);
+    }
+    if (validate_checksum) {
+        if (stored_hash == 0) {
+            throw std::runtime_error(NO_HASH_ERR_MSG);
+        }
+        if (!io_options.single_pass_checksum) {
+            uint64_t computed_hash = read_qx_hash(myFile, format);
+            if (computed_hash != stored_hash) {
+                throw_error<StdErrorPolicy>(HASH_MISMATCH_ERR_MSG);
+            }
+        }
+    }
+
+    if (nthreads > 1 && qio_parallel_blocks(format)) {
+#if RCPP_PARALLEL_USE_TBB != 0
+        if (shuffle) {
+            DO_QD_READ(StreamReader, BlockCompressReaderMT, ZstdShuffleDecompressor, runtime_hash);
+        } else {
+            DO_QD_READ(StreamReader, BlockCompressReaderMT, ZstdDecompressor, runtime_hash);
+        }
+#endif
+    } else {
+        if (shuffle) {
+            DO_QD_READ(StreamReader, BlockCompressReader, ZstdShuffleDecompressor, runtime_hash);
+        } else {
+            DO_QD_READ(StreamReader, BlockCompressReader, ZstdDecompressor, runtime_hash);
+        }
+    }
+    return output;
+}
+
 SEXP qd_read(SEXP file, const bool use_alt_rep, const bool validate_checksum, int nthreads) {
     const char* const file_path = qs2_as_single_string(file, "file");
     nthreads = normalize_nthreads(nthreads);
@@ -502,38 +632,22 @@ SEXP qd_read(SEXP file, const bool use_alt_rep, const bool validate_checksum, in
     uint64_t runtime_hash = 0;
     uint64_t stored_hash = 0;
     {
-        IfStreamReader myFile(R_ExpandFileName(file_path));
-        if (!myFile.isValid()) {
-            throw std::runtime_error(FILE_READ_ERR_MSG);
-        }
-
-        bool shuffle;
-        read_qdata_header(myFile, shuffle, stored_hash);
-        if (validate_checksum) {
-            if (stored_hash == 0) {
-                throw std::runtime_error(NO_HASH_ERR_MSG);
-            }
-            uint64_t computed_hash = read_qx_hash(myFile);
-            if (computed_hash != stored_hash) {
-                throw_error<StdErrorPolicy>(HASH_MISMATCH_ERR_MSG);
+        bool mapped = false;
+#ifdef QIO_HAS_MMAP
+        if (qs2_use_mmap) {
+            MmapFileReader myFile(R_ExpandFileName(file_path));
+            if (myFile.isValid()) {
+                output = qd_read_file(myFile, file_path, validate_checksum, nthreads, runtime_hash, stored_hash);
+                mapped = true;
             }
         }
-
-        if (nthreads > 1) {
-#if RCPP_PARALLEL_USE_TBB != 0
-            tbb::global_control gc(tbb::global_control::parameter::max_allowed_parallelism, nthreads);
-            if (shuffle) {
-                DO_QD_READ(IfStreamReader, BlockCompressReaderMT, ZstdShuffleDecompressor, runtime_hash);
-            } else {
-                DO_QD_READ(IfStreamReader, BlockCompressReaderMT, ZstdDecompressor, runtime_hash);
-            }
 #endif
-        } else {
-            if (shuffle) {
-                DO_QD_READ(IfStreamReader, BlockCompressReader, ZstdShuffleDecompressor, runtime_hash);
-            } else {
-                DO_QD_READ(IfStreamReader, BlockCompressReader, ZstdDecompressor, runtime_hash);
+        if (!mapped) {
+            IfStreamReader myFile(R_ExpandFileName(file_path));
+            if (!myFile.isValid()) {
+                throw std::runtime_error(FILE_READ_ERR_MSG);
             }
+            output = qd_read_file(myFile, file_path, validate_checksum, nthreads, runtime_hash, stored_hash);
         }
     }
     if (!validate_checksum) {
@@ -544,6 +658,10 @@ SEXP qd_read(SEXP file, const bool use_alt_rep, const bool validate_checksum, in
         }
     }
     UNPROTECT(1);
+    // single pass validation: the object is built before the hash is known, so drop it here
+    if (validate_checksum && runtime_hash != stored_hash) {
+        throw_error<StdErrorPolicy>(HASH_MISMATCH_ERR_MSG);
+    }
     return output;
 }
 
@@ -552,22 +670,28 @@ SEXP qd_deserialize_impl(MemoryReader& myFile, const bool validate_checksum, int
 
     bool shuffle;
     uint64_t stored_hash;
-    read_qdata_header(myFile, shuffle, stored_hash);
+    QioFormat format;
+    const QioReadOptions io_options = qx_read_options(nthreads);
+    read_qdata_header(myFile, shuffle, stored_hash, format);
+    if (const char* const dictionary_error = qio_dictionary_error(format, io_options.dictionary.get())) {
+        throw std::runtime_error(dictionary_error);
+    }
     if (validate_checksum) {
         if (stored_hash == 0) {
             throw std::runtime_error(IN_MEMORY_NO_HASH_ERR_MSG);
         }
-        uint64_t computed_hash = read_qx_hash(myFile);
-        if (computed_hash != stored_hash) {
-            throw_error<StdErrorPolicy>(IN_MEMORY_HASH_MISMATCH_ERR_MSG);
+        if (!io_options.single_pass_checksum) {
+            uint64_t computed_hash = read_qx_hash(myFile, format);
+            if (computed_hash != stored_hash) {
+                throw_error<StdErrorPolicy>(IN_MEMORY_HASH_MISMATCH_ERR_MSG);
+            }
         }
     }
 
     SEXP output = R_NilValue;
     uint64_t runtime_hash = 0;
-    if (nthreads > 1) {
+    if (nthreads > 1 && qio_parallel_blocks(format)) {
 #if RCPP_PARALLEL_USE_TBB != 0
-        tbb::global_control gc(tbb::global_control::parameter::max_allowed_parallelism, nthreads);
         if (shuffle) {
             DO_QD_READ(MemoryReader, BlockCompressReaderMT, ZstdShuffleDecompressor, runtime_hash);
         } else {
@@ -589,6 +713,10 @@ SEXP qd_deserialize_impl(MemoryReader& myFile, const bool validate_checksum, int
         }
     }
     UNPROTECT(1);
+    // single pass validation: the object is built before the hash is known, so drop it here
+    if (validate_checksum && runtime_hash != stored_hash) {
+        throw_error<StdErrorPolicy>(IN_MEMORY_HASH_MISMATCH_ERR_MSG);
+    }
     return output;
 }
 
@@ -612,19 +740,22 @@ SEXP qx_dump(SEXP file) {
         throw std::runtime_error(FILE_READ_ERR_MSG);
     }
     qxHeaderInfo header_info = read_qx_header(myFile);
+    if (const char* const dictionary_error = qio_dictionary_error(header_info.block_format, qs2_dictionary.get())) {
+        throw std::runtime_error(std::string("For file ") + file_path + ": " + dictionary_error);
+    }
 
-    std::tuple<std::vector<std::vector<unsigned char>>, std::vector<std::vector<unsigned char>>, std::vector<int>, std::string> output;
+    std::tuple<std::vector<std::vector<unsigned char>>, std::vector<std::vector<unsigned char>>, std::vector<int>, std::string, std::vector<int>> output;
     if (header_info.shuffle) {
-        output = qx_dump_impl<IfStreamReader, ZstdShuffleDecompressor>(myFile);
+        output = qx_dump_impl<IfStreamReader, ZstdShuffleDecompressor>(myFile, header_info.block_format, qs2_dictionary.get());
     } else {
-        output = qx_dump_impl<IfStreamReader, ZstdDecompressor>(myFile);
+        output = qx_dump_impl<IfStreamReader, ZstdDecompressor>(myFile, header_info.block_format, qs2_dictionary.get());
     }
 
     return qx_unwind_protect([&]() -> SEXP {
-        constexpr int output_size = 10;
+        constexpr int output_size = 12;
         const char* output_names[output_size] = {
-            "format", "format_version", "compression", "shuffle", "file_endian",
-            "stored_hash", "computed_hash", "zblocks", "blocks", "block_shuffled"
+            "format", "format_version", "compression", "shuffle", "file_endian", "block_size",
+            "stored_hash", "computed_hash", "zblocks", "blocks", "block_shuffled", "corrupt_blocks"
         };
         SEXP result = PROTECT(Rf_allocVector(VECSXP, output_size));
         SEXP names = PROTECT(Rf_allocVector(STRSXP, output_size));
@@ -637,40 +768,98 @@ SEXP qx_dump(SEXP file) {
         SET_VECTOR_ELT(result, 2, Rf_mkString(header_info.compression.c_str()));
         SET_VECTOR_ELT(result, 3, Rf_ScalarInteger(header_info.shuffle));
         SET_VECTOR_ELT(result, 4, Rf_mkString(header_info.file_endian.c_str()));
-        SET_VECTOR_ELT(result, 5, Rf_mkString(header_info.stored_hash.c_str()));
-        SET_VECTOR_ELT(result, 6, Rf_mkString(std::get<3>(output).c_str()));
+        SET_VECTOR_ELT(result, 5, Rf_ScalarInteger(static_cast<int>(header_info.block_format.block_size())));
+        SET_VECTOR_ELT(result, 6, Rf_mkString(header_info.stored_hash.c_str()));
+        SET_VECTOR_ELT(result, 7, Rf_mkString(std::get<3>(output).c_str()));
 
         SEXP zblocks = PROTECT(blocks_to_list_unprotected(std::get<0>(output)));
-        SET_VECTOR_ELT(result, 7, zblocks);
+        SET_VECTOR_ELT(result, 8, zblocks);
         UNPROTECT(1);
         SEXP blocks = PROTECT(blocks_to_list_unprotected(std::get<1>(output)));
-        SET_VECTOR_ELT(result, 8, blocks);
+        SET_VECTOR_ELT(result, 9, blocks);
         UNPROTECT(1);
 
         const std::vector<int>& block_shuffled = std::get<2>(output);
         SEXP shuffled = Rf_allocVector(INTSXP, static_cast<R_xlen_t>(block_shuffled.size()));
-        SET_VECTOR_ELT(result, 9, shuffled);
+        SET_VECTOR_ELT(result, 10, shuffled);
         if (!block_shuffled.empty()) {
             std::memcpy(INTEGER(shuffled), block_shuffled.data(), block_shuffled.size() * sizeof(int));
         }
 
+        const std::vector<int>& corrupt_block_numbers = std::get<4>(output);
+        SEXP corrupt_blocks = Rf_allocVector(INTSXP, static_cast<R_xlen_t>(corrupt_block_numbers.size()));
+        SET_VECTOR_ELT(result, 11, corrupt_blocks);
+        if (!corrupt_block_numbers.empty()) {
+            std::memcpy(INTEGER(corrupt_blocks), corrupt_block_numbers.data(), corrupt_block_numbers.size() * sizeof(int));
+        }
+
         Rf_setAttrib(result, R_NamesSymbol, names);
         UNPROTECT(2);
         return result;
     });
 }
 
+// Each object is serialized on its own, as save and serialize would with the
+// current qopt() settings, and its uncompressed blocks become the training
+// samples, so the dictionary matches what the compressors are given.
+SEXP qx_train_dictionary(SEXP objects, SEXP format, const int dictionary_size) {
+    const char* const format_name = qs2_as_single_string(format, "format");
+    const bool qdata = std::strcmp(format_name, "qdata") == 0;
+    if (!qdata && std::strcmp(format_name, "qs2") != 0) {
+        throw std::runtime_error("format must be \"qs2\" or \"qdata\"");
+    }
+    if (TYPEOF(objects) != VECSXP) {
+        throw std::runtime_error("objects must be a list");
+    }
+    if (dictionary_size == NA_INTEGER || dictionary_size <= 0) {
+        throw std::runtime_error("dictionary_size must be a positive integer");
+    }
+    // no dictionary is recorded while sampling, which would be used by no one
+    QioFormat block_format = qdata ? qd_write_format(false) : qx_write_format(false);
+    block_format.set_dictionary(0);
+
+    QioDictionarySampler sampler;
+    QioDiscardWriter myFile;
+    for (R_xlen_t i = 0; i < Rf_xlength(objects); ++i) {
+        SEXP object = VECTOR_ELT(objects, i);
+        if (qdata) {
+            BlockCompressWriter<QioDiscardWriter, QioDictionarySampler, xxHashEnv, StdErrorPolicy, true> writer(myFile, 0, block_format);
+            std::swap(writer.cp, sampler);
+            QdataSerializer<decltype(writer)> serializer(writer, false);
+            qx_with_unwind_cleanup(writer, [&]() -> SEXP {
+                serializer.write_object(object);
+                serializer.write_object_data();
+                writer.finish();
+                return R_NilValue;
+            });
+            std::swap(writer.cp, sampler);
+        } else {
+            BlockCompressWriter<QioDiscardWriter, QioDictionarySampler, xxHashEnv, RErrorPolicy, false> block_io(myFile, 0, block_format);
+            std::swap(block_io.cp, sampler);
+            uint64_t hash = 0;
+            qx_with_unwind_cleanup(block_io, [&]() -> SEXP {
+                struct R_outpstream_st out;
+                R_SerializeInit(&out, block_io);
+                qsSaveImplArgs args = {object, hash, &out};
+                return qs_save_impl<decltype(block_io)>(static_cast<void*>(&args));
+            });
+            std::swap(block_io.cp, sampler);
+        }
+    }
+    const std::vector<char> dictionary = qio_train_dictionary(sampler.samples, sampler.sample_sizes, static_cast<size_t>(dictionary_size));
+    return qx_unwind_protect([&]() -> SEXP {
+        SEXP out = Rf_allocVector(RAWSXP, static_cast<R_xlen_t>(dictionary.size()));
+        std::memcpy(RAW(out), dictionary.data(), dictionary.size());
+        return out;
+    });
+}
+
 // Returns SEXP rather than std::string for the same reason the arguments take
 // SEXP: Rcpp::wrap() of a returned std::string allocates, and an allocation
-// failure there would jump past the temporary's destructor.
+// failure there would jump past the temporary's destructor. Reports the
+// shuffle kernels chosen at runtime, not the compile flags.
 SEXP check_SIMD() {
-#if defined(__AVX2__)
-    return alloc_string("AVX2");
-#elif defined(__SSE2__)
-    return alloc_string("SSE2");
-#else
-    return alloc_string("no SIMD");
-#endif
+    return alloc_string(qio_simd_name(qio_simd_level()));
 }
 
 bool check_TBB() {
@@ -686,8 +875,8 @@ SEXP internal_compute_qx_hash(SEXP file) {
         if (!myFile.isValid()) {
             throw_error<StdErrorPolicy>(FILE_READ_ERR_MSG);
         }
-        myFile.seekg(24);
-        hash = read_qx_hash(myFile);
+        const qxHeaderInfo header_info = read_qx_header(myFile);
+        hash = read_qx_hash(myFile, header_info.block_format);
     }
     char digest[32];
     std::snprintf(digest, sizeof(digest), "%llu", static_cast<unsigned long long>(hash));